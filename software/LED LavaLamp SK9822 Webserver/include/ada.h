@@ -0,0 +1,75 @@
+/*
+  LED LAVA LAMP - LED frames over the serial port (Adalight)
+
+  Host software (Prismatik, Hyperion, ... or scripts/ada_send.py) can
+  drive the LED in real time over USB serial, without WiFi latency or
+  jitter. The port runs at ADA_BAUD and takes Adalight frames:
+
+    'A' 'd' 'a' hi lo check     header, LED count - 1 = hi * 256 + lo,
+                                check = hi ^ lo ^ 0x55
+    r g b ... r g b             one pixel per LED
+
+  The pixels go straight into LED_fb as they arrive, at the brightness
+  of the zone they fall in, and the frame is shown as soon as its last
+  byte is read, not at the next display cycle. LEDs beyond LED_COUNT are
+  skipped, missing ones keep their color. Anything else on the port
+  (a bad check byte, a frame cut short for ADA_BYTE_MS) is dropped up
+  to the next "Ada".
+
+  While frames keep coming (for ADA_TIMEOUT_MS after the last one) they
+  own the framebuffer: the zones stop drawing, a playing show stops.
+  The lamp says "Ada\n" once at boot, as Adalight does, and answers
+  every frame shown with ADA_ACK, so a host can measure the latency
+  and pace itself. Debug output shares the port at the same baud rate;
+  Adalight hosts ignore it.
+
+  Builds with LED_PALETTE (see lamp.h) have no framebuffer for the
+  frames and ignore the port.
+
+  Every ADA_REPORT_MS while streaming the lamp prints frames per second,
+  bad headers, receive overruns and the latency from the first header
+  byte read to the LED written (like MQTT's cmd_us).
+
+ */
+
+#ifndef ADA_H
+#define ADA_H
+
+#include <Arduino.h>
+
+// Define the serial baud rate (debug output included)
+#define ADA_BAUD (1000000)
+
+// Define the serial receive buffer in bytes; it has to hold what
+// arrives while loop() is busy elsewhere (100 bytes/ms at ADA_BAUD)
+#define ADA_RX_BUF (1024)
+
+// Define the most pixel bytes read from the port in one go
+#define ADA_CHUNK (96)
+
+// Define how long a frame may stall before it is dropped in ms
+#define ADA_BYTE_MS (50)
+
+// Define how long the frames own the LED after the last one in ms
+#define ADA_TIMEOUT_MS (2000)
+
+// Define how often the statistics are printed while streaming in ms
+#define ADA_REPORT_MS (5000)
+
+// Define the byte sent back for every frame shown (ASCII ACK)
+#define ADA_ACK (0x06)
+
+// open the serial port at ADA_BAUD; call first thing in setup()
+void adaBegin();
+
+// read what the port has; true when a frame is complete in LED_fb
+// and has to be shown; call on every pass through loop()
+bool adaPoll();
+
+// the frame adaPoll() completed was written to the LED
+void adaShown();
+
+// frames are streaming and own the framebuffer
+bool adaActive();
+
+#endif
@@ -0,0 +1,54 @@
+/*
+  LED LAVA LAMP - per-channel LED calibration
+
+  SK9822 batches differ in how bright each color comes out, so plain
+  255,255,255 'Lamp' white is tinted. CALIB_FILE on LittleFS holds one
+  or more calibration profiles (one per strip batch), each with a gain
+  (I-V correction), gamma and white point per channel:
+
+    # comment
+    use batch-2023        profile to load (default: the first one)
+    profile batch-2023
+    gain 255,236,214      255 = 1.0
+    gamma 250,250,250     gamma x100
+    white 255,255,255     white point, 255 = full
+
+  When a COLOR PLAN is selected the calibration is folded into what the
+  frame loop reads: fused per-channel tables for sine plans (built once
+  per gamma setting), hue tables for hue plans (built per plan, kept
+  while a zone shows it) or the corrected color for fixed plans.
+
+ */
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <Arduino.h>
+#include <LavaEngine.h>
+#include "lamp.h"
+
+// Define the calibration file on LittleFS
+#define CALIB_FILE "/calib.txt"
+
+// Define the room for a profile name (including the 0)
+#define CALIB_NAME_LEN (24)
+
+// Define the longest line read from CALIB_FILE
+#define CALIB_LINE_MAX (64)
+
+// Define how many different hue plans the zones can show at once
+// (LAVA_HUE_LUT bytes of RAM each)
+#define CALIB_HUE_TABLES (2)
+
+extern LavaCalib calib;                     // calibration in use
+extern char calibProfile[CALIB_NAME_LEN];   // its profile name
+
+// read CALIB_FILE; without one the LEDs are not corrected
+void calibBegin();
+
+// put the calibrated colors of 'plan' into the frame (with no hue spread
+// unless it is a hue plan, so palettes drop to one entry); false (frame
+// untouched) for a hue plan when every hue table is shown by another zone
+bool calibPlan(const ColorPlan &plan, LavaFrame &f);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+  LED LAVA LAMP - heap monitor
+
+  The lamps stay up for months, so a slow leak or a heap that breaks up
+  into small pieces only shows after days. Every HEAP_SAMPLE_MS the free
+  heap, the largest free block (the biggest allocation that can still
+  succeed) and the SDK fragmentation figure are sampled; the last
+  HEAP_SAMPLES samples and the worst values since boot are printed on
+  Serial and served as JSON at /api/heap.
+
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <Arduino.h>
+
+// Define how often the heap is sampled in ms
+#define HEAP_SAMPLE_MS (600000UL)
+
+// Define how many samples are kept (36 x 10 minutes = 6 hours)
+#define HEAP_SAMPLES (36)
+
+struct HeapSample {
+  uint16_t free;        // free heap in bytes
+  uint16_t max_block;   // largest free block in bytes
+  uint8_t frag;         // fragmentation in %
+};
+
+// take the first sample; call once from setup()
+void heapBegin();
+
+// take a sample when one is due; call on every pass through loop()
+void heapPoll();
+
+// uptime at millis() 'now', worst values since boot and the kept
+// samples, oldest first; the same 'now' gives the same bytes, so a
+// counting pass and the sending pass agree on the length
+void heapJson(Print &out, uint32_t now);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+  LED LAVA LAMP - HTTP request parser
+
+  An incremental state machine fed straight from the TCP receive buffer
+  (WiFiClient::peekBuffer()), any number of bytes at a time. Nothing is
+  collected line by line: the method, path, query and the two headers
+  the web server needs (If-None-Match, Connection) are copied into
+  fixed-size slices as their bytes go by, everything else is skipped.
+
+  Request bodies are never read. A request announcing one (a non-zero
+  Content-Length, or any Transfer-Encoding) is marked 'close', so the
+  body can't be taken for the next request on the connection.
+
+  Limits are hard: a request line longer than HTTP_LINE_MAX or a path or
+  query that doesn't fit its slice is answered 414, a header line longer
+  than HTTP_LINE_MAX or more than HTTP_HEADERS_MAX header lines 431, and
+  anything that isn't HTTP/1.x 400. Parsing stops at the error, so a
+  client sending garbage costs nothing more than closing the connection.
+
+  httpParse() stops right after the blank line ending a request, so
+  pipelined requests stay in the receive buffer for the next one.
+
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <Arduino.h>
+
+// Define the longest request or header line (nothing is buffered per
+// line, so this only bounds what a client can make the lamp wade through)
+#define HTTP_LINE_MAX (1024)
+
+// Define the most header lines in one request
+#define HTTP_HEADERS_MAX (32)
+
+// Define the room for each slice (including the 0)
+#define HTTP_METHOD_MAX (8)
+#define HTTP_PATH_MAX (64)
+#define HTTP_QUERY_MAX (32)
+#define HTTP_ETAG_MAX (64)
+
+// Define the room for a header name or token being compared
+#define HTTP_TOKEN_MAX (20)
+
+struct HttpRequest {
+  uint8_t state;          // where the parser is (http.cpp)
+  uint8_t field;          // header whose value is being read
+  uint16_t status;        // 0, or the error status to answer with
+  bool done;              // a whole request (or an error) was parsed
+  bool close;             // close the connection after answering
+  uint8_t headers;        // header lines so far
+  uint16_t line;          // bytes of the current line so far
+  uint8_t len;            // bytes in the slice being filled
+  char method[HTTP_METHOD_MAX];
+  char path[HTTP_PATH_MAX];
+  char query[HTTP_QUERY_MAX];
+  char etag[HTTP_ETAG_MAX];       // If-None-Match value (may be a list)
+  char token[HTTP_TOKEN_MAX];     // header name, version or Connection value
+};
+
+// get ready for the next request
+void httpBegin(HttpRequest &r);
+
+// consume up to 'len' bytes of 'buf'; returns how many were used, which
+// is less than 'len' once r.done is set
+size_t httpParse(HttpRequest &r, const char *buf, size_t len);
+
+#endif
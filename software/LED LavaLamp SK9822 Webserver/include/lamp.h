@@ -0,0 +1,125 @@
+/*
+  LED LAVA LAMP - shared lamp state
+
+  Plan tables, zones and the lamp clock live in main.cpp; this header
+  lets the other modules (e.g. multi-lamp sync) reach them.
+
+  The chain is split into zones (ZONE_SIZES in main.cpp), each with its
+  own COLOR and BRIGHT PLAN, phase accumulators and pipeline. Every
+  frame each zone draws only its own LEDs into the framebuffer, which
+  then goes out in one pass, so a frame costs the same for one zone or
+  several. The lamp plan (curColorPlan / curBrightPlan, set with the
+  button, /m/N and /b/N) applies to every zone; /z/Z/m/N and /z/Z/b/N
+  change a single zone.
+
+  With LED_PALETTE the zones draw through palettes instead: each frame
+  a zone's pipeline draws only its palette (LAVA_PALETTE_SIZE entries,
+  one for plans without a hue) and every LED keeps one byte, its step
+  along the palette, set when the plan is selected. That is 1 byte per
+  LED instead of 4 and a frame no longer runs the pipeline per LED,
+  worth it on long chains. Recorded shows and serial frames bring a
+  color per LED and need the framebuffer, so they are off then.
+
+ */
+
+#ifndef LAMP_H
+#define LAMP_H
+
+#include <Arduino.h>
+#include <LavaEngine.h>
+
+// Define how many LED are in the chain (1..n)
+#define LED_COUNT (5)
+
+// Define whether the zones draw through palettes (1 byte per LED plus
+// LAVA_PALETTE_SIZE x 4 bytes per zone) instead of the framebuffer
+// (4 bytes per LED); shows and serial frames are off then
+#define LED_PALETTE (0)
+
+// Define the LED held by the framebuffer
+#define LED_FB_COUNT (LED_PALETTE ? 1 : LED_COUNT)
+
+// Define the display update cycle in ms
+#define CYCLE_MS (200)
+
+// Define the room for a plan name in its record (including the 0)
+#define PLAN_NAME_LEN (12)
+
+// where a hue plan (LAVA_COLOR_HSV, LAVA_COLOR_OKLAB) sits in its color
+// space; its 'init' and 'effect' are the start phases (x256) and phase
+// steps of { hue, level, - }, level following the sine table
+struct HuePath {
+  uint8_t a;          // saturation (HSV) or lightness (OKLAB)
+  uint8_t b;          // value (HSV) or chroma (OKLAB)
+  uint16_t spread;    // hue phase step from one LED to the next
+};
+
+// plan records are constant and live in flash (PROGMEM); copy one into
+// RAM with getColorPlan() / getBrightPlan() before reading its fields
+struct ColorPlan {
+  char name[PLAN_NAME_LEN];
+  uint8_t efftyp;     // LAVA_COLOR_FIXED, LAVA_COLOR_SINE, LAVA_COLOR_HSV, LAVA_COLOR_OKLAB
+  ColorTuple init;
+  ColorTuple effect;
+  bool gamma;
+  HuePath hue;        // hue plans only
+};
+
+struct BrightPlan {
+  char name[PLAN_NAME_LEN];
+  uint8_t efftyp;     // LAVA_BRIGHT_FIXED, LAVA_BRIGHT_FADE
+  uint16_t init;
+  uint16_t effect;
+};
+
+extern const ColorPlan colorPlan[];
+extern const uint8_t lastColorPlan;
+extern uint8_t curColorPlan;
+extern ColorPlan curColor;      // RAM copy of colorPlan[curColorPlan]
+
+extern const BrightPlan brightPlan[];
+extern const uint8_t lastBrightPlan;
+extern uint8_t curBrightPlan;
+extern BrightPlan curBright;    // RAM copy of brightPlan[curBrightPlan]
+
+// one stretch of the chain; the plan records stay in flash, only what
+// the frame loop needs is kept here
+struct Zone {
+  uint16_t first;           // first LED of the zone
+  uint16_t count;           // LEDs in the zone
+  uint8_t color_plan;       // COLOR PLAN number
+  uint8_t bright_plan;      // BRIGHT PLAN number
+  uint16_t bright_inc;      // brightness phase step per frame (0 unless LAVA_BRIGHT_FADE)
+  ColorTuple color_inc;     // color phase steps per frame (0 for LAVA_COLOR_FIXED)
+  LavaFrame frame;          // phases, color and brightness
+  LavaRenderFn<LavaSpan> render;  // pipeline for the zone's plans
+};
+
+extern Zone zone[];
+extern const uint8_t zoneCount;
+
+extern LavaPixel LED_fb[LED_FB_COUNT];  // the frame sent to the LED
+
+// copy a plan record out of flash
+void getColorPlan(uint8_t plan, ColorPlan &p);
+void getBrightPlan(uint8_t plan, BrightPlan &p);
+
+// select a new COLOR PLAN for every zone and restart its phase accumulators
+void selectColorPlan(uint8_t plan);
+
+// select a new BRIGHT PLAN for every zone
+void selectBrightPlan(uint8_t plan);
+
+// show 'color' on every zone: the first fixed COLOR PLAN (e.g. "Lamp")
+// with its color replaced; ignored when there is no fixed plan
+void selectColor(ColorTuple color);
+
+// the same for zone 'z' only; false when a hue plan finds no free hue
+// table (CALIB_HUE_TABLES), the zone then keeps its plan
+bool selectZoneColorPlan(uint8_t z, uint8_t plan);
+void selectZoneBrightPlan(uint8_t z, uint8_t plan);
+
+// lamp clock in ms: millis() plus the offset learned from a sync master
+uint32_t lampMillis();
+
+#endif
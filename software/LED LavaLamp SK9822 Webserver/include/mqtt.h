@@ -0,0 +1,92 @@
+/*
+  LED LAVA LAMP - MQTT control and state
+
+  A small MQTT 3.1.1 client (QoS 0 only) for home automation. MQTT_FILE
+  on LittleFS names the broker; without it (or without a broker line)
+  MQTT stays off:
+
+    # comment
+    broker 192.168.1.10   IP address or host name
+    port 1883
+    user lamp             optional
+    pass secret           optional
+    topic lavalamp/den    topic prefix (default: lavalamp/CHIPID)
+
+  The lamp subscribes to
+    TOPIC/set/plan        COLOR PLAN number or name
+    TOPIC/set/bright      BRIGHT PLAN number or name
+    TOPIC/set/color       fixed color "r,g,b" or "#rrggbb"
+  and publishes, retained,
+    TOPIC/state           {"color":N,"bright":N,"rgb":[r,g,b],"sync":N,"cmd_us":N}
+    TOPIC/status          "online", or "offline" (will) when it drops off
+
+  A command is shown on the LED right away, not at the next frame;
+  "cmd_us" is how long the last one took from its packet being read
+  to the LED being written. The state is published whenever it changes
+  (web page, button, sync, MQTT), but at most once per MQTT_BATCH_MS:
+  a burst of changes goes out as one publish at the end of the window.
+
+  Nothing here waits for the network in loop(). Connecting is the one
+  step the ESP8266 core does blocking, so it is only tried from
+  mqttFrame(), right after a frame went out, and bounded by
+  MQTT_CONNECT_MS (less than CYCLE_MS); CONNACK, pings and everything
+  else are polled. Failed attempts back off exponentially, with jitter,
+  up to MQTT_BACKOFF_MAX_MS.
+
+ */
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <Arduino.h>
+
+// Define the broker settings file on LittleFS
+#define MQTT_FILE "/mqtt.txt"
+
+// Define the longest line read from MQTT_FILE
+#define MQTT_LINE_MAX (96)
+
+// Define the room for the broker name, user, password and topic prefix
+#define MQTT_NAME_LEN (48)
+
+// Define the largest packet received (longer ones are skipped)
+#define MQTT_PACKET_MAX (128)
+
+// Define the longest a connection attempt may hold up loop() in ms
+#define MQTT_CONNECT_MS (100)
+
+// Define how long the broker has to answer CONNECT in ms
+#define MQTT_CONNACK_MS (5000)
+
+// Define the keep-alive interval announced to the broker in s
+#define MQTT_KEEPALIVE_S (30)
+
+// Define the first and the longest wait between connection attempts in ms
+#define MQTT_BACKOFF_MS (1000)
+#define MQTT_BACKOFF_MAX_MS (60000)
+
+// Define the shortest time between two state publishes in ms
+#define MQTT_BATCH_MS (250)
+
+// read MQTT_FILE; connecting starts with the next frame
+void mqttBegin();
+
+// read and apply commands; call on every pass through loop().
+// Returns true when a command changed the lamp, so it can be shown
+// now (then call mqttShown())
+bool mqttPoll();
+
+// the LED show the last command
+void mqttShown();
+
+// connect (or reconnect) and keep the connection alive; call once per
+// display frame, after the frame was sent
+void mqttFrame();
+
+// the address changed: drop the session and connect again at once
+void mqttRestart();
+
+// short text describing the MQTT connection
+const char *mqttStatus();
+
+#endif
@@ -0,0 +1,115 @@
+/*
+  LED LAVA LAMP - recorded shows
+
+  A show is a sequence of LED frames stored on LittleFS as
+  SHOW_DIR/NAME.lls. It is recorded on the lamp from whatever the zones
+  draw (/show/record/NAME), or made on a host from a simulator trace or
+  a CSV file with scripts/show_encode.py. Playback (/show/play/NAME)
+  streams it from flash through a SHOW_BUF byte read-ahead buffer, so a
+  show of any length costs the same RAM. Builds with LED_PALETTE (see
+  lamp.h) have no framebuffer and neither play nor record.
+
+  File format, all little-endian:
+
+    header  "LLSH", u8 version, u8 keyframe interval (records),
+            u16 LED count, u32 records, u32 duration in ms
+    record  u8 type, u16 payload length, u16 delay in ms, payload
+              'K' keyframe: every LED, no skips
+              'D' delta: only the LED that changed since the last frame
+
+  The delays are the timing track: how long after the previous frame
+  this one is shown. Frames identical to the previous one are not
+  stored, their time is added to the next delay. The payload is a list
+  of runs, one control byte each, n = (control & 0x3f) + 1:
+
+    00nnnnnn   skip n LED (keep the previous frame)
+    01nnnnnn   n LED of the one pixel that follows
+    10nnnnnn   n pixels follow
+
+  where a pixel is r, g, b, 5-bit brightness. Keyframes let playback
+  start in the middle of a show (/show/play/NAME?t=MS) without decoding
+  it from the start, and every record carries its length, so finding the
+  keyframe only reads the record headers.
+
+ */
+
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <Arduino.h>
+#include <LavaEngine.h>
+
+// Define the LittleFS folder holding the shows
+#define SHOW_DIR "/shows"
+
+// Define the show file version
+#define SHOW_VERSION (1)
+
+// Define the read-ahead (and record write) buffer size in bytes
+#define SHOW_BUF (256)
+
+// Define how often a recording stores a keyframe (in records)
+#define SHOW_KEY_RECORDS (50)
+
+// Define the longest recording in ms
+#define SHOW_RECORD_MAX_MS (600000UL)
+
+// Define the longest show name
+#define SHOW_NAME_MAX (16)
+
+// Define the sizes of the file and record headers
+#define SHOW_HEAD_LEN (16)
+#define SHOW_REC_LEN (5)
+
+// Define how many stored shows /api/show lists (the rest only counted)
+#define SHOW_LIST_MAX (16)
+
+// Define the show states
+#define SHOW_IDLE (0)
+#define SHOW_PLAY (1)
+#define SHOW_RECORD (2)
+
+extern uint8_t showState;
+
+// play SHOW_DIR/name.lls from 'at_ms' into the show, over and over
+bool showPlay(const char *name, uint32_t at_ms = 0);
+
+// record the frames the zones draw into SHOW_DIR/name.lls
+bool showRecord(const char *name);
+
+// end playback or recording
+void showStop();
+
+// put the next frame into LED_fb when it is due (true) and read ahead
+// while it is not; call on every pass through loop()
+bool showPoll();
+
+// LED_fb holds a frame the zones drew; stored while recording
+void showCapture();
+
+// what showJson() prints, taken once so that both of its passes (length
+// and send) print the same bytes
+struct ShowSnapshot {
+  uint8_t state;                  // SHOW_IDLE, SHOW_PLAY or SHOW_RECORD
+  char name[SHOW_NAME_MAX + 1];   // show playing or recording
+  uint32_t frames;                // playback statistics
+  uint32_t read;
+  uint32_t read_per_sec;
+  uint32_t late_avg_us;
+  uint32_t late_max_us;
+  uint32_t records;               // records stored so far
+  uint8_t shows;                  // stored shows listed in 'show'
+  uint16_t more;                  // stored shows beyond SHOW_LIST_MAX
+  struct {
+    char name[SHOW_NAME_MAX + 1];
+    uint32_t bytes;
+  } show[SHOW_LIST_MAX];
+};
+
+// take the state, playback statistics and the stored shows
+void showSnapshot(ShowSnapshot &s);
+
+// a snapshot as JSON
+void showJson(Print &out, const ShowSnapshot &s);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+  LED LAVA LAMP - multi-lamp phase synchronization
+
+  One lamp acts as time MASTER and multicasts a small beacon once per
+  second holding its plan numbers, frame number and phase accumulators.
+  FOLLOWERS learn the master clock offset from the beacons, align their
+  display frames to it, and then slew their phase accumulators toward
+  the master phase a little each frame, so the colors never jump.
+
+  On a lamp split into zones the beacon carries the lamp plans and the
+  phase of the first zone showing the lamp COLOR PLAN; a follower slews
+  every zone showing it.
+
+  Only the master transmits, so every lamp costs the same bandwidth
+  (one beacon per second from the master) no matter how many follow.
+
+ */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <Arduino.h>
+
+// Define the SYNC roles
+#define SYNC_OFF (0)
+#define SYNC_FOLLOWER (1)
+#define SYNC_MASTER (2)
+
+// Define the SYNC role used at power-on
+#define SYNC_ROLE_DEFAULT (SYNC_OFF)
+
+// Define the multicast group and UDP port used for beacons
+#define SYNC_GROUP IPAddress(239, 76, 76, 1)
+#define SYNC_PORT (4210)
+
+// Define how often the master sends a beacon in ms
+#define SYNC_BEACON_MS (1000)
+#define SYNC_BEACON_CYC (SYNC_BEACON_MS / CYCLE_MS)
+
+// Define how long a follower keeps a master without hearing a beacon
+#define SYNC_TIMEOUT_MS (5000)
+
+// Define how many beacons are used for each clock offset estimate
+#define SYNC_OFFSET_WINDOW (8)
+
+// Define the largest lamp clock correction applied per frame in ms
+#define SYNC_CLOCK_SLEW_MS (2)
+
+// Define the phase slew: error / SYNC_SLEW_DIV, but at most
+// SYNC_SLEW_MAX phase counts per frame (256 counts = 1 sine table step)
+#define SYNC_SLEW_DIV (8)
+#define SYNC_SLEW_MAX (64)
+
+extern uint8_t syncRole;
+
+// begin listening for (or sending) beacons once WiFi is connected, and
+// again when its address changes (the group is joined on the address)
+void syncBegin();
+
+// change the SYNC role (SYNC_OFF, SYNC_FOLLOWER, SYNC_MASTER)
+void syncSetRole(uint8_t role);
+
+// receive any pending beacons; call on every pass through loop()
+void syncPoll();
+
+// called once per display frame after the phase accumulators advanced:
+// the master sends beacons, a follower slews toward the master phase
+void syncFrame(uint32_t frame);
+
+// short text describing the current SYNC state for the web page
+const char *syncStatus();
+
+#endif
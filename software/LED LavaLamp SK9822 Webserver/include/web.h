@@ -0,0 +1,100 @@
+/*
+  LED LAVA LAMP - web server
+
+  The page, style sheet and script live in web/ and are gzip compressed
+  at build time (scripts/gzip_web.py) into data/www/, which is uploaded
+  with "pio run -t uploadfs". They are sent exactly as stored, with
+  Content-Encoding: gzip, so the lamp never compresses anything itself.
+  Without them on LittleFS the built-in page is served instead.
+
+  Every asset gets a strong ETag (hash of the stored bytes) at boot, and
+  a request carrying a matching If-None-Match is answered 304 without
+  touching the file. All of them are sent no-cache: the page loads the
+  script and style sheet from fixed URLs, so after an uploadfs a cached
+  copy must never outlive the page it belongs to. The page reads the lamp state as JSON from
+  /api/state; the /m/N, /b/N and /s/N actions answer with it too, as
+  do /z/Z/m/N and /z/Z/b/N, which set the plans of zone Z only.
+  /api/heap has the heap samples (see heap.h). /api/show lists the
+  recorded shows (up to SHOW_LIST_MAX, "more" counts the rest), which
+  /show/play/NAME, /show/record/NAME and /show/stop control (see
+  show.h); they answer with the same list.
+
+  Responses go out through WebWriter, which packs headers and body into
+  full TCP segments (WEB_MSS) instead of one small write per line, and
+  always carry a Content-Length, so browsers can keep the connection
+  open (HTTP/1.1 keep-alive) for the next request. Up to WEB_CLIENTS
+  connections are serviced from loop() without blocking the display.
+  Requests are parsed in place from each connection's receive buffer
+  (see http.h); only GET is served.
+
+ */
+
+#ifndef WEB_H
+#define WEB_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+// Define the web server TCP port
+#define WEB_PORT (80)
+
+// Define the LittleFS folder holding the compressed web assets
+#define WEB_ROOT "/www"
+
+// Define the bytes packed into each TCP write (one full segment)
+#define WEB_MSS (1460)
+
+// Define how many bytes of an asset are hashed at a time
+#define WEB_CHUNK (512)
+
+// Define the Cache-Control of every asset (revalidated each time, which
+// costs one 304 per asset while it is unchanged)
+#define WEB_CACHE "no-cache"
+
+// Define the largest /api/state response in bytes
+#define WEB_STATE_MAX (768)
+
+// Define how many browser connections are kept open at once
+#define WEB_CLIENTS (4)
+
+// Define how long an idle keep-alive connection stays open in ms
+#define WEB_IDLE_MS (5000)
+
+// Define how many requests one connection may carry before it is closed
+#define WEB_MAX_REQUESTS (100)
+
+// buffers a response and writes it to the client one segment at a time;
+// in counting mode nothing is sent, only length() is kept, so a
+// generated body can be measured for its Content-Length first
+class WebWriter : public Print {
+  public:
+    WebWriter(WiFiClient &client, bool counting = false) : client(client), counting(counting) {}
+    ~WebWriter() { flush(); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    void flush() override;
+
+    // copy the rest of a file straight into the segment buffer
+    size_t send(Stream &file);
+
+    size_t length() const { return total; }
+
+  private:
+    WiFiClient &client;
+    bool counting;
+    size_t used = 0;      // bytes waiting in the segment buffer
+    size_t total = 0;     // bytes written so far
+};
+
+// start the server and hash the assets on LittleFS
+void webBegin();
+
+// accept and service browser connections; call on every pass through loop()
+void webPoll();
+
+// the address changed: close the connections made to the old one
+void webRestart();
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  LED LAVA LAMP - fast WiFi connect at boot
+
+  WiFiManager's autoConnect() scans every channel, associates and then
+  asks DHCP for an address, several seconds before the web UI answers.
+  After each connect the lamp keeps the access point (BSSID), channel
+  and address it got in the EEPROM sector (WlanCache), and the next
+  boot connects straight to that access point on that channel with
+  that address: no scan, no DHCP. The connect is started before the
+  button window in setup() and runs alongside it.
+
+  When that fails within WLAN_FAST_MS (the access point moved, new
+  credentials, ...) the lamp falls back to autoConnect(), which scans
+  and, when nothing is found, opens the "NightLightAP" portal.
+
+  Without WLAN_FILE the cached address is a copy of the last DHCP
+  lease, which the router may have given to someone else meanwhile. So
+  WLAN_RENEW_MS after a fast boot the lamp goes back to DHCP in the
+  background to hold a lease of its own (the router usually hands out
+  the same address again); when the link stays down for WLAN_FAST_MS
+  before that, it does so at once. Whenever the address changes,
+  wlanPoll() says so, and loop() moves the sync group, the web server
+  and the MQTT session over to the new one.
+
+  WLAN_FILE on LittleFS may fix the address instead:
+
+    # comment
+    ip 192.168.1.50
+    gateway 192.168.1.1
+    mask 255.255.255.0
+    dns 192.168.1.1       optional, default: the gateway
+
+  Each boot prints which way it connected and how long after power-on
+  the web server was ready; /api/state has the same as "wifi" and
+  "bootMs".
+
+ */
+
+#ifndef WLAN_H
+#define WLAN_H
+
+#include <Arduino.h>
+#include <WiFiManager.h>
+
+// Define the static address file on LittleFS
+#define WLAN_FILE "/wifi.txt"
+
+// Define the longest line read from WLAN_FILE
+#define WLAN_LINE_MAX (48)
+
+// Define the EEPROM bytes used, and where the cache starts
+#define WLAN_EEPROM_SIZE (64)
+#define WLAN_EEPROM_ADDR (0)
+
+// Define how long the direct connect may take before scanning, and
+// how long the link may be down before a cached lease is given up, in ms
+#define WLAN_FAST_MS (3000)
+
+// Define when a fast boot on a cached lease goes back to DHCP in ms
+#define WLAN_RENEW_MS (10000)
+
+// Define the ways the lamp got onto the network
+#define WLAN_FAST (0)         // cached access point and address
+#define WLAN_SCAN (1)         // autoConnect() found it
+#define WLAN_PORTAL (2)       // configured through the portal
+
+// read the cache (and WLAN_FILE) and start connecting to the access
+// point of the last boot; returns at once
+void wlanBegin();
+
+// wait for that connect, else fall back to 'wm' (scan, then portal);
+// remembers the access point and address for the next boot
+void wlanConnect(WiFiManager &wm);
+
+// the web server is up: report the boot time
+void wlanReady();
+
+// renew a cached lease, and watch the link (back to DHCP at once when
+// the cached lease stops working);
+// call on every pass through loop(). Returns true when the address
+// changed: whatever was bound to the old one has to start again
+bool wlanPoll();
+
+// how the lamp connected: "fast", "scan" or "portal"
+const char *wlanPath();
+
+// millis() when the web server was ready
+uint32_t wlanBootMs();
+
+#endif
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+# Adalight sender: stream LED frames to the lamp over its serial port
+# (see include/ada.h) and measure what gets through:
+#   resync      garbage, a bad check byte and a frame cut short, then a
+#               good frame: only that one may be shown
+#   latency     one frame at a time, from its last byte written to the
+#               lamp's ACK (frame written to the LED)
+#   throughput  frames back to back for --seconds, at most --window
+#               unacknowledged, paced to the line rate of --baud
+#
+#   python3 scripts/ada_send.py PORT [--baud B] [--leds N] [--seconds S] [--window W]
+#   python3 scripts/ada_send.py --sim path/to/lavasim [...]
+#
+# With --sim the host simulator plays the lamp in real time on a pseudo
+# terminal (lavasim -r -S), so the unmodified firmware parses the frames,
+# and the last frame sent is checked against the LED trace. A pty has no
+# line rate, hence the pacing. On the simulator the latency and the
+# frame rate are bound by its loop step (SIM_LOOP_US, one frame shown
+# per pass through loop()), and the lamp-side latency it prints is 0:
+# its clock doesn't move while loop() runs. On the lamp both come from
+# the time loop() really takes.
+
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import termios
+import threading
+import time
+import tty
+
+ACK = 0x06
+LATENCY_FRAMES = 200
+BYTE_MS = 50            # ADA_BYTE_MS
+
+
+def frame(leds, n):
+    """an Adalight frame of 'leds' pixels, a rainbow moved by n"""
+    hi, lo = (leds - 1) >> 8, (leds - 1) & 0xFF
+    data = bytearray(b"Ada" + bytes([hi, lo, hi ^ lo ^ 0x55]))
+    for i in range(leds):
+        h = (n * 3 + i * 16) & 0xFF
+        data += bytes([h, (h + 85) & 0xFF, (h + 170) & 0xFF])
+    return bytes(data)
+
+
+class Port:
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd, termios.TCSANOW)    # keep what the lamp sent already
+        speed = getattr(termios, "B%d" % baud, None)
+        if speed is not None:
+            attr = termios.tcgetattr(self.fd)
+            attr[4] = attr[5] = speed
+            termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+        self.cond = threading.Condition()
+        self.acks = []          # perf_counter() of every ACK
+        self.lines = []         # text the lamp printed
+        threading.Thread(target=self.reader, daemon=True).start()
+
+    def reader(self):
+        text = bytearray()
+        while True:
+            try:
+                data = os.read(self.fd, 4096)
+            except OSError:
+                return
+            now = time.perf_counter()
+            with self.cond:
+                for c in data:
+                    if c == ACK:
+                        self.acks.append(now)
+                    elif c == 0x0A:
+                        self.lines.append(text.decode(errors="replace").strip())
+                        text.clear()
+                    else:
+                        text.append(c)
+                self.cond.notify_all()
+
+    def write(self, data):
+        view = memoryview(data)
+        while view:
+            view = view[os.write(self.fd, view):]
+
+    def wait_acks(self, count, timeout):
+        end = time.perf_counter() + timeout
+        with self.cond:
+            while len(self.acks) < count:
+                left = end - time.perf_counter()
+                if left <= 0 or not self.cond.wait(left):
+                    return False
+        return True
+
+    def wait_line(self, prefix, timeout, seen=0):
+        """first line printed after the first 'seen' starting with 'prefix'"""
+        end = time.perf_counter() + timeout
+        with self.cond:
+            while True:
+                for line in self.lines[seen:]:
+                    if line.startswith(prefix):
+                        return line
+                left = end - time.perf_counter()
+                if left <= 0 or not self.cond.wait(left):
+                    return None
+
+
+def report(name, values, unit):
+    values = sorted(values)
+    print("%-12s n=%d median %.3f %s  p95 %.3f %s  max %.3f %s" %
+          (name, len(values), statistics.median(values), unit,
+           values[max(0, int(len(values) * 0.95) - 1)], unit, values[-1], unit))
+
+
+def last_trace_frame(path):
+    """r, g, b of every LED of the last frame in a simulator trace"""
+    with open(path, "rb") as f:
+        data = f.read()
+    pos, last = 8, None
+    while pos < len(data):
+        if data[pos:pos + 1] == b"F":
+            count = int.from_bytes(data[pos + 5:pos + 7], "little")
+            px = data[pos + 7:pos + 7 + 4 * count]
+            last = [tuple(px[i:i + 3]) for i in range(0, len(px), 4)]
+            pos += 7 + 4 * count
+        else:
+            pos += 5
+    return last
+
+
+def main():
+    args = sys.argv[1:]
+    opts = {"--baud": 1000000, "--leds": 5, "--seconds": 5, "--window": 4}
+    port_path = lavasim = None
+    while args:
+        opt = args.pop(0)
+        if opt in opts:
+            opts[opt] = int(args.pop(0))
+        elif opt == "--sim":
+            lavasim = args.pop(0)
+        elif not opt.startswith("-"):
+            port_path = opt
+        else:
+            raise SystemExit("usage: ada_send.py PORT|--sim lavasim [--baud B] [--leds N] "
+                             "[--seconds S] [--window W]")
+    baud, leds = opts["--baud"], opts["--leds"]
+
+    sim = tmp = None
+    if lavasim:
+        tmp = tempfile.mkdtemp(prefix="ada_send")
+        port_path = os.path.join(tmp, "serial")
+        trace = os.path.join(tmp, "trace.bin")
+        sim = subprocess.Popen([lavasim, "-q", "-r", "-t", "1h", "-S", port_path, "-o", trace],
+                               stderr=subprocess.DEVNULL)
+        for _ in range(100):
+            if os.path.exists(port_path):
+                break
+            time.sleep(0.05)
+    elif not port_path:
+        raise SystemExit("no port")
+
+    failed = False
+    try:
+        port = Port(port_path, baud)
+        wire = len(frame(leds, 0)) * 10.0 / baud
+        print("%d LED, %d bytes per frame, line limit %.0f fps at %d baud" %
+              (leds, len(frame(leds, 0)), 1 / wire, baud))
+        # opening a real port resets the lamp; it says "Ada" when it is up
+        if not port.wait_line("Ada", 3):
+            print("no hello from the lamp, sending anyway")
+        time.sleep(0.5)
+
+        # resync: none of the broken frames may be shown
+        good = frame(leds, 0)
+        bad = bytearray(good)
+        bad[5] ^= 0xFF
+        port.write(b"noise A Ad " + bytes(bad))
+        port.write(good[:len(good) // 2])
+        time.sleep(2 * BYTE_MS / 1000)
+        port.write(good)
+        time.sleep(0.3)
+        if len(port.acks) != 1:
+            print("FAIL resync: %d frames shown, expected 1" % len(port.acks))
+            failed = True
+
+        # latency
+        lat = []
+        for n in range(LATENCY_FRAMES):
+            data = frame(leds, n)
+            before = len(port.acks)
+            port.write(data)
+            start = time.perf_counter()
+            if not port.wait_acks(before + 1, 1):
+                print("FAIL frame %d not acknowledged" % n)
+                failed = True
+                break
+            lat.append((port.acks[before] - start) * 1e3)
+            time.sleep(wire)
+        if lat:
+            report("latency", lat, "ms")
+
+        # throughput
+        first = len(port.acks)
+        sent, start = 0, time.perf_counter()
+        next_at = start
+        while time.perf_counter() - start < opts["--seconds"]:
+            if sent - (len(port.acks) - first) >= opts["--window"]:
+                port.wait_acks(first + sent - opts["--window"] + 1, 0.1)
+                continue
+            now = time.perf_counter()
+            if now < next_at:
+                time.sleep(next_at - now)
+            port.write(frame(leds, sent))
+            sent += 1
+            next_at = max(next_at, now) + wire
+        port.wait_acks(first + sent, 1)
+        elapsed = time.perf_counter() - start
+        shown = len(port.acks) - first
+        print("throughput   %d frames sent, %d shown in %.2f s: %.0f fps (line limit %.0f)" %
+              (sent, shown, elapsed, shown / elapsed, 1 / wire))
+        if shown != sent:
+            print("FAIL %d frames lost" % (sent - shown))
+            failed = True
+        # the lamp's own numbers; the last frame again now and then, so
+        # the stream doesn't time out and the LED keep it
+        seen, line = len(port.lines), None
+        for _ in range(14):
+            line = port.wait_line("ada:", 0.5, seen)
+            if line:
+                break
+            port.write(frame(leds, sent - 1))
+        print("lamp says    %s" % (line or "nothing"))
+    finally:
+        if sim:
+            sim.terminate()
+            sim.wait()
+
+    if sim:
+        last = frame(leds, sent - 1)[6:]
+        shown = last_trace_frame(trace)
+        want = [tuple(last[i:i + 3]) for i in range(0, len(last), 3)][:len(shown or [])]
+        if shown != want:
+            print("FAIL last frame on the LED %s, sent %s" % (shown, want))
+            failed = True
+        else:
+            print("last frame sent is on the LED")
+        for name in os.listdir(tmp):
+            os.remove(os.path.join(tmp, name))
+        os.rmdir(tmp)
+    print("FAIL" if failed else "PASS")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
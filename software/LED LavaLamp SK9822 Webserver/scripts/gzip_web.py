@@ -0,0 +1,32 @@
+# PlatformIO pre-build script: compress the web UI in web/ into
+# data/www/<name>.gz so "pio run -t uploadfs" puts gzip-precompressed
+# files on LittleFS. mtime is fixed so the output (and the ETag the
+# firmware derives from it) only changes when the source does.
+# Also runs standalone ("python3 scripts/gzip_web.py"), e.g. before
+# starting the host simulator.
+
+import gzip
+import os
+
+try:
+    Import("env")
+    project_dir = env.subst("$PROJECT_DIR")
+except NameError:
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+src_dir = os.path.join(project_dir, "web")
+dst_dir = os.path.join(project_dir, "data", "www")
+
+os.makedirs(dst_dir, exist_ok=True)
+for name in sorted(os.listdir(src_dir)):
+    with open(os.path.join(src_dir, name), "rb") as f:
+        raw = f.read()
+    packed = gzip.compress(raw, compresslevel=9, mtime=0)
+    dst = os.path.join(dst_dir, name + ".gz")
+    if os.path.exists(dst):
+        with open(dst, "rb") as f:
+            if f.read() == packed:
+                continue
+    with open(dst, "wb") as f:
+        f.write(packed)
+    print("gzip_web: %s %u -> %u bytes" % (name, len(raw), len(packed)))
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Measure request latency against a lamp on the local network, once
+# with a new TCP connection per request (like the old firmware forced)
+# and once over a single HTTP/1.1 keep-alive connection.
+#
+#   python3 scripts/http_bench.py 192.168.1.42 [path] [count]
+
+import http.client
+import statistics
+import sys
+import time
+
+host = sys.argv[1]
+path = sys.argv[2] if len(sys.argv) > 2 else "/api/state"
+count = int(sys.argv[3]) if len(sys.argv) > 3 else 50
+
+
+def timed(conn):
+    start = time.perf_counter()
+    conn.request("GET", path)
+    resp = conn.getresponse()
+    resp.read()
+    return (time.perf_counter() - start) * 1e3, resp.status
+
+
+def report(name, times):
+    times.sort()
+    print("%-12s n=%d median %.1f ms  p95 %.1f ms  max %.1f ms" %
+          (name, len(times), statistics.median(times),
+           times[int(len(times) * 0.95) - 1], times[-1]))
+
+
+fresh = []
+for _ in range(count):
+    conn = http.client.HTTPConnection(host, 80, timeout=5)
+    start = time.perf_counter()
+    conn.connect()
+    connect_ms = (time.perf_counter() - start) * 1e3
+    ms, status = timed(conn)
+    fresh.append(connect_ms + ms)
+    conn.close()
+
+kept = []
+conn = http.client.HTTPConnection(host, 80, timeout=5)
+for _ in range(count):
+    ms, status = timed(conn)
+    kept.append(ms)
+conn.close()
+
+report("new conn", fresh)
+report("keep-alive", kept)
@@ -0,0 +1,100 @@
+# PlatformIO post-build script: sort every symbol of firmware.elf into
+# the ESP8266 memory regions (DRAM, IRAM, flash) and write memmap.txt
+# next to it, with region totals first and then one line per symbol,
+# largest first. The previous memmap.txt is compared against, and any
+# region or symbol that grew is printed, so RAM regressions show up in
+# the build log.
+# Also runs standalone: python3 scripts/memmap.py firmware.elf [nm]
+
+import os
+import subprocess
+import sys
+
+# ESP8266 address map
+REGIONS = [
+    ("DRAM", 0x3FFE8000, 0x40000000),   # .data, .rodata, .bss, heap
+    ("IRAM", 0x40100000, 0x40110000),   # ICACHE_RAM_ATTR code
+    ("flash", 0x40200000, 0x41000000),  # irom0: code and PROGMEM
+]
+
+# only show this many symbols that grew
+SHOW_GROWN = 20
+
+
+def region_of(addr):
+    for name, start, end in REGIONS:
+        if start <= addr < end:
+            return name
+    return "other"
+
+
+def read_symbols(elf, nm):
+    out = subprocess.run([nm, "-S", "-C", "--size-sort", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = {}
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        addr, size, kind, name = parts
+        key = (region_of(int(addr, 16)), name)
+        symbols[key] = symbols.get(key, 0) + int(size, 16)
+    return symbols
+
+
+def read_report(path):
+    symbols = {}
+    if not os.path.exists(path):
+        return symbols
+    with open(path) as f:
+        for line in f:
+            parts = line.rstrip("\n").split("\t")
+            if len(parts) == 3 and parts[0].isdigit():
+                symbols[(parts[1], parts[2])] = int(parts[0])
+    return symbols
+
+
+def totals(symbols):
+    sums = {}
+    for (region, name), size in symbols.items():
+        sums[region] = sums.get(region, 0) + size
+    return sums
+
+
+def memmap(elf, nm):
+    path = os.path.join(os.path.dirname(elf), "memmap.txt")
+    old = read_report(path)
+    new = read_symbols(elf, nm)
+    sums = totals(new)
+    old_sums = totals(old)
+    regions = [r[0] for r in REGIONS] + ["other"]
+
+    with open(path, "w") as f:
+        for region in regions:
+            f.write("# %-6s %8u bytes\n" % (region, sums.get(region, 0)))
+        for (region, name), size in sorted(new.items(), key=lambda s: (regions.index(s[0][0]), -s[1])):
+            f.write("%u\t%s\t%s\n" % (size, region, name))
+
+    print("memmap: " + ", ".join("%s %u" % (r, sums.get(r, 0)) for r in regions[:-1]) + " bytes -> " + path)
+    if not old:
+        return
+    for region in regions:
+        diff = sums.get(region, 0) - old_sums.get(region, 0)
+        if diff:
+            print("memmap: %s %+d bytes" % (region, diff))
+    grown = [(size - old.get(key, 0), key) for key, size in new.items() if size > old.get(key, 0)]
+    for diff, (region, name) in sorted(grown, reverse=True)[:SHOW_GROWN]:
+        print("memmap:   %+6d %-5s %s" % (diff, region, name))
+
+
+try:
+    Import("env")
+
+    def memmap_action(target, source, env):
+        memmap(str(target[0]), env.subst("$CC").replace("gcc", "nm"))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memmap_action)
+except NameError:
+    if len(sys.argv) < 2:
+        sys.exit("usage: memmap.py firmware.elf [nm]")
+    memmap(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else "xtensa-lx106-elf-nm")
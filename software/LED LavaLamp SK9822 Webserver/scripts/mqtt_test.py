@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+# MQTT test against a broker on the local network (e.g. Mosquitto):
+# send plan, bright and color commands to the lamp, check that its
+# retained state follows and measure the command-to-state round trip,
+# then send a burst of commands and count the state publishes it
+# turns into (they should be batched, see include/mqtt.h).
+#
+#   python3 scripts/mqtt_test.py BROKER[:PORT] [--topic T] [--sim path/to/lavasim]
+#
+# With --sim the host simulator plays the lamp (in real time, on the
+# contents of data/ plus an mqtt.txt naming the broker), so the whole
+# path runs through the unmodified firmware. The lamp-side "cmd_us"
+# (command read to LED written) is only meaningful on the real lamp:
+# the simulator's clock doesn't move while loop() runs.
+
+import json
+import os
+import shutil
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+COMMANDS = [
+    ("plan", "1", {"color": 1}),
+    ("bright", "2", {"bright": 2}),
+    ("plan", "glacial", {"color": 3}),
+    ("color", "255,0,0", {"color": 4, "rgb": [255, 0, 0]}),
+    ("bright", "Normal", {"bright": 1}),
+    ("color", "#00ff40", {"color": 4, "rgb": [0, 255, 64]}),
+    ("plan", "0", {"color": 0}),
+    ("bright", "0", {"bright": 0}),
+]
+ROUNDS = 5
+BURST = 20
+
+
+class Client:
+    """just enough MQTT 3.1.1 (QoS 0) for the test"""
+
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.cond = threading.Condition()
+        self.msgs = []          # (time, topic, payload)
+        body = self.string("MQTT") + bytes([4, 0x02, 0, 60]) + self.string("mqtt_test-%d" % os.getpid())
+        self.send(0x10, body)
+        if self.sock.recv(4)[:2] != b"\x20\x02":
+            raise SystemExit("broker refused the connection")
+        self.sock.settimeout(None)
+        threading.Thread(target=self.reader, daemon=True).start()
+        threading.Thread(target=self.pinger, daemon=True).start()
+
+    @staticmethod
+    def string(s):
+        b = s.encode()
+        return len(b).to_bytes(2, "big") + b
+
+    def send(self, first, body):
+        n, head = len(body), bytearray([first])
+        while True:
+            head.append((n & 0x7F) | (0x80 if n > 0x7F else 0))
+            n >>= 7
+            if not n:
+                break
+        self.sock.sendall(bytes(head) + body)
+
+    def recv(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise EOFError
+            data += chunk
+        return data
+
+    def reader(self):
+        try:
+            while True:
+                first = self.recv(1)[0]
+                n = shift = 0
+                while True:
+                    c = self.recv(1)[0]
+                    n |= (c & 0x7F) << shift
+                    shift += 7
+                    if not c & 0x80:
+                        break
+                body = self.recv(n)
+                if first >> 4 == 3:
+                    tlen = int.from_bytes(body[:2], "big")
+                    pos = 2 + tlen + (2 if first & 0x06 else 0)
+                    with self.cond:
+                        self.msgs.append((time.perf_counter(), body[2:2 + tlen].decode(), body[pos:].decode()))
+                        self.cond.notify_all()
+        except (EOFError, OSError):
+            pass
+
+    def pinger(self):
+        while True:
+            time.sleep(20)
+            self.send(0xC0, b"")
+
+    def subscribe(self, topic):
+        self.send(0x82, b"\x00\x01" + self.string(topic) + b"\x00")
+
+    def publish(self, topic, payload):
+        self.send(0x30, self.string(topic) + payload.encode())
+
+    def wait(self, test, timeout):
+        """first message after the ones seen so far for which test() holds"""
+        end = time.perf_counter() + timeout
+        with self.cond:
+            seen = len(self.msgs)
+            while True:
+                for m in self.msgs[seen:]:
+                    if test(m):
+                        return m
+                seen = len(self.msgs)
+                left = end - time.perf_counter()
+                if left <= 0 or not self.cond.wait(left):
+                    return None
+
+
+def report(name, values, unit):
+    values = sorted(values)
+    print("%-18s n=%d median %.1f %s  p95 %.1f %s  max %.1f %s" %
+          (name, len(values), statistics.median(values), unit,
+           values[max(0, int(len(values) * 0.95) - 1)], unit, values[-1], unit))
+
+
+def start_sim(lavasim, broker, port, topic):
+    here = os.path.dirname(os.path.abspath(__file__))
+    fs = tempfile.mkdtemp(prefix="mqtt_test")
+    shutil.copytree(os.path.join(here, "..", "data"), fs, dirs_exist_ok=True)
+    with open(os.path.join(fs, "mqtt.txt"), "w") as f:
+        f.write("broker %s\nport %d\ntopic %s\n" % (broker, port, topic))
+    proc = subprocess.Popen([lavasim, "-q", "-r", "-t", "1h", "-f", fs], stderr=subprocess.DEVNULL)
+    return proc, fs
+
+
+def main():
+    args = sys.argv[1:]
+    if not args or args[0].startswith("-"):
+        raise SystemExit(__doc__ or "usage: mqtt_test.py BROKER[:PORT] [--topic T] [--sim lavasim]")
+    host, _, port = args.pop(0).partition(":")
+    port = int(port or 1883)
+    topic, lavasim = "lavalamp/test", None
+    while args:
+        opt = args.pop(0)
+        if opt == "--topic":
+            topic = args.pop(0)
+        elif opt == "--sim":
+            lavasim = args.pop(0)
+
+    client = Client(host, port)
+    client.subscribe(topic + "/#")
+    sim = start_sim(lavasim, host, port, topic) if lavasim else None
+    failed = False
+    try:
+        if not client.wait(lambda m: m[1] == topic + "/status" and m[2] == "online", 15):
+            raise SystemExit("lamp did not come online on %s/status" % topic)
+        print("lamp online")
+        client.wait(lambda m: m[1] == topic + "/state", 2)
+
+        # one command at a time, each after the batch window of the last
+        rtt, lamp = [], []
+        for _ in range(ROUNDS):
+            for cmd, value, want in COMMANDS:
+                time.sleep(0.4)
+                start = time.perf_counter()
+                client.publish("%s/set/%s" % (topic, cmd), value)
+                m = client.wait(lambda m: m[1] == topic + "/state" and
+                                all(json.loads(m[2]).get(k) == v for k, v in want.items()), 2)
+                if not m:
+                    print("FAIL %s %s: no matching state" % (cmd, value))
+                    failed = True
+                    continue
+                rtt.append((m[0] - start) * 1e3)
+                lamp.append(json.loads(m[2])["cmd_us"])
+        report("command -> state", rtt, "ms")
+        report("lamp cmd_us", lamp, "us")
+
+        # a burst: every command shown, their states batched
+        time.sleep(0.4)
+        with client.cond:
+            before = len(client.msgs)
+        for i in range(BURST):
+            client.publish(topic + "/set/color", "%d,%d,0" % (i * 10, 255 - i * 10))
+        time.sleep(1.5)
+        with client.cond:
+            states = [json.loads(m[2]) for m in client.msgs[before:] if m[1] == topic + "/state"]
+        last = [(BURST - 1) * 10, 255 - (BURST - 1) * 10, 0]
+        print("burst of %d commands -> %d state publishes, last rgb %s" %
+              (BURST, len(states), states[-1].get("rgb") if states else None))
+        if not states or states[-1].get("rgb") != last or len(states) > BURST // 2:
+            print("FAIL burst not batched or final state wrong")
+            failed = True
+    finally:
+        if sim:
+            sim[0].terminate()
+            sim[0].wait()
+            shutil.rmtree(sim[1])
+    print("FAIL" if failed else "PASS")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
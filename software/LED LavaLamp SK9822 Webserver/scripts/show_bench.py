@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# Show benchmark on the host simulator: record every COLOR PLAN for a
+# while, encode it with show_encode.py, play it back on the simulated
+# lamp and report the compression ratio, the flash bytes read per
+# second and the playback jitter (how late frames were shown).
+#
+#   python3 scripts/show_bench.py path/to/lavasim [minutes]
+#
+# The lamp prints the same playback line ("show: played ...") when a
+# show is stopped on the real hardware, for numbers with real flash.
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import show_encode
+
+PLANS = 5
+PLAYED = re.compile(r"show: played \S+, (\d+) frames .* (\d+) bytes read \((\d+) B/s\), late avg (\d+) max (\d+) us")
+
+
+def run(lavasim, fs, script, seconds, trace=None):
+    path = os.path.join(fs, "script.txt")
+    with open(path, "w") as f:
+        f.write(script)
+    cmd = [lavasim, "-f", fs, "-s", path, "-t", "%ds" % seconds]
+    if trace:
+        cmd += ["-q", "-o", trace]
+    return subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+
+
+def main(argv):
+    if not argv:
+        print("usage: show_bench.py path/to/lavasim [minutes]")
+        return 2
+    lavasim = argv[0]
+    seconds = int(float(argv[1]) * 60) if len(argv) > 1 else 600
+
+    print("%-6s %7s %7s %8s %7s %6s %9s %9s" %
+          ("plan", "frames", "stored", "raw", "show", "ratio", "flash B/s", "late us"))
+    with tempfile.TemporaryDirectory() as fs:
+        for plan in range(PLANS):
+            trace = os.path.join(fs, "trace.bin")
+            run(lavasim, fs, "1s get /m/%d\n" % plan, seconds + 2, trace)
+            frames = show_encode.load(trace, 2000, 2000 + seconds * 1000)
+            data = show_encode.encode(frames)
+            os.makedirs(os.path.join(fs, "shows"), exist_ok=True)
+            with open(os.path.join(fs, "shows", "bench.lls"), "wb") as f:
+                f.write(data)
+
+            out = run(lavasim, fs, "0.5s get /show/play/bench\n%ds get /show/stop\n" % (seconds + 1), seconds + 2)
+            played = PLAYED.search(out)
+            if not played:
+                raise SystemExit("plan %d: no playback report" % plan)
+            raw = len(frames) * len(frames[0][1])
+            print("%-6d %7d %7d %8d %7d %6.2f %9s %9s" %
+                  (plan, len(frames), len(show_encode.distinct(frames)), raw, len(data), raw / len(data),
+                   played.group(3), "%s/%s" % (played.group(4), played.group(5))))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+# Encode a show file (see include/show.h) on the host, from a simulator
+# trace ("lavasim -o trace.bin", any plan) or from a CSV file (any other
+# source), one frame per line:
+#
+#   ms,r,g,b,bright,r,g,b,bright,...     '#' starts a comment
+#
+# The output goes to data/shows/ for "pio run -t uploadfs".
+#
+#   python3 scripts/show_encode.py INPUT OUTPUT.lls [--from MS] [--to MS]
+#   python3 scripts/show_encode.py --check OUTPUT.lls   decode and dump
+#
+# Prints the frame count, the raw size (every display frame, 4 bytes a
+# LED) and the encoded size, so the compression ratio shows.
+
+import struct
+import sys
+
+MAGIC = b"LLSH"
+VERSION = 1
+KEY_RECORDS = 50
+RUN_MAX = 64
+SKIP, REPEAT, LITERAL = 0x00, 0x40, 0x80
+
+
+def read_trace(path):
+    """(ms, pixels) for every frame of an LLTR trace, pixels as bytes"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"LLTR":
+        raise ValueError("%s: not a simulator trace" % path)
+    frames, pos, last = [], 8, b""
+    while pos + 5 <= len(data):
+        kind, ms = data[pos], struct.unpack_from("<I", data, pos + 1)[0]
+        pos += 5
+        if kind == ord("F"):
+            count = struct.unpack_from("<H", data, pos)[0]
+            last = data[pos + 2:pos + 2 + 4 * count]
+            pos += 2 + 4 * count
+        elif kind != ord("S"):
+            break
+        frames.append((ms, last))
+    return frames
+
+
+def read_csv(path):
+    frames = []
+    with open(path) as f:
+        for line in f:
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            values = [int(v) for v in line.split(",")]
+            if (len(values) - 1) % 4:
+                raise ValueError("%s: need ms and 4 values per LED: %s" % (path, line))
+            px = bytearray(min(max(v, 0), 255) for v in values[1:])
+            px[3::4] = bytes(v & 0x1F for v in px[3::4])
+            frames.append((values[0], bytes(px)))
+    return frames
+
+
+def runs(px, prev):
+    """run-coded payload of one frame, against 'prev' unless it is None"""
+    out = bytearray()
+    n_leds = len(px) // 4
+    led = lambda buf, i: buf[4 * i:4 * i + 4]
+    same_prev = lambda i: prev is not None and led(px, i) == led(prev, i)
+    i = 0
+    while i < n_leds:
+        n = 1
+        if same_prev(i):
+            while i + n < n_leds and n < RUN_MAX and same_prev(i + n):
+                n += 1
+            out.append(SKIP | (n - 1))
+        else:
+            while i + n < n_leds and n < RUN_MAX and led(px, i + n) == led(px, i):
+                n += 1
+            if n > 1:
+                out.append(REPEAT | (n - 1))
+                out += led(px, i)
+            else:
+                while i + n < n_leds and n < RUN_MAX:
+                    j = i + n
+                    if same_prev(j) or (j + 1 < n_leds and led(px, j) == led(px, j + 1)):
+                        break
+                    n += 1
+                out.append(LITERAL | (n - 1))
+                out += px[4 * i:4 * (i + n)]
+        i += n
+    return bytes(out)
+
+
+def encode(frames):
+    """show file bytes for [(ms, pixels)], same rules as the firmware"""
+    if not frames:
+        raise ValueError("no frames")
+    n_leds = len(frames[0][1]) // 4
+    steps = [b[0] - a[0] for a, b in zip(frames, frames[1:]) if b[0] > a[0]]
+    duration = frames[-1][0] - frames[0][0] + (min(steps) if steps else 0)
+    body, records, prev, last_ms = bytearray(), 0, None, frames[0][0]
+    for ms, px in frames:
+        if prev is not None and px == prev:
+            continue
+        delay = ms - last_ms
+        while delay > 0xFFFF:
+            body += struct.pack("<BHH", ord("D"), 0, 0xFFFF)
+            delay -= 0xFFFF
+            records += 1
+        key = records % KEY_RECORDS == 0
+        payload = runs(px, None if key else prev)
+        body += struct.pack("<BHH", ord("K" if key else "D"), len(payload), delay) + payload
+        records += 1
+        prev, last_ms = px, ms
+    head = MAGIC + struct.pack("<BBHII", VERSION, KEY_RECORDS, n_leds, records, duration)
+    return head + bytes(body)
+
+
+def decode(data):
+    """(n_leds, duration, [(ms, pixels)]) of a show file"""
+    if data[:4] != MAGIC or data[4] != VERSION:
+        raise ValueError("not a show file")
+    n_leds, records, duration = struct.unpack_from("<HII", data, 6)
+    fb, frames, pos, t = bytearray(4 * n_leds), [], 16, 0
+    for _ in range(records):
+        kind, length, delay = struct.unpack_from("<BHH", data, pos)
+        pos += 5
+        end, i = pos + length, 0
+        while pos < end:
+            c = data[pos]
+            n = (c & (RUN_MAX - 1)) + 1
+            pos += 1
+            if c & 0xC0 == SKIP:
+                pass
+            elif c & 0xC0 == REPEAT:
+                fb[4 * i:4 * (i + n)] = data[pos:pos + 4] * n
+                pos += 4
+            elif c & 0xC0 == LITERAL:
+                fb[4 * i:4 * (i + n)] = data[pos:pos + 4 * n]
+                pos += 4 * n
+            else:
+                raise ValueError("bad run at %d" % (pos - 1))
+            i += n
+        t += delay
+        frames.append((t, bytes(fb)))
+    return n_leds, duration, frames
+
+
+def distinct(frames):
+    """pixels of each frame that differs from the one before"""
+    return [px for i, (ms, px) in enumerate(frames) if i == 0 or px != frames[i - 1][1]]
+
+
+def load(path, start=None, stop=None):
+    with open(path, "rb") as f:
+        is_trace = f.read(4) == b"LLTR"
+    frames = read_trace(path) if is_trace else read_csv(path)
+    return [fr for fr in frames
+            if (start is None or fr[0] >= start) and (stop is None or fr[0] < stop)]
+
+
+def main(argv):
+    if len(argv) == 2 and argv[0] == "--check":
+        with open(argv[1], "rb") as f:
+            n_leds, duration, frames = decode(f.read())
+        print("%s: %d LED, %d records, %.3f s" % (argv[1], n_leds, len(frames), duration / 1e3))
+        for ms, px in frames:
+            print("%8d %s" % (ms, px.hex()))
+        return 0
+    if len(argv) < 2:
+        print("usage: show_encode.py INPUT OUTPUT.lls [--from MS] [--to MS]\n"
+              "       show_encode.py --check OUTPUT.lls")
+        return 2
+    opts = dict(zip(argv[2::2], argv[3::2]))
+    frames = load(argv[0], int(opts["--from"]) if "--from" in opts else None,
+                  int(opts["--to"]) if "--to" in opts else None)
+    data = encode(frames)
+    # the file has to decode back to every changed frame
+    changed = distinct(frames)
+    if distinct(decode(data)[2]) != changed:
+        raise SystemExit("encoder check failed")
+    with open(argv[1], "wb") as f:
+        f.write(data)
+    raw = len(frames) * len(frames[0][1])
+    print("%s: %d frames (%d stored), raw %d bytes, encoded %d bytes, ratio %.2f" %
+          (argv[1], len(frames), len(changed), raw, len(data), raw / len(data)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
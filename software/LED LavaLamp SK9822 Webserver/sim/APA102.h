@@ -0,0 +1,41 @@
+/*
+  LED LAVA LAMP simulator - APA102 library shim
+
+  Instead of clocking bits out of two pins, every frame is handed to the
+  simulator, which records it in the frame trace and previews.
+
+ */
+
+#ifndef SIM_APA102_H
+#define SIM_APA102_H
+
+#include <Arduino.h>
+#include "sim.h"
+
+template<uint8_t dataPin, uint8_t clockPin> class APA102 {
+  public:
+    void startFrame() {
+      count = 0;
+    }
+
+    void sendColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t brightness = 31) {
+      if (count < SIM_MAX_LEDS) {
+        pixels[count].r = red;
+        pixels[count].g = green;
+        pixels[count].b = blue;
+        pixels[count].bright = brightness & 0x1F;
+      }
+      count++;
+    }
+
+    void endFrame(uint16_t ledCount) {
+      (void)ledCount;
+      simFrame(pixels, count < SIM_MAX_LEDS ? count : SIM_MAX_LEDS);
+    }
+
+  private:
+    SimPixel pixels[SIM_MAX_LEDS];
+    uint16_t count = 0;
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+  LED LAVA LAMP simulator - Arduino core shim
+
+  Just enough of the ESP8266 Arduino core (String, Print, Serial,
+  millis/delay, digital pins) to run the firmware on a Linux host.
+  Time comes from the simulator's virtual clock, see sim.h.
+
+ */
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define LOW (0)
+#define HIGH (1)
+#define INPUT (0)
+#define OUTPUT (1)
+#define INPUT_PULLUP (2)
+
+#define DEC (10)
+#define HEX (16)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// everything lives in "flash" on the host, so PROGMEM access is plain access
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+
+class String {
+  public:
+    String(const char *s = "") : str(s ? s : "") {}
+    String(const __FlashStringHelper *s) : str((const char *)s) {}
+    String(const std::string &s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(unsigned char v, unsigned char base = 10) { fromNum(v, base, false); }
+    String(int v, unsigned char base = 10) { fromNum(v, base, v < 0); }
+    String(unsigned int v, unsigned char base = 10) { fromNum(v, base, false); }
+    String(long v, unsigned char base = 10) { fromNum(v, base, v < 0); }
+    String(unsigned long v, unsigned char base = 10) { fromNum(v, base, false); }
+
+    unsigned int length() const { return str.length(); }
+    const char *c_str() const { return str.c_str(); }
+    bool reserve(unsigned int size) { str.reserve(size); return true; }
+
+    String &operator+=(const String &s) { str += s.str; return *this; }
+    String &operator+=(const char *s) { str += s; return *this; }
+    String &operator+=(char c) { str += c; return *this; }
+    bool concat(const String &s) { str += s.str; return true; }
+    bool concat(char c) { str += c; return true; }
+
+    bool operator==(const String &s) const { return str == s.str; }
+    bool operator==(const char *s) const { return str == s; }
+    bool operator!=(const String &s) const { return str != s.str; }
+    bool equals(const String &s) const { return str == s.str; }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    char charAt(unsigned int i) const { return (i < str.length()) ? str[i] : 0; }
+    int indexOf(char c, unsigned int from = 0) const { return npos(str.find(c, from)); }
+    int indexOf(const char *s, unsigned int from = 0) const { return npos(str.find(s, from)); }
+    int indexOf(const String &s, unsigned int from = 0) const { return npos(str.find(s.str, from)); }
+    bool startsWith(const String &s) const { return str.compare(0, s.str.length(), s.str) == 0; }
+    String substring(unsigned int from) const { return (from < str.length()) ? String(str.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to) std::swap(from, to);
+      return (from < str.length()) ? String(str.substr(from, to - from)) : String();
+    }
+    long toInt() const { return strtol(str.c_str(), NULL, 10); }
+    void trim();
+
+  private:
+    std::string str;
+    static int npos(size_t p) { return (p == std::string::npos) ? -1 : (int)p; }
+    void fromNum(unsigned long v, unsigned char base, bool neg);
+    void fromNum(long v, unsigned char base, bool neg) { fromNum((unsigned long)(neg ? -v : v), base, neg); }
+    void fromNum(int v, unsigned char base, bool neg) { fromNum((long)v, base, neg); }
+    void fromNum(unsigned int v, unsigned char base, bool neg) { fromNum((unsigned long)v, base, neg); }
+    void fromNum(unsigned char v, unsigned char base, bool neg) { fromNum((unsigned long)v, base, neg); }
+};
+
+String operator+(const String &a, const String &b);
+String operator+(const String &a, const char *b);
+String operator+(const char *a, const String &b);
+String operator+(const String &a, char b);
+
+class Print;
+
+class Printable {
+  public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t len);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *buf, size_t len) { return write((const uint8_t *)buf, len); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC) { return print((long)v, base); }
+    size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(long v, int base = DEC);
+    size_t print(unsigned long v, int base = DEC);
+    size_t print(double v, int digits = 2);
+    size_t print(const Printable &p) { return p.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T &v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual int read(uint8_t *buf, size_t len);
+    size_t readBytes(uint8_t *buf, size_t len) { return read(buf, len); }
+    size_t readBytes(char *buf, size_t len) { return read((uint8_t *)buf, len); }
+    String readStringUntil(char terminator);
+    long parseInt();
+    void setTimeout(unsigned long ms) { timeout_ms = ms; }
+  protected:
+    unsigned long timeout_ms = 1000;
+};
+
+// Serial: output goes to stdout, input comes from the simulator
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    using Stream::read;
+    size_t setRxBufferSize(size_t size) { return size; }
+    bool hasOverrun() { return false; }
+    int availableForWrite() { return 256; }
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class EspClass {
+  public:
+    void restart();
+    uint32_t getChipId();
+    uint32_t getFreeHeap();
+    uint32_t getMaxFreeBlockSize();
+    uint8_t getHeapFragmentation();
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return 80; }
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,11 @@
+/*
+  LED LAVA LAMP simulator - DNSServer shim (only included, never used)
+
+ */
+
+#ifndef SIM_DNSSERVER_H
+#define SIM_DNSSERVER_H
+
+#include <ESP8266WiFi.h>
+
+#endif
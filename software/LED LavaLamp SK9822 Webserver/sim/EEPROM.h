@@ -0,0 +1,60 @@
+/*
+  LED LAVA LAMP simulator - EEPROM shim
+
+  Like the ESP8266 core, a RAM copy of one flash sector: begin() reads
+  it, put() and write() only mark it dirty when they change something
+  and commit() writes it back if dirty. The sector is a host file (the
+  -E option of the simulator), else it starts erased every run. Every
+  sector write is logged, so flash wear shows up.
+
+ */
+
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <Arduino.h>
+
+// Define the size of the flash sector
+#define SIM_EEPROM_SIZE (4096)
+
+class EEPROMClass {
+  public:
+    void begin(size_t size);
+    bool commit();
+    void end() { commit(); size = 0; }
+
+    uint8_t read(int address) { return inRange(address, 1) ? data[address] : 0; }
+    void write(int address, uint8_t value) {
+      if (inRange(address, 1) && (data[address] != value)) {
+        data[address] = value;
+        dirty = true;
+      }
+    }
+
+    template <typename T> T &get(int address, T &t) {
+      if (inRange(address, sizeof(T)))
+        memcpy((uint8_t *)&t, data + address, sizeof(T));
+      return t;
+    }
+    template <typename T> const T &put(int address, const T &t) {
+      if (inRange(address, sizeof(T)) && memcmp(data + address, (const uint8_t *)&t, sizeof(T))) {
+        memcpy(data + address, (const uint8_t *)&t, sizeof(T));
+        dirty = true;
+      }
+      return t;
+    }
+
+    size_t length() { return size; }
+    uint8_t *getDataPtr() { dirty = true; return data; }
+
+  private:
+    bool inRange(int address, size_t len) { return (address >= 0) && ((size_t)address + len <= size); }
+
+    uint8_t data[SIM_EEPROM_SIZE];
+    size_t size = 0;
+    bool dirty = false;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
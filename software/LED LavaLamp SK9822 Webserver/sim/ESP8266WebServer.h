@@ -0,0 +1,11 @@
+/*
+  LED LAVA LAMP simulator - ESP8266WebServer shim (only included, never used)
+
+ */
+
+#ifndef SIM_ESP8266WEBSERVER_H
+#define SIM_ESP8266WEBSERVER_H
+
+#include <ESP8266WiFi.h>
+
+#endif
@@ -0,0 +1,105 @@
+/*
+  LED LAVA LAMP simulator - ESP8266WiFi shim
+
+  The station is connected from the start, unless the simulator models
+  connecting (-w): then begin() and config() take the time a scan,
+  association and DHCP would, and only find the access point where it
+  is (sim_core.cpp). WiFiServer::accept() hands out the
+  HTTP connections scheduled by the simulator script; whatever the
+  firmware writes back is captured per connection. WiFiClient::connect()
+  opens a real TCP connection from the host (run with -r for anything
+  that talks to a real server, e.g. an MQTT broker).
+
+ */
+
+#ifndef SIM_ESP8266WIFI_H
+#define SIM_ESP8266WIFI_H
+
+#include <memory>
+#include <Arduino.h>
+#include <IPAddress.h>
+#include "sim.h"
+
+#define WL_IDLE_STATUS (0)
+#define WL_NO_SSID_AVAIL (1)
+#define WL_CONNECTED (3)
+#define WL_CONNECT_FAILED (4)
+#define WL_DISCONNECTED (6)
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+
+class WiFiClient : public Stream {
+  public:
+    WiFiClient() {}
+    WiFiClient(std::shared_ptr<SimConn> c) : conn(c) {}
+
+    operator bool() const { return conn != nullptr; }
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+    uint8_t connected();
+    void stop();
+    void setNoDelay(bool nodelay) { (void)nodelay; }
+    int availableForWrite();
+    IPAddress remoteIP() { return IPAddress(192, 168, 4, 100); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    int read(uint8_t *buf, size_t len) override;
+
+    // zero-copy receive (core 3.x): the bytes of the current pbuf
+    bool hasPeekBufferAPI() const { return true; }
+    const char *peekBuffer();
+    size_t peekAvailable();
+    void peekConsume(size_t consume);
+
+  private:
+    std::shared_ptr<SimConn> conn;
+};
+
+class WiFiServer {
+  public:
+    WiFiServer(uint16_t port) : port(port) {}
+    void begin() {}
+    void setNoDelay(bool nodelay) { (void)nodelay; }
+    WiFiClient accept();
+    WiFiClient available() { return accept(); }
+
+  private:
+    uint16_t port;
+};
+
+class ESP8266WiFiClass {
+  public:
+    String SSID() { return String("simulator"); }
+    String psk() { return String("password"); }
+    String macAddress() { return String("5C:CF:7F:00:00:01"); }
+    IPAddress localIP();
+    IPAddress gatewayIP() { return IPAddress(192, 168, 4, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+    IPAddress dnsIP(uint8_t n = 0) { (void)n; return IPAddress(192, 168, 4, 1); }
+    int32_t RSSI() { return -50; }
+    int32_t channel();
+    uint8_t *BSSID();
+    String BSSIDstr();
+    uint8_t status();
+    bool isConnected() { return status() == WL_CONNECTED; }
+    int8_t waitForConnectResult(unsigned long timeoutLength = 60000);
+
+    int begin(const char *ssid, const char *pass = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+    bool mode(WiFiMode_t m) { (void)m; return true; }
+    bool persistent(bool p) { (void)p; return true; }
+    bool setAutoConnect(bool a) { (void)a; return true; }
+    bool setAutoReconnect(bool a) { (void)a; return true; }
+    bool disconnect(bool wifioff = false);
+    bool hostname(const char *name) { (void)name; return true; }
+    int hostByName(const char *host, IPAddress &ip, uint32_t timeout_ms = 10000);
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,11 @@
+/*
+  LED LAVA LAMP simulator - FS shim
+
+ */
+
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <LittleFS.h>
+
+#endif
@@ -0,0 +1,41 @@
+/*
+  LED LAVA LAMP simulator - IPAddress shim
+
+ */
+
+#ifndef SIM_IPADDRESS_H
+#define SIM_IPADDRESS_H
+
+#include <Arduino.h>
+
+class IPAddress : public Printable {
+  public:
+    IPAddress() : addr{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr{a, b, c, d} {}
+    IPAddress(uint32_t a) { memcpy(addr, &a, 4); }
+
+    operator uint32_t() const { uint32_t a; memcpy(&a, addr, 4); return a; }
+    uint8_t operator[](int i) const { return addr[i]; }
+    uint8_t &operator[](int i) { return addr[i]; }
+    bool operator==(const IPAddress &o) const { return memcmp(addr, o.addr, 4) == 0; }
+    bool isSet() const { return (uint32_t)*this != 0; }
+
+    String toString() const {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr[0], addr[1], addr[2], addr[3]);
+      return String(buf);
+    }
+    bool fromString(const char *s) {
+      unsigned a, b, c, d;
+      if (sscanf(s, "%u.%u.%u.%u", &a, &b, &c, &d) != 4)
+        return false;
+      addr[0] = a; addr[1] = b; addr[2] = c; addr[3] = d;
+      return true;
+    }
+    size_t printTo(Print &p) const override { return p.print(toString()); }
+
+  private:
+    uint8_t addr[4];
+};
+
+#endif
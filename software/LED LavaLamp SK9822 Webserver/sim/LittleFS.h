@@ -0,0 +1,82 @@
+/*
+  LED LAVA LAMP simulator - LittleFS shim
+
+  The flash file system is a directory on the host (the project's
+  data/ folder by default, see the -f option of the simulator). Like
+  LittleFS, opening a file for writing creates its folders.
+
+ */
+
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include <memory>
+#include <Arduino.h>
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File : public Stream {
+  public:
+    File() {}
+    File(FILE *f, const char *path);
+
+    operator bool() const { return fp != nullptr; }
+    size_t size() const;
+    size_t position() const;
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    const char *name() const { return path.c_str(); }
+    void close();
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    int read(uint8_t *buf, size_t len) override;
+
+  private:
+    std::shared_ptr<FILE> fp;
+    std::string path;
+};
+
+// directory listing; only plain files are returned
+class Dir {
+  public:
+    bool next();
+    String fileName() const { return String(name); }
+    size_t fileSize() const { return size; }
+
+  private:
+    friend class FS;
+    std::shared_ptr<void> dir;    // DIR *
+    std::string path;             // host path of the directory
+    std::string name;
+    size_t size = 0;
+};
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+class FS {
+  public:
+    bool begin() { return true; }
+    void end() {}
+    File open(const char *path, const char *mode);
+    File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+    Dir openDir(const char *path);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool info(FSInfo &info);
+};
+
+extern FS LittleFS;
+
+#endif
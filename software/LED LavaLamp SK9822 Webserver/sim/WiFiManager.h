@@ -0,0 +1,56 @@
+/*
+  LED LAVA LAMP simulator - WiFiManager shim
+
+  Follows WiFiManager 0.16: autoConnect() returns at once when the
+  station is connected, else it connects with the stored credentials
+  and, when that fails, calls the AP callback and opens the portal. The
+  station is connected from the start unless the simulator models
+  connecting (-w); then the portal is someone configuring the lamp
+  SIM_WIFI_PORTAL_MS later.
+
+ */
+
+#ifndef SIM_WIFIMANAGER_H
+#define SIM_WIFIMANAGER_H
+
+#include <ESP8266WiFi.h>
+
+class WiFiManager {
+  public:
+    boolean autoConnect(const char *apName = NULL, const char *apPassword = NULL) {
+      if (WiFi.status() == WL_CONNECTED)
+        return true;
+      if (connectWifi())
+        return true;
+      if (apCallback)
+        apCallback(this);
+      return startConfigPortal(apName, apPassword);
+    }
+    boolean startConfigPortal(const char *apName = NULL, const char *apPassword = NULL) {
+      (void)apName; (void)apPassword;
+      simWifiPortal();
+      return connectWifi();
+    }
+    void resetSettings() { Serial.println("*WM: settings erased"); }
+    void setConnectTimeout(unsigned long seconds) { connectTimeout = seconds * 1000; }
+    void setConfigPortalTimeout(unsigned long seconds) { (void)seconds; }
+    void setDebugOutput(boolean debug) { (void)debug; }
+    void setAPCallback(void (*func)(WiFiManager *)) { apCallback = func; }
+    void setSTAStaticIPConfig(IPAddress ip, IPAddress gw, IPAddress sn) { staIp = ip; staGateway = gw; staMask = sn; }
+
+  private:
+    bool connectWifi() {
+      if (staIp.isSet())
+        WiFi.config(staIp, staGateway, staMask);
+      WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str());
+      return WiFi.waitForConnectResult(connectTimeout ? connectTimeout : 60000) == WL_CONNECTED;
+    }
+
+    void (*apCallback)(WiFiManager *) = NULL;
+    unsigned long connectTimeout = 0;
+    IPAddress staIp;
+    IPAddress staGateway;
+    IPAddress staMask;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+  LED LAVA LAMP simulator - WiFiUDP shim
+
+  Datagrams go over the simulated multicast bus (lavasim -M, see
+  sim_sync.cpp) to the other lamps. A single simulated lamp has nobody
+  to talk to: packets sent are dropped, and nothing is ever received.
+
+ */
+
+#ifndef SIM_WIFIUDP_H
+#define SIM_WIFIUDP_H
+
+#include <ESP8266WiFi.h>
+#include "sim.h"
+
+class WiFiUDP : public Stream {
+  public:
+    uint8_t begin(uint16_t port) { rx_port = port; return 1; }
+    uint8_t beginMulticast(IPAddress iface, IPAddress group, uint16_t port) { (void)iface; (void)group; return begin(port); }
+    void stop() { rx_port = 0; rx_len = rx_pos = 0; }
+    int beginPacket(IPAddress ip, uint16_t port) { (void)ip; tx_port = port; tx_len = 0; return 1; }
+    int beginPacketMulticast(IPAddress group, uint16_t port, IPAddress iface, int ttl = 1) { (void)iface; (void)ttl; return beginPacket(group, port); }
+    int endPacket() { simUdpSend(tx_port, tx, tx_len); return 1; }
+    int parsePacket() {
+      rx_pos = 0;
+      rx_len = rx_port ? simUdpRecv(rx_port, rx, sizeof(rx)) : 0;
+      return rx_len;
+    }
+    IPAddress remoteIP() { return IPAddress(); }
+    uint16_t remotePort() { return 0; }
+    IPAddress destinationIP() { return IPAddress(); }
+
+    size_t write(uint8_t c) override {
+      if (tx_len >= sizeof(tx))
+        return 0;
+      tx[tx_len++] = c;
+      return 1;
+    }
+    using Print::write;
+    int available() override { return rx_len - rx_pos; }
+    int read() override { return (rx_pos < rx_len) ? rx[rx_pos++] : -1; }
+    int peek() override { return (rx_pos < rx_len) ? rx[rx_pos] : -1; }
+    using Stream::read;
+
+  private:
+    uint16_t rx_port = 0;     // bound port, 0 = not listening
+    uint8_t rx[SIM_UDP_MTU];
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+    uint16_t tx_port = 0;
+    uint8_t tx[SIM_UDP_MTU];
+    size_t tx_len = 0;
+};
+
+#endif
@@ -0,0 +1,1080 @@
+/*
+  LED LAVA LAMP simulator - runner
+
+  Runs the unmodified firmware setup()/loop() on a virtual clock, so
+  hours of lamp time pass in seconds, and captures every LED frame.
+
+    lavasim [options]
+      -t TIME     run for TIME of lamp time (default 1h)
+      -s SCRIPT   scripted button presses / HTTP requests, see below
+      -o TRACE    write every frame to a binary trace file
+      -p PPM      write a PPM preview, one row per frame, one column per LED
+      -e N        only put every Nth frame into the PPM (default 1)
+      -v N        print every Nth frame to the terminal in color
+      -f DIR      folder used as the LittleFS contents (default data)
+      -l LOG      append every HTTP response to LOG
+      -n ID       chip id reported by ESP.getChipId()
+      -q          discard the firmware's Serial output
+      -k N        soak test: N random requests and button presses, then
+                  check the heap for leaks and fragmentation (exit status 1)
+      -H CSV      write heap samples (soak test) to CSV
+      -r          run in real time, for talking to real servers (MQTT)
+      -w AP       model connecting to WiFi: the access point is "ok",
+                  has "moved" (new BSSID and channel) or is "gone"
+                  (the portal opens); default: connected at once
+      -E FILE     keep the EEPROM sector in FILE across runs
+      -S LINK     make the serial port a pseudo terminal, LINK a symlink
+                  to it, for a host sending frames (scripts/ada_send.py;
+                  run with -r)
+    lavasim -M N [-L PCT] [-D MS] [-J MS] [-K PPM] [options]
+                  N lamps synced over a simulated multicast bus with
+                  loss and latency, reporting the followers' clock and
+                  phase errors against time (sim_sync.cpp)
+    lavasim -c TRACE1 TRACE2
+                  compare two traces, exit status 1 if they differ
+    lavasim -x    check the fused calibration tables and the HSV / OKLab
+                  conversions (LavaEngine) against the floating-point
+                  references, and that a zone leaving a hue plan draws
+                  a one-entry palette again; exit status 1 if any check
+                  fails, see sim_color.cpp
+    lavasim -C    benchmark the per-LED cost of the color sources, and
+                  the old run time effect type branches against the
+                  lavaRenderer() pipelines
+    lavasim -P    benchmark palettes against the framebuffer on long
+                  chains: RAM, frame time, color error (sim_color.cpp)
+    lavasim -F DIR
+                  fuzz the HTTP request parser with the corpus in DIR
+                  (sim/http), exit status 1 on a failure
+    lavasim -B    benchmark the HTTP request parser against the ones
+                  it replaced, see sim_http.cpp
+
+  TIME is a number with an optional unit: ms (default), s, m or h.
+
+  SCRIPT has one event per line, '#' starts a comment:
+      TIME press DURATION   hold the user button for DURATION
+      TIME pin N 0|1        drive input pin N low or high
+      TIME get PATH         HTTP GET PATH from a client
+      TIME kget N PATH      HTTP GET PATH on keep-alive connection N
+                            (reused while the firmware keeps it open)
+      TIME send TEXT        raw bytes from a client (\r \n \\ escapes)
+      TIME serial TEXT      bytes into the Serial receive buffer
+      TIME wifi DURATION    drop the WiFi link for DURATION; the
+                            router gives the lamp's address away, so
+                            its next DHCP lease is a new one
+      TIME end              stop the simulation
+
+  Allocations made by the firmware are counted and placed in a model of
+  the ESP8266 heap (sim_heap.cpp). A soak test fails when the display
+  loop allocates at all, when the heap holds more at the end than at the
+  start, when the largest free block ended up smaller, when the model
+  heap ran out, or when a response body doesn't match its Content-Length.
+
+  TRACE is "LLTR", a version byte and three reserved bytes, then one
+  record per frame, all little-endian:
+      'F' u32 ms, u16 count, count x (r, g, b, bright)   a new frame
+      'S' u32 ms                                        same as last frame
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include <LavaEngine.h>
+#include "sim.h"
+
+void setup();
+void loop();
+
+#define TRACE_MAGIC "LLTR"
+#define TRACE_VERSION (1)
+
+// Define the user button pin (input pins idle HIGH, like the pull-up)
+#define SIM_BUTTON (12)
+
+enum SimEventType { EV_PIN, EV_GET, EV_KGET, EV_SEND, EV_SERIAL, EV_WIFI, EV_END };
+
+struct SimEvent {
+  uint64_t at_us;
+  SimEventType type;
+  int pin;
+  int level;
+  std::string text;
+};
+
+bool sim_quiet = false;
+
+static uint64_t sim_us;                 // virtual clock
+static uint64_t sim_end_us = 3600ULL * 1000000;
+static bool sim_running = true;
+static uint32_t sim_node = 0x00511A17;
+static std::string sim_fs = "data";
+static SimWifiAp sim_wifi = SIM_AP_ALWAYS;
+static const char *sim_eeprom;
+
+static std::vector<SimEvent> sim_events;
+static size_t sim_next_event;
+static uint8_t sim_pins[32];
+static std::string sim_serial;
+static std::deque<std::shared_ptr<SimConn>> sim_pending;
+static std::shared_ptr<SimConn> sim_keep[16];  // kget connections
+static FILE *sim_http_log;
+static uint32_t sim_conns;              // connections opened
+static uint32_t sim_requests;           // requests sent
+static uint32_t sim_writes;             // response writes
+static uint32_t sim_bad_length;         // responses whose Content-Length is off
+static bool sim_log_conns = true;       // log every response on stderr
+static bool sim_realtime = false;       // keep the virtual clock on the wall clock
+static bool sim_bus_lamp = false;       // one of the lamps of -M, the bus reports
+static volatile sig_atomic_t sim_stop;  // SIGTERM / SIGINT: finish up and end
+static int sim_pty = -1;                // serial pseudo terminal, master side (-S)
+static std::string sim_pty_link;        // ... and the symlink to its slave side
+
+static FILE *sim_trace;
+static SimPixel sim_last[SIM_MAX_LEDS];
+static uint16_t sim_last_count;
+static uint32_t sim_frames;
+static uint32_t sim_changed;
+
+static const char *sim_ppm_path;
+static uint32_t sim_ppm_every = 1;
+static uint32_t sim_ppm_width;
+static std::vector<uint8_t> sim_ppm;
+static uint32_t sim_term_every;
+
+/* virtual clock and script events */
+
+uint64_t simMicros() {
+  return sim_us;
+}
+
+// does every response in 'reply' carry exactly the body its
+// Content-Length announces? (else a keep-alive client reads the next
+// response from the wrong place)
+static bool simFramed(const std::string &reply) {
+  size_t pos = 0;
+
+  while (pos < reply.size()) {
+    size_t end = reply.find("\r\n\r\n", pos);
+    size_t len = reply.find("\r\nContent-Length: ", pos);
+    if ((reply.compare(pos, 7, "HTTP/1.") != 0) || (end == std::string::npos) || (len > end))
+      return false;
+    pos = end + 4 + strtoul(reply.c_str() + len + 18, NULL, 10);
+  }
+  return pos == reply.size();
+}
+
+// log the response to the last request on a connection
+static void simLogExchange(SimConn &conn) {
+  std::string reply = conn.tx.substr(conn.tx_mark);
+  std::string status = reply.substr(0, reply.find('\r'));
+  uint32_t writes = conn.writes - conn.writes_mark;
+
+  if (!reply.empty() && !simFramed(reply)) {
+    fprintf(stderr, "sim: %s: response body does not match its Content-Length\n", conn.label.c_str());
+    sim_bad_length++;
+  }
+  sim_writes += writes;
+  conn.tx.clear();
+  conn.tx_mark = 0;
+  conn.writes_mark = conn.writes;
+  if (!sim_log_conns)
+    return;
+
+  fprintf(stderr, "[%10.3f] %s -> %s, %zu bytes in %u writes",
+          conn.rx_us / 1e6, conn.label.c_str(), status.c_str(), reply.size(), writes);
+  if (conn.keep >= 0)
+    fprintf(stderr, ", %.1f ms (connection %d, request %u)",
+            (conn.tx_us > conn.rx_us) ? (conn.tx_us - conn.rx_us) / 1e3 : 0.0, conn.keep, conn.requests);
+  fputc('\n', stderr);
+  if (sim_http_log) {
+    fprintf(sim_http_log, "==== %.3f %s\n", conn.rx_us / 1e6, conn.label.c_str());
+    fwrite(reply.data(), 1, reply.size(), sim_http_log);
+    fputc('\n', sim_http_log);
+  }
+}
+
+// queue a request, on a new connection unless 'conn' is still open
+static void simRequest(std::shared_ptr<SimConn> conn, const std::string &rx, int keep) {
+  if (conn && !conn->closed) {
+    simLogExchange(*conn);
+    if (conn->rx_pos == conn->rx.size()) {
+      conn->rx.clear();
+      conn->rx_pos = 0;
+    }
+  }
+  else {
+    conn = std::make_shared<SimConn>();
+    conn->keep = keep;
+    sim_pending.push_back(conn);
+    sim_conns++;
+    if (keep >= 0)
+      sim_keep[keep] = conn;
+  }
+  conn->rx += rx;
+  conn->rx_us = sim_us;
+  conn->requests++;
+  conn->label = rx.substr(0, rx.find('\r'));
+  sim_requests++;
+}
+
+static void simEvent(const SimEvent &ev) {
+  switch (ev.type) {
+    case EV_PIN:
+      sim_pins[ev.pin & 31] = ev.level;
+      break;
+    case EV_GET:
+      simRequest(nullptr, "GET " + ev.text + " HTTP/1.1\r\nHost: lavalamp\r\nConnection: close\r\n\r\n", -1);
+      break;
+    case EV_KGET:
+      simRequest(sim_keep[ev.pin], "GET " + ev.text + " HTTP/1.1\r\nHost: lavalamp\r\n\r\n", ev.pin);
+      break;
+    case EV_SEND:
+      simRequest(nullptr, ev.text, -1);
+      break;
+    case EV_SERIAL:
+      sim_serial += ev.text;
+      break;
+    case EV_WIFI:
+      simWifiDrop(ev.level);
+      break;
+    case EV_END:
+      sim_running = false;
+      break;
+  }
+}
+
+/* soak test */
+
+// Define the gap between soak operations in ms (random in this range)
+#define SOAK_GAP_MIN_MS (5)
+#define SOAK_GAP_MAX_MS (45)
+
+// Define how long the soak runs on after the last operation in ms,
+// long enough for every keep-alive connection to time out
+#define SOAK_DRAIN_MS (15000)
+
+// Define how often the heap is sampled during a soak in ms
+#define SOAK_SAMPLE_MS (10000)
+
+// Define how many keep-alive connections the soak client juggles
+// (more than the firmware serves at once, so some get evicted)
+#define SOAK_KEEP (6)
+
+// what a pass through loop() did, for the allocation counts
+enum SoakPass { PASS_IDLE, PASS_FRAME, PASS_HTTP, PASS_BUTTON, PASSES };
+static const char *soak_pass_name[PASSES] = { "idle", "frame", "http", "button" };
+
+static uint64_t sim_soak_total;         // operations requested (-k)
+static uint64_t sim_soak_done;          // operations started
+static uint64_t sim_soak_next_us;       // time of the next operation
+static uint64_t sim_soak_release_us;    // button release, 0 = not held
+static uint64_t sim_soak_sample_us;     // time of the next heap sample
+static uint32_t sim_soak_rand = 88172645;
+static uint32_t sim_soak_presses;
+static FILE *sim_heap_csv;
+
+static uint64_t soak_passes[PASSES];
+static uint64_t soak_allocs[PASSES];
+static uint32_t soak_start_live;        // heap when the first operation started
+static uint32_t soak_start_block;
+static uint32_t soak_worst_block;
+static uint8_t soak_worst_frag;
+
+static uint32_t soakRandom(uint32_t range) {
+  sim_soak_rand ^= sim_soak_rand << 13;
+  sim_soak_rand ^= sim_soak_rand >> 17;
+  sim_soak_rand ^= sim_soak_rand << 5;
+  return sim_soak_rand % range;
+}
+
+static std::string soakPath() {
+  static const char *paths[] = { "/", "/index.html", "/style.css", "/app.js", "/api/state",
+                                 "/api/heap", "/m/", "/b/", "/s/", "/missing", "/?x=1" };
+  std::string path = paths[soakRandom(sizeof(paths) / sizeof(paths[0]))];
+
+  // plan numbers include one past the last plan
+  if (path == "/m/")
+    path += '0' + soakRandom(6);
+  else if (path == "/b/")
+    path += '0' + soakRandom(4);
+  else if (path == "/s/")
+    path += '0' + soakRandom(3);
+  return path;
+}
+
+static void soakOp() {
+  uint32_t r = soakRandom(1000);
+  int keep = soakRandom(SOAK_KEEP);
+  std::string path = soakPath();
+
+  if (r < 400)          // browser on a keep-alive connection
+    simRequest(sim_keep[keep], "GET " + path + " HTTP/1.1\r\nHost: lavalamp\r\n\r\n", keep);
+  else if (r < 700)     // one request per connection
+    simRequest(nullptr, "GET " + path + " HTTP/1.1\r\nConnection: close\r\n\r\n", -1);
+  else if (r < 800)     // revalidation with a stale ETag
+    simRequest(nullptr, "GET " + path + " HTTP/1.1\r\nIf-None-Match: \"0badf00d-1\"\r\n\r\n", -1);
+  else if (r < 850)
+    simRequest(nullptr, "GET " + path + " HTTP/1.0\r\n\r\n", -1);
+  else if (r < 900)     // request line longer than the firmware keeps
+    simRequest(nullptr, "GET " + path + std::string(200 + soakRandom(300), 'a') + " HTTP/1.1\r\n\r\n", -1);
+  else if (r < 950)     // long header line
+    simRequest(sim_keep[keep], "GET " + path + " HTTP/1.1\r\nUser-Agent: " +
+               std::string(100 + soakRandom(500), 'u') + "\r\n\r\n", keep);
+  else if (r < 995)     // request that never finishes
+    simRequest(nullptr, "GET " + path + " HTTP/1.1\r\nHost: lava", -1);
+  else if (!sim_soak_release_us) {
+    // short (next color plan) or long (next bright plan) button press
+    sim_pins[SIM_BUTTON] = LOW;
+    sim_soak_release_us = sim_us + (soakRandom(2) ? 2000000 : 7000000);
+    sim_soak_presses++;
+  }
+}
+
+static void soakSample() {
+  const SimHeapStats &h = simHeapStats();
+  uint32_t block = simHeapMaxBlock();
+  uint8_t frag = simHeapFragmentation();
+
+  soak_worst_block = std::min(soak_worst_block, block);
+  soak_worst_frag = std::max(soak_worst_frag, frag);
+  if (sim_heap_csv)
+    fprintf(sim_heap_csv, "%.3f,%u,%u,%u,%u,%u,%llu\n", sim_us / 1e6, simHeapFree(), block, frag,
+            h.live_blocks, h.live_bytes, (unsigned long long)h.allocs);
+}
+
+// start the soak operations that are due by 'target'
+static void simSoak(uint64_t target) {
+  if (sim_soak_release_us && (sim_soak_release_us <= target)) {
+    sim_pins[SIM_BUTTON] = HIGH;
+    sim_soak_release_us = 0;
+  }
+  while ((sim_soak_done < sim_soak_total) && (sim_soak_next_us <= target)) {
+    if (sim_soak_done++ == 0) {
+      soak_start_live = simHeapStats().live_bytes;
+      soak_start_block = soak_worst_block = simHeapMaxBlock();
+      soak_worst_frag = simHeapFragmentation();
+    }
+    sim_us = std::max(sim_us, sim_soak_next_us);
+    soakOp();
+    sim_soak_next_us += (SOAK_GAP_MIN_MS + soakRandom(SOAK_GAP_MAX_MS - SOAK_GAP_MIN_MS + 1)) * 1000;
+  }
+  if (sim_soak_sample_us <= target) {
+    soakSample();
+    sim_soak_sample_us += SOAK_SAMPLE_MS * 1000;
+  }
+  if ((sim_soak_done == sim_soak_total) && !sim_soak_release_us &&
+      (target >= sim_soak_next_us + SOAK_DRAIN_MS * 1000))
+    sim_running = false;
+}
+
+// account one pass through loop()
+static void soakPass(bool held, uint64_t allocs, uint32_t frames, uint32_t writes) {
+  SoakPass pass = PASS_IDLE;
+
+  if (held || (sim_pins[SIM_BUTTON] == LOW))
+    pass = PASS_BUTTON;
+  else if (sim_net_writes != writes)
+    pass = PASS_HTTP;
+  else if (sim_frames != frames)
+    pass = PASS_FRAME;
+  soak_passes[pass]++;
+  soak_allocs[pass] += simHeapStats().allocs - allocs;
+}
+
+static int soakReport() {
+  const SimHeapStats &h = simHeapStats();
+  uint32_t block = simHeapMaxBlock();
+  int failed = 0;
+
+  soakSample();
+  fprintf(stderr, "soak: %llu operations, %u requests, %u button presses, %.1f h lamp time\n",
+          (unsigned long long)sim_soak_done, sim_requests, sim_soak_presses, sim_us / 3600e6);
+  for (int i = 0; i < PASSES; i++)
+    fprintf(stderr, "soak: %-6s passes %10llu, allocations %10llu (%.3f per pass)\n", soak_pass_name[i],
+            (unsigned long long)soak_passes[i], (unsigned long long)soak_allocs[i],
+            soak_passes[i] ? (double)soak_allocs[i] / soak_passes[i] : 0.0);
+  fprintf(stderr, "soak: allocations %llu, per request %.2f\n",
+          (unsigned long long)h.allocs, sim_requests ? (double)h.allocs / sim_requests : 0.0);
+  fprintf(stderr, "soak: heap in use %u -> %u bytes (%u blocks), largest free block %u -> %u (worst %u), worst frag %u%%\n",
+          soak_start_live, h.live_bytes, h.live_blocks, soak_start_block, block, soak_worst_block, soak_worst_frag);
+
+  if (soak_allocs[PASS_FRAME] || soak_allocs[PASS_IDLE]) {
+    fprintf(stderr, "soak: FAIL the display loop allocates\n");
+    failed = 1;
+  }
+  if (h.live_bytes > soak_start_live) {
+    fprintf(stderr, "soak: FAIL %u bytes leaked\n", h.live_bytes - soak_start_live);
+    failed = 1;
+  }
+  if (block < soak_start_block) {
+    fprintf(stderr, "soak: FAIL largest free block shrank by %u bytes\n", soak_start_block - block);
+    failed = 1;
+  }
+  if (sim_bad_length) {
+    fprintf(stderr, "soak: FAIL %u responses with a wrong Content-Length\n", sim_bad_length);
+    failed = 1;
+  }
+  if (h.failures) {
+    fprintf(stderr, "soak: FAIL %u allocations did not fit the %u byte heap\n", h.failures, SIM_HEAP_SIZE);
+    failed = 1;
+  }
+  if (!failed)
+    fprintf(stderr, "soak: PASS\n");
+  return failed;
+}
+
+void simAdvance(uint32_t us) {
+  uint64_t target = sim_us + us;
+
+  while ((sim_next_event < sim_events.size()) && (sim_events[sim_next_event].at_us <= target)) {
+    if (sim_events[sim_next_event].at_us > sim_us)
+      sim_us = sim_events[sim_next_event].at_us;
+    SimHeapPause pause;
+    simEvent(sim_events[sim_next_event++]);
+  }
+  if (sim_soak_total) {
+    SimHeapPause pause;
+    simSoak(target);
+  }
+  sim_us = target;
+  simBusStep();
+}
+
+int simPinRead(uint8_t pin) {
+  return sim_pins[pin & 31];
+}
+
+void simPinWrite(uint8_t pin, uint8_t value) {
+  sim_pins[pin & 31] = value ? HIGH : LOW;
+}
+
+// -S: the serial port as a pseudo terminal; the slave side stays open
+// (raw) so the port is there before and after a host uses it
+static bool openPty(const char *link) {
+  struct termios tio;
+  const char *name;
+  int slave;
+
+  if (((sim_pty = posix_openpt(O_RDWR | O_NOCTTY)) < 0) || grantpt(sim_pty) || unlockpt(sim_pty) ||
+      !(name = ptsname(sim_pty)) || ((slave = open(name, O_RDWR | O_NOCTTY)) < 0)) {
+    perror("pseudo terminal");
+    return false;
+  }
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fcntl(sim_pty, F_SETFL, O_NONBLOCK);
+  unlink(link);
+  if (symlink(name, link)) {
+    perror(link);
+    return false;
+  }
+  sim_pty_link = link;
+  fprintf(stderr, "sim: serial port %s -> %s\n", link, name);
+  return true;
+}
+
+// what a host wrote to the pseudo terminal
+static void ptyPull() {
+  char buf[512];
+  ssize_t n;
+
+  if (sim_pty < 0)
+    return;
+  SimHeapPause pause;
+  while ((n = read(sim_pty, buf, sizeof(buf))) > 0)
+    sim_serial.append(buf, n);
+}
+
+int simSerialAvailable() {
+  ptyPull();
+  return sim_serial.size();
+}
+
+void simSerialWrite(const uint8_t *buf, size_t len) {
+  // dropped when nobody reads the port and its buffer is full
+  if (sim_pty >= 0) {
+    ssize_t n = write(sim_pty, buf, len);
+    (void)n;
+  }
+}
+
+int simSerialRead(bool peek) {
+  int c;
+
+  ptyPull();
+  if (sim_serial.empty())
+    return -1;
+  c = (uint8_t)sim_serial[0];
+  if (!peek)
+    sim_serial.erase(0, 1);
+  return c;
+}
+
+std::shared_ptr<SimConn> simAccept() {
+  std::shared_ptr<SimConn> conn;
+
+  if (sim_pending.empty())
+    return conn;
+  conn = sim_pending.front();
+  sim_pending.pop_front();
+  conn->open_us = sim_us;
+  return conn;
+}
+
+void simClose(SimConn &conn) {
+  SimHeapPause pause;
+
+  conn.closed = true;
+  if ((conn.keep < 0) || (conn.tx.size() > conn.tx_mark))
+    simLogExchange(conn);
+  if ((conn.keep >= 0) && sim_log_conns)
+    fprintf(stderr, "[%10.3f] connection %d closed after %u requests\n", sim_us / 1e6, conn.keep, conn.requests);
+}
+
+const char *simFsRoot() {
+  return sim_fs.c_str();
+}
+
+uint32_t simChipId() {
+  return sim_node;
+}
+
+SimWifiAp simWifiAp() {
+  return sim_wifi;
+}
+
+const char *simEepromPath() {
+  return sim_eeprom;
+}
+
+/* frame capture */
+
+static void put16(FILE *f, uint16_t v) {
+  fputc(v & 0xFF, f);
+  fputc(v >> 8, f);
+}
+
+static void put32(FILE *f, uint32_t v) {
+  put16(f, v & 0xFFFF);
+  put16(f, v >> 16);
+}
+
+static uint8_t simShade(uint8_t v, uint8_t bright) {
+  return (v * bright + 15) / 31;
+}
+
+void simFrame(const SimPixel *pixels, uint16_t count) {
+  SimHeapPause pause;
+  uint32_t ms = sim_us / 1000;
+  bool same = (count == sim_last_count) && !memcmp(pixels, sim_last, count * sizeof(SimPixel));
+
+  sim_frames++;
+  if (!same)
+    sim_changed++;
+
+  if (sim_trace) {
+    if (same) {
+      fputc('S', sim_trace);
+      put32(sim_trace, ms);
+    }
+    else {
+      fputc('F', sim_trace);
+      put32(sim_trace, ms);
+      put16(sim_trace, count);
+      for (uint16_t i = 0; i < count; i++) {
+        fputc(pixels[i].r, sim_trace);
+        fputc(pixels[i].g, sim_trace);
+        fputc(pixels[i].b, sim_trace);
+        fputc(pixels[i].bright, sim_trace);
+      }
+    }
+  }
+
+  if (sim_ppm_path && (sim_frames % sim_ppm_every == 0)) {
+    if (sim_ppm_width == 0)
+      sim_ppm_width = count;
+    for (uint32_t i = 0; i < sim_ppm_width; i++) {
+      SimPixel p = (i < count) ? pixels[i] : SimPixel{0, 0, 0, 0};
+      for (int x = 0; x < 8; x++) {
+        sim_ppm.push_back(simShade(p.r, p.bright));
+        sim_ppm.push_back(simShade(p.g, p.bright));
+        sim_ppm.push_back(simShade(p.b, p.bright));
+      }
+    }
+  }
+
+  if (sim_term_every && (sim_frames % sim_term_every == 0)) {
+    fprintf(stderr, "[%10.3f] ", sim_us / 1e6);
+    for (uint16_t i = 0; i < count; i++)
+      fprintf(stderr, "\x1b[48;2;%u;%u;%um  ", simShade(pixels[i].r, pixels[i].bright),
+              simShade(pixels[i].g, pixels[i].bright), simShade(pixels[i].b, pixels[i].bright));
+    fprintf(stderr, "\x1b[0m\n");
+  }
+
+  memcpy(sim_last, pixels, count * sizeof(SimPixel));
+  sim_last_count = count;
+}
+
+static void simFinish() {
+  FILE *f;
+
+  if (sim_trace) {
+    fclose(sim_trace);
+    sim_trace = NULL;
+  }
+  if (sim_ppm_path && sim_ppm_width && (f = fopen(sim_ppm_path, "wb"))) {
+    fprintf(f, "P6\n%u %zu\n255\n", sim_ppm_width * 8, sim_ppm.size() / (sim_ppm_width * 24));
+    fwrite(sim_ppm.data(), 1, sim_ppm.size(), f);
+    fclose(f);
+  }
+  if (sim_http_log)
+    fclose(sim_http_log);
+  fflush(stdout);
+  if (!sim_bus_lamp)
+    fprintf(stderr, "sim: %.3f s lamp time, %u frames (%u changed)\n", sim_us / 1e6, sim_frames, sim_changed);
+  if (sim_requests && !sim_bus_lamp)
+    fprintf(stderr, "sim: %u requests on %u connections, %u response writes\n", sim_requests, sim_conns, sim_writes);
+  if (!sim_pty_link.empty()) {
+    unlink(sim_pty_link.c_str());
+    sim_pty_link.clear();
+  }
+}
+
+void simExit(int code) {
+  simFinish();
+  exit(code);
+}
+
+/* trace comparison */
+
+struct TraceFrame {
+  uint32_t ms;
+  std::vector<SimPixel> pixels;
+};
+
+static bool get32(FILE *f, uint32_t *v) {
+  uint8_t b[4];
+  if (fread(b, 1, 4, f) != 4)
+    return false;
+  *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  return true;
+}
+
+static bool readTrace(const char *path, std::vector<TraceFrame> &frames) {
+  FILE *f = fopen(path, "rb");
+  char hdr[8];
+  TraceFrame fr;
+  uint8_t cnt[2];
+  int type;
+
+  if (!f || (fread(hdr, 1, 8, f) != 8) || memcmp(hdr, TRACE_MAGIC, 4) || (hdr[4] != TRACE_VERSION)) {
+    fprintf(stderr, "%s: not a lamp trace\n", path);
+    if (f)
+      fclose(f);
+    return false;
+  }
+  while ((type = fgetc(f)) != EOF) {
+    if (!get32(f, &fr.ms))
+      break;
+    if (type == 'F') {
+      if (fread(cnt, 1, 2, f) != 2)
+        break;
+      fr.pixels.resize(cnt[0] | (cnt[1] << 8));
+      if (fread(fr.pixels.data(), sizeof(SimPixel), fr.pixels.size(), f) != fr.pixels.size())
+        break;
+    }
+    else if (type != 'S')
+      break;
+    frames.push_back(fr);
+  }
+  fclose(f);
+  return true;
+}
+
+static int compareTraces(const char *a, const char *b) {
+  std::vector<TraceFrame> fa, fb;
+  size_t n, diff = 0, first = 0;
+
+  if (!readTrace(a, fa) || !readTrace(b, fb))
+    return 2;
+  n = std::min(fa.size(), fb.size());
+  for (size_t i = 0; i < n; i++) {
+    bool same = (fa[i].ms == fb[i].ms) && (fa[i].pixels.size() == fb[i].pixels.size()) &&
+                !memcmp(fa[i].pixels.data(), fb[i].pixels.data(), fa[i].pixels.size() * sizeof(SimPixel));
+    if (!same && (diff++ == 0))
+      first = i;
+  }
+  printf("%zu / %zu frames, %zu differ", fa.size(), fb.size(), diff);
+  if (diff)
+    printf(", first at frame %zu (%.3f s)", first, fa[first].ms / 1e3);
+  printf("\n");
+  return (diff || (fa.size() != fb.size())) ? 1 : 0;
+}
+
+/* calibration check */
+
+static int checkCalib() {
+  static const uint8_t gains[] = { 255, 236, 200, 128, 1, 0 };
+  static const uint16_t gammas[] = { 100, 180, 220, 250, 280, 300 };
+  static const uint8_t whites[] = { 255, 240, 128 };
+  uint8_t lut[3 * LAVA_SINE_STEPS];
+  uint32_t checked = 0, bad = 0, worst = 0;
+
+  // no calibration has to give exactly the old sine -> gamma_lut output
+  lavaBuildLut(lavaCalibNone, true, lut);
+  for (uint8_t i = 0; i < LAVA_SINE_STEPS; i++) {
+    for (uint8_t ch = 0; ch < 3; ch++) {
+      if (lut[ch * LAVA_SINE_STEPS + i] != pgm_read_byte(&gamma_lut[pgm_read_byte(&sinetbl[i])])) {
+        printf("none: entry %u channel %u differs from gamma_lut\n", i, ch);
+        bad++;
+      }
+    }
+  }
+
+  for (uint8_t gain : gains) {
+    for (uint16_t gamma : gammas) {
+      for (uint8_t white : whites) {
+        // give every channel a different setting
+        LavaCalib cal = { { gain, (uint8_t)(255 - gain / 2), 255 },
+                          { gamma, 250, (uint16_t)(gamma + 20) },
+                          { white, 255, (uint8_t)(white - white / 8) } };
+
+        for (int g = 0; g < 2; g++) {
+          lavaBuildLut(cal, g, lut);
+          for (uint8_t ch = 0; ch < 3; ch++) {
+            // fused tables: sine entry through the reference
+            for (uint8_t i = 0; i < LAVA_SINE_STEPS; i++) {
+              int want = lavaCalibrateRef(cal, ch, pgm_read_byte(&sinetbl[i]), g);
+              uint32_t err = abs(lut[ch * LAVA_SINE_STEPS + i] - want);
+              worst = std::max(worst, err);
+              checked++;
+              if (err > 1) {
+                if (bad++ < 10)
+                  printf("gain %u gamma %u white %u: channel %u entry %u is %u, want %d\n",
+                         cal.gain[ch], cal.gamma[ch], cal.white[ch], ch, i, lut[ch * LAVA_SINE_STEPS + i], want);
+              }
+            }
+            // fixed colors: every value
+            for (int v = 0; v < 256; v++) {
+              uint32_t err = abs(lavaCalibrate(cal, ch, v, g) - lavaCalibrateRef(cal, ch, v, g));
+              worst = std::max(worst, err);
+              checked++;
+              if (err > 1) {
+                if (bad++ < 10)
+                  printf("gain %u gamma %u white %u: channel %u value %d is off by %u\n",
+                         cal.gain[ch], cal.gamma[ch], cal.white[ch], ch, v, err);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  printf("calibration: %u entries checked, worst error %u, %u bad\n", checked, worst, bad);
+  return bad ? 1 : 0;
+}
+
+/* script */
+
+static bool parseTime(const char *s, uint64_t *us) {
+  char *end;
+  double v = strtod(s, &end);
+
+  if (end == s)
+    return false;
+  if (!strcmp(end, "h"))
+    v *= 3600e3;
+  else if (!strcmp(end, "m"))
+    v *= 60e3;
+  else if (!strcmp(end, "s"))
+    v *= 1e3;
+  else if (*end && strcmp(end, "ms"))
+    return false;
+  *us = (uint64_t)(v * 1000);
+  return true;
+}
+
+static std::string unescape(const std::string &s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if ((s[i] == '\\') && (i + 1 < s.size())) {
+      char c = s[++i];
+      out += (c == 'r') ? '\r' : (c == 'n') ? '\n' : c;
+    }
+    else
+      out += s[i];
+  }
+  return out;
+}
+
+static bool loadScript(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512], when[32], cmd[32];
+  int lineno = 0, used;
+  uint64_t at, len;
+
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    lineno++;
+    line[strcspn(line, "#\r\n")] = 0;
+    for (used = strlen(line); (used > 0) && isspace((uint8_t)line[used - 1]); used--)
+      line[used - 1] = 0;
+    if (sscanf(line, "%31s %31s %n", when, cmd, &used) < 2)
+      continue;
+
+    std::string arg(line + used);
+    SimEvent ev{0, EV_END, 0, 0, ""};
+    if (!parseTime(when, &at)) {
+      fprintf(stderr, "%s:%d: bad time '%s'\n", path, lineno, when);
+      fclose(f);
+      return false;
+    }
+    ev.at_us = at;
+
+    if (!strcmp(cmd, "press") && parseTime(arg.c_str(), &len)) {
+      sim_events.push_back({at, EV_PIN, SIM_BUTTON, LOW, ""});
+      sim_events.push_back({at + len, EV_PIN, SIM_BUTTON, HIGH, ""});
+      continue;
+    }
+    else if (!strcmp(cmd, "pin") && (sscanf(arg.c_str(), "%d %d", &ev.pin, &ev.level) == 2))
+      ev.type = EV_PIN;
+    else if (!strcmp(cmd, "get") && !arg.empty()) {
+      ev.type = EV_GET;
+      ev.text = arg.substr(0, arg.find_first_of(" \t"));
+    }
+    else if (!strcmp(cmd, "kget") && (sscanf(arg.c_str(), "%d %n", &ev.pin, &used) >= 1) &&
+             (ev.pin >= 0) && (ev.pin < 16) && (arg.size() > (size_t)used)) {
+      ev.type = EV_KGET;
+      ev.text = arg.substr(used, arg.find_first_of(" \t", used) - used);
+    }
+    else if (!strcmp(cmd, "send") && !arg.empty()) {
+      ev.type = EV_SEND;
+      ev.text = unescape(arg);
+    }
+    else if (!strcmp(cmd, "serial") && !arg.empty()) {
+      ev.type = EV_SERIAL;
+      ev.text = unescape(arg);
+    }
+    else if (!strcmp(cmd, "wifi") && parseTime(arg.c_str(), &len)) {
+      ev.type = EV_WIFI;
+      ev.level = len / 1000;
+    }
+    else if (!strcmp(cmd, "end"))
+      ev.type = EV_END;
+    else {
+      fprintf(stderr, "%s:%d: bad event '%s'\n", path, lineno, cmd);
+      fclose(f);
+      return false;
+    }
+    sim_events.push_back(ev);
+  }
+  fclose(f);
+  std::stable_sort(sim_events.begin(), sim_events.end(),
+                   [](const SimEvent &a, const SimEvent &b) { return a.at_us < b.at_us; });
+  return true;
+}
+
+// wait until the wall clock caught up with the virtual one
+static void realtimeWait() {
+  static uint64_t start_us;
+  struct timespec ts;
+  uint64_t wall_us;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  wall_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  if (!start_us)
+    start_us = wall_us - sim_us;
+  if (sim_us > wall_us - start_us)
+    usleep(sim_us - (wall_us - start_us));
+}
+
+static void stopSignal(int sig) {
+  (void)sig;
+  sim_stop = 1;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: lavasim [-t time] [-s script] [-o trace] [-p ppm] [-e n] [-v n] [-f dir] [-l log] [-n id] [-q]\n"
+                  "               [-k n] [-H csv] [-r] [-w ok|moved|gone] [-E eeprom] [-S link]\n"
+                  "       lavasim -M lamps [-L loss%%] [-D ms] [-J ms] [-K ppm] [options]\n"
+                  "       lavasim -c trace1 trace2\n"
+                  "       lavasim -x\n"
+                  "       lavasim -C\n"
+                  "       lavasim -P\n"
+                  "       lavasim -F dir\n"
+                  "       lavasim -B\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *trace_path = NULL;
+  std::string lamp_trace;
+  uint32_t bus_lamps = 0, bus_loss = 0, bus_latency = 5, bus_jitter = 0, bus_ppm = 20;
+  int opt;
+
+  for (int i = 0; i < 32; i++)
+    sim_pins[i] = HIGH;
+
+  while ((opt = getopt(argc, argv, "t:s:o:p:e:v:f:l:n:qk:H:rw:E:S:M:L:D:J:K:cxCPF:B")) != -1) {
+    switch (opt) {
+      case 't':
+        if (!parseTime(optarg, &sim_end_us))
+          usage();
+        break;
+      case 's':
+        if (!loadScript(optarg))
+          return 2;
+        break;
+      case 'o': trace_path = optarg; break;
+      case 'p': sim_ppm_path = optarg; break;
+      case 'e': sim_ppm_every = std::max(1, atoi(optarg)); break;
+      case 'v': sim_term_every = atoi(optarg); break;
+      case 'f': sim_fs = optarg; break;
+      case 'n': sim_node = strtoul(optarg, NULL, 0); break;
+      case 'q': sim_quiet = true; break;
+      case 'k': sim_soak_total = strtoull(optarg, NULL, 0); break;
+      case 'r': sim_realtime = true; break;
+      case 'w':
+        if (!strcmp(optarg, "ok"))
+          sim_wifi = SIM_AP_OK;
+        else if (!strcmp(optarg, "moved"))
+          sim_wifi = SIM_AP_MOVED;
+        else if (!strcmp(optarg, "gone"))
+          sim_wifi = SIM_AP_GONE;
+        else
+          usage();
+        break;
+      case 'E': sim_eeprom = optarg; break;
+      case 'M': bus_lamps = atoi(optarg); break;
+      case 'L': bus_loss = atoi(optarg); break;
+      case 'D': bus_latency = atoi(optarg); break;
+      case 'J': bus_jitter = atoi(optarg); break;
+      case 'K': bus_ppm = atoi(optarg); break;
+      case 'S':
+        if (!openPty(optarg))
+          return 2;
+        break;
+      case 'H':
+        if (!(sim_heap_csv = fopen(optarg, "w"))) {
+          perror(optarg);
+          return 2;
+        }
+        fprintf(sim_heap_csv, "time_s,free,max_block,frag,live_blocks,live_bytes,allocs\n");
+        break;
+      case 'l':
+        if (!(sim_http_log = fopen(optarg, "a"))) {
+          perror(optarg);
+          return 2;
+        }
+        break;
+      case 'c':
+        if (argc - optind != 2)
+          usage();
+        return compareTraces(argv[optind], argv[optind + 1]);
+      case 'x':
+        return checkCalib() | checkColor() | checkPalette();
+      case 'C':
+        return benchColor();
+      case 'P':
+        return benchPalette();
+      case 'F':
+        return fuzzHttp(optarg);
+      case 'B':
+        return benchHttp();
+      default:
+        usage();
+    }
+  }
+
+  // -M: from here on this is one of the lamps, the bus runs elsewhere
+  if (bus_lamps) {
+    int lamp;
+
+    if (!simBusFirmware()) {
+      fprintf(stderr, "bus: this firmware has no sync\n");
+      return 2;
+    }
+    simBusConfig(bus_loss, bus_latency, bus_jitter, bus_ppm);
+    lamp = busStart(bus_lamps, sim_end_us);
+    sim_bus_lamp = true;
+    sim_node += lamp;
+    sim_end_us = UINT64_MAX;
+    sim_log_conns = false;
+    sim_quiet = true;
+    if (lamp)
+      sim_events.clear();
+    sim_events.push_back({ 1000000, EV_GET, 0, 0, lamp ? "/s/1" : "/s/2" });
+    std::stable_sort(sim_events.begin(), sim_events.end(),
+                     [](const SimEvent &a, const SimEvent &b) { return a.at_us < b.at_us; });
+    if (trace_path) {
+      lamp_trace = std::string(trace_path) + "." + std::to_string(lamp);
+      trace_path = lamp_trace.c_str();
+    }
+  }
+
+  if (trace_path) {
+    if (!(sim_trace = fopen(trace_path, "wb"))) {
+      perror(trace_path);
+      return 2;
+    }
+    fwrite(TRACE_MAGIC, 1, 4, sim_trace);
+    fputc(TRACE_VERSION, sim_trace);
+    fputc(0, sim_trace);
+    put16(sim_trace, 0);
+  }
+
+  // a soak test runs until its operations are done
+  if (sim_soak_total) {
+    sim_end_us = UINT64_MAX;
+    sim_log_conns = false;
+  }
+
+  if (sim_realtime)
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+  // end like -t does (trace written, pseudo terminal removed)
+  signal(SIGTERM, stopSignal);
+  signal(SIGINT, stopSignal);
+
+  simHeapTrack(true);
+  setup();
+  simHeapTrack(false);
+  simBusUp();
+  while (sim_running && !sim_stop && (sim_us < sim_end_us)) {
+    uint64_t allocs = simHeapStats().allocs;
+    uint32_t frames = sim_frames;
+    uint32_t writes = sim_net_writes;
+    bool held = (sim_pins[SIM_BUTTON] == LOW);
+
+    simHeapTrack(true);
+    loop();
+    simHeapTrack(false);
+    if (sim_soak_total)
+      soakPass(held, allocs, frames, writes);
+    simAdvance(SIM_LOOP_US);
+    if (sim_realtime)
+      realtimeWait();
+  }
+  simFinish();
+  if (sim_soak_total) {
+    int failed = soakReport();
+    if (sim_heap_csv)
+      fclose(sim_heap_csv);
+    return failed;
+  }
+  return 0;
+}
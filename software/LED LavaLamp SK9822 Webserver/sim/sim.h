@@ -0,0 +1,175 @@
+/*
+  LED LAVA LAMP simulator - interface between the shims and the runner
+
+  The firmware's setup() and loop() run unmodified on top of the shim
+  headers in this folder. Every shim that needs time, pins, network
+  traffic or LED output goes through the functions below, which are
+  implemented by the runner in sim.cpp.
+
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+// Define the largest LED chain the simulator can capture
+#define SIM_MAX_LEDS (1024)
+
+// Define how far the virtual clock advances per pass through loop() in us
+#define SIM_LOOP_US (1000)
+
+// Define the largest UDP datagram carried
+#define SIM_UDP_MTU (128)
+
+// Define the size of the modeled ESP8266 heap in bytes
+#define SIM_HEAP_SIZE (40960)
+
+struct SimPixel {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t bright;     // 5-bit APA102 global brightness
+};
+
+// one scripted HTTP connection, or a real TCP connection the firmware
+// opened itself (WiFiClient::connect(), e.g. to an MQTT broker)
+struct SimConn {
+  std::string rx;     // request bytes sent by the client
+  size_t rx_pos = 0;  // bytes already read by the firmware
+  std::string tx;     // response bytes written by the firmware
+  uint32_t writes = 0;    // write() calls, roughly one TCP segment each
+  uint64_t open_us = 0;   // virtual time the connection was accepted
+  bool closed = false;    // firmware called stop()
+  std::string label;      // request line, for the log
+  int keep = -1;          // keep-alive connection number (kget), -1 = one-shot
+  uint32_t requests = 0;  // requests sent on this connection
+  size_t tx_mark = 0;     // response bytes already logged
+  uint32_t writes_mark = 0;   // writes already logged
+  uint64_t rx_us = 0;     // virtual time the last request arrived
+  uint64_t tx_us = 0;     // virtual time of the last write
+  int fd = -1;            // socket of a real connection, -1 = scripted
+};
+
+// virtual clock
+uint64_t simMicros();
+void simAdvance(uint32_t us);
+
+// LED output, called by APA102::endFrame()
+void simFrame(const SimPixel *pixels, uint16_t count);
+
+// digital pins (scripted button presses)
+int simPinRead(uint8_t pin);
+void simPinWrite(uint8_t pin, uint8_t value);
+
+// serial input (scripted, or from the pseudo terminal of -S) and
+// output to that pseudo terminal
+int simSerialAvailable();
+int simSerialRead(bool peek);
+void simSerialWrite(const uint8_t *buf, size_t len);
+
+// HTTP connections (scripted)
+std::shared_ptr<SimConn> simAccept();
+void simClose(SimConn &conn);
+
+// real TCP connections: connect with a timeout in ms, pull in what has
+// arrived, send (sim_core.cpp)
+std::shared_ptr<SimConn> simConnect(uint32_t ip, uint16_t port, uint32_t timeout_ms);
+void simSocketRecv(SimConn &conn);
+void simSocketSend(SimConn &conn, const uint8_t *buf, size_t len);
+bool simResolve(const char *host, uint32_t &ip);
+
+// UDP datagrams over the multicast bus between lamps (-M, sim_sync.cpp);
+// without it nothing arrives and what is sent is dropped
+void simUdpSend(uint16_t port, const uint8_t *buf, size_t len);
+size_t simUdpRecv(uint16_t port, uint8_t *buf, size_t size);
+
+// -M: loss in %, latency and jitter in ms, crystal tolerance in ppm
+void simBusConfig(uint32_t loss_pct, uint32_t latency_ms, uint32_t jitter_ms, uint32_t ppm);
+
+// fork the lamps and run the bus until 'end_us'; returns the lamp
+// number in each lamp, the bus exits with its status
+int busStart(uint32_t lamps, uint64_t end_us);
+
+// the firmware has multi-lamp sync to run on the bus
+bool simBusFirmware();
+
+// the lamp is set up; wait for the others at every bus step passed
+void simBusUp();
+void simBusStep();
+
+// host folder standing in for LittleFS
+const char *simFsRoot();
+
+// chip id reported by ESP.getChipId()
+uint32_t simChipId();
+
+// WiFi station model (-w): the access point the lamp knows is there,
+// has moved to another BSSID and channel, or is gone until someone
+// uses the portal; "always" is connected from the start
+enum SimWifiAp { SIM_AP_ALWAYS, SIM_AP_OK, SIM_AP_MOVED, SIM_AP_GONE };
+
+// Define how long the modeled station takes for each step in ms
+#define SIM_WIFI_SCAN_MS (2200)     // scan all channels
+#define SIM_WIFI_ASSOC_MS (300)     // authenticate and associate
+#define SIM_WIFI_DHCP_MS (800)      // get an address
+#define SIM_WIFI_PORTAL_MS (30000)  // someone configuring the portal
+
+SimWifiAp simWifiAp();
+
+// the portal is open: wait for someone to configure it (sim_core.cpp)
+void simWifiPortal();
+
+// drop the link for 'ms'; the next DHCP lease is a new address
+void simWifiDrop(uint32_t ms);
+
+// file holding the EEPROM sector (-E), NULL = erased at every start
+const char *simEepromPath();
+
+// instrumented heap (sim_heap.cpp)
+struct SimHeapStats {
+  uint64_t allocs;        // firmware allocations so far
+  uint64_t alloc_bytes;   // bytes requested by those allocations
+  uint64_t frees;         // ... and releases
+  uint32_t live_blocks;   // allocations not yet released
+  uint32_t live_bytes;    // bytes requested by those
+  uint32_t failures;      // allocations the model heap could not place
+};
+
+// count (and model) the allocations made from now on
+void simHeapTrack(bool on);
+
+// allocations made while one of these exists are the simulator's own
+class SimHeapPause {
+  public:
+    SimHeapPause();
+    ~SimHeapPause();
+};
+
+const SimHeapStats &simHeapStats();
+uint32_t simHeapFree();
+uint32_t simHeapMaxBlock();
+uint8_t simHeapFragmentation();
+
+// color space checks and benchmark (sim_color.cpp)
+int checkColor();
+int checkPalette();
+int benchColor();
+int benchPalette();
+
+// HTTP request parser checks (sim_http.cpp)
+int fuzzHttp(const char *dir);
+int benchHttp();
+
+// response writes so far, all connections
+extern uint32_t sim_net_writes;
+
+// serial output is discarded when set (-q)
+extern bool sim_quiet;
+
+// stop the simulation (e.g. ESP.restart())
+void simExit(int code);
+
+#endif
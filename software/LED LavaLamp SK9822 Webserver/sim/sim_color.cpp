@@ -0,0 +1,477 @@
+/*
+  LED LAVA LAMP simulator - color space checks
+
+  lavasim -x (after the calibration tables) checks the integer HSV and
+  OKLCh conversions (LavaEngine lava_color.cpp) against their
+  floating-point definitions, and the hue tables of lavaBuildHueLut():
+  a table color scaled by its level multiplier has to come out as the
+  conversion made at that level (with the chroma fitted to the gamut).
+  Last, a zone switched from a hue plan to each sine / fixed plan
+  (selectZoneColorPlan()) has to draw a one-entry palette again.
+
+  lavasim -C benchmarks the per-LED cost of the color sources through
+  the whole pipeline into a framebuffer:
+      sine      LavaLutColor, the sine plans (three table reads)
+      hue       LavaHueColor, the hue plans (tables and multiplies)
+      hsv       lavaHsv() per LED, no tables
+      oklab     lavaOklch() per LED, no tables
+      float     lavaOklchRef() per LED, what double math would cost
+  ns/LED are host numbers, only good for comparing the sources; the
+  ESP8266 has no FPU, so 'float' is far worse there than the ratio
+  shown here. It then times, for every sine / fixed plan, the per-LED
+  loop testing 'if (efftyp == ...)' at run time (as the firmwares did
+  before LavaEngine) against the pipeline lavaRenderer() picks for the
+  plan, on the same frames, and checks both draw the same pixels.
+
+  lavasim -P compares the framebuffer with palettes (LAVA_PALETTE_SIZE,
+  LED_PALETTE) on long chains, a frame drawn and sent to the wire:
+      direct    the pipeline per LED into a framebuffer, lavaShow()
+      pal256    lavaFillPalette(), lavaShowPalette() with 256 entries
+      pal16     the same with 16 entries, blending between them
+  for a hue plan (a gradient along the chain, so the LED differ) and a
+  sine plan (one color for the whole chain, a one-entry palette). It
+  prints the RAM each takes (framebuffer, or index bytes and palette),
+  the frame time, how many times faster than 'direct' it is (as -C
+  reports the pipelines against the branches) and the worst channel
+  difference from 'direct'.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <algorithm>
+#include <Arduino.h>
+#include <LavaEngine.h>
+#include "sim.h"
+
+// Define the LEDs per benchmark frame, the frames per run and the runs
+// (the fastest counts)
+#define BENCH_LEDS (1024)
+#define BENCH_FRAMES (2000)
+#define BENCH_RUNS (5)
+
+/* checks */
+
+// worst channel difference of two colors
+static int colorError(const uint8_t a[3], const uint8_t b[3]) {
+  return std::max({ abs(a[0] - b[0]), abs(a[1] - b[1]), abs(a[2] - b[2]) });
+}
+
+static void colorCheck(const char *name, int err, int allowed, uint32_t &bad, int &worst, const char *what) {
+  worst = std::max(worst, err);
+  if ((err > allowed) && (bad++ < 10))
+    printf("%s: %s is off by %d\n", name, what, err);
+}
+
+int checkColor() {
+  static const uint8_t levels[] = { 0, 1, 40, 128, 200, 255 };
+  uint8_t got[3], want[3], lut[LAVA_HUE_LUT];
+  uint32_t checked = 0, bad = 0;
+  int worst_hsv = 0, worst_oklab = 0, worst_lut = 0;
+  char what[64];
+
+  for (uint32_t h = 0; h < 65536; h += 61) {
+    for (uint8_t s : levels) {
+      for (uint8_t v : levels) {
+        lavaHsv(h, s, v, got[0], got[1], got[2]);
+        lavaHsvRef(h, s, v, want[0], want[1], want[2]);
+        snprintf(what, sizeof(what), "hue %u sat %u val %u", h, s, v);
+        colorCheck("hsv", colorError(got, want), 1, bad, worst_hsv, what);
+        checked++;
+      }
+    }
+  }
+
+  for (uint32_t h = 0; h < 65536; h += 256) {
+    for (int l = 0; l < 256; l += 5) {
+      for (int c = 0; c < 256; c += 5) {
+        lavaOklch(h, l, c, got[0], got[1], got[2]);
+        lavaOklchRef(h, l, c, want[0], want[1], want[2]);
+        snprintf(what, sizeof(what), "hue %u light %d chroma %d", h >> 8, l, c);
+        colorCheck("oklab", colorError(got, want), 2, bad, worst_oklab, what);
+        checked++;
+      }
+    }
+  }
+
+  // hue tables, no calibration: at full level the table is the
+  // conversion; lower levels have to match converting at that level
+  for (uint8_t efftyp : { LAVA_COLOR_HSV, LAVA_COLOR_OKLAB }) {
+    uint8_t a = (efftyp == LAVA_COLOR_HSV) ? 255 : 200;
+    uint8_t b = (efftyp == LAVA_COLOR_HSV) ? 255 : 80;
+
+    lavaBuildHueLut(lavaCalibNone, efftyp, a, b, false, lut);
+    for (uint8_t i = 0; i < LAVA_SINE_STEPS; i++) {
+      uint8_t k = pgm_read_byte(&sinetbl[i]);
+      for (uint16_t h = 0; h < LAVA_HUE_STEPS; h++) {
+        LavaFrame f = {};
+        f.lut = lut;
+        f.phase.r = h << 8;
+        f.phase.g = i << 8;
+        LavaHueColor::get(f, 0, got[0], got[1], got[2]);
+        if (efftyp == LAVA_COLOR_HSV)
+          lavaHsvRef(h << 8, a, (b * k + 127) / 255, want[0], want[1], want[2]);
+        else
+          lavaOklchRef(h << 8, (a * k + 127) / 255, (lavaOklchFit(h << 8, a, b) * k + 127) / 255, want[0], want[1],
+                       want[2]);
+        snprintf(what, sizeof(what), "%s hue %u level %u", efftyp == LAVA_COLOR_HSV ? "hsv" : "oklab", h, k);
+        // 8-bit table entries times an 8-bit multiplier, and the
+        // level rounded to 8 bits before converting
+        colorCheck("hue table", colorError(got, want), 3, bad, worst_lut, what);
+        checked++;
+      }
+    }
+  }
+
+  printf("color: %u conversions checked, worst error hsv %d, oklab %d, hue tables %d, %u bad\n", checked,
+         worst_hsv, worst_oklab, worst_lut, bad);
+  return bad ? 1 : 0;
+}
+
+#if !__has_include("lamp.h")
+
+int checkPalette() {
+  printf("palette: this firmware has no zones\n");
+  return 0;
+}
+
+#else
+
+#include "lamp.h"
+
+// a plan without a hue has to leave the palette past entry 0 alone,
+// whatever hue plan the zone showed before
+int checkPalette() {
+  LavaPixel pal[LAVA_PALETTE_SIZE];
+  ColorPlan p;
+  uint8_t hue = 0;
+  uint32_t checked = 0, bad = 0;
+
+  for (uint8_t plan = 0; plan <= lastColorPlan; plan++) {
+    getColorPlan(plan, p);
+    if ((p.efftyp == LAVA_COLOR_HSV) || (p.efftyp == LAVA_COLOR_OKLAB))
+      hue = plan;
+  }
+  for (uint8_t plan = 0; plan <= lastColorPlan; plan++) {
+    uint16_t filled = 0;
+
+    getColorPlan(plan, p);
+    if ((p.efftyp == LAVA_COLOR_HSV) || (p.efftyp == LAVA_COLOR_OKLAB))
+      continue;
+    selectZoneColorPlan(0, hue);
+    selectZoneColorPlan(0, plan);
+    memset(pal, 0xA5, sizeof(pal));
+    lavaFillPalette(zone[0].render, zone[0].frame, pal);
+    for (uint16_t k = 1; k < LAVA_PALETTE_SIZE; k++)
+      filled += (pal[k].r != 0xA5) || (pal[k].g != 0xA5) || (pal[k].b != 0xA5) || (pal[k].bright != 0xA5);
+    if (filled) {
+      printf("palette: plan %u after hue plan %u fills %u entries past the first\n", plan, hue, filled);
+      bad++;
+    }
+    checked++;
+  }
+  printf("palette: %u plans checked after a hue plan, %u bad\n", checked, bad);
+  return bad ? 1 : 0;
+}
+
+#endif
+
+/* benchmarks */
+
+struct BenchHsvColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    lavaHsv(f.phase.r + led * f.spread, 255, lavaSine(f.phase.g), r, g, b);
+  }
+};
+
+struct BenchOklabColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    lavaOklch(f.phase.r + led * f.spread, lavaSine(f.phase.g), 80, r, g, b);
+  }
+};
+
+struct BenchFloatColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    lavaOklchRef(f.phase.r + led * f.spread, lavaSine(f.phase.g), 80, r, g, b);
+  }
+};
+
+static LavaPixel bench_fb[BENCH_LEDS];
+static uint32_t bench_sink;
+
+// fastest ns per LED of 'render'
+static double benchColorRun(LavaRenderFn<LavaSpan> render, const uint8_t *lut) {
+  double best = 1e9;
+  LavaFrame f = {};
+
+  f.lut = lut;
+  f.spread = 0x0400;
+  f.bright = 31;
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+      LavaSpan span = { bench_fb };
+      lavaAdvance(f.phase, ColorTuple{ 40, 24, 7 }, 1);
+      render(span, f, BENCH_LEDS);
+      bench_sink += bench_fb[i % BENCH_LEDS].r;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, secs * 1e9 / ((double)BENCH_FRAMES * BENCH_LEDS));
+  }
+  return best;
+}
+
+// the plan options as the old loop read them, from memory every LED
+struct BenchPlan {
+  uint8_t color_efftyp;
+  uint8_t bright_efftyp;
+  bool gamma;
+};
+
+static const BenchPlan *bench_plan;
+
+// the per-LED loop with run time effect type tests
+static void benchBranchy(LavaSpan &strip, const LavaFrame &f, uint16_t count) {
+  uint8_t r, g, b, bright;
+
+  strip.startFrame();
+  for (uint16_t i = 0; i < count; i++) {
+    if (bench_plan->color_efftyp == LAVA_COLOR_SINE) {
+      r = lavaSine(f.phase.r);
+      g = lavaSine(f.phase.g);
+      b = lavaSine(f.phase.b);
+      if (bench_plan->gamma) {
+        r = pgm_read_byte(&gamma_lut[r]);
+        g = pgm_read_byte(&gamma_lut[g]);
+        b = pgm_read_byte(&gamma_lut[b]);
+      }
+    }
+    else {
+      r = f.color.r;
+      g = f.color.g;
+      b = f.color.b;
+    }
+    if (bench_plan->bright_efftyp == LAVA_BRIGHT_FADE)
+      bright = lavaSine(f.bright_phase) >> 3;
+    else
+      bright = f.bright & 0x1F;
+    strip.sendColor(r, g, b, bright);
+  }
+  strip.endFrame(count);
+}
+
+// fastest ns per LED of 'render', and a checksum of every frame drawn
+static double benchRenderRun(LavaRenderFn<LavaSpan> render, uint32_t &sum) {
+  double best = 1e9;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    LavaFrame f = {};
+    f.color = ColorTuple{ 255, 160, 40 };
+    f.bright = 31;
+    sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+      LavaSpan span = { bench_fb };
+      lavaAdvance(f.phase, ColorTuple{ 40, 24, 7 }, 1);
+      f.bright_phase += 11;
+      render(span, f, BENCH_LEDS);
+      sum = sum * 31 + bench_fb[i % BENCH_LEDS].r + (bench_fb[i % BENCH_LEDS].g << 8) +
+            (bench_fb[i % BENCH_LEDS].b << 16) + (bench_fb[i % BENCH_LEDS].bright << 24);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, secs * 1e9 / ((double)BENCH_FRAMES * BENCH_LEDS));
+  }
+  return best;
+}
+
+// old run time branches against the lavaRenderer() pipelines
+static int benchRenderer() {
+  static const BenchPlan plans[] = {
+    { LAVA_COLOR_SINE, LAVA_BRIGHT_FIXED, true },
+    { LAVA_COLOR_SINE, LAVA_BRIGHT_FIXED, false },
+    { LAVA_COLOR_SINE, LAVA_BRIGHT_FADE, true },
+    { LAVA_COLOR_SINE, LAVA_BRIGHT_FADE, false },
+    { LAVA_COLOR_FIXED, LAVA_BRIGHT_FIXED, false },
+    { LAVA_COLOR_FIXED, LAVA_BRIGHT_FADE, false },
+  };
+  static const char *const colors[] = { "fixed", "sine" };
+  static const char *const brights[] = { "fixed", "fade" };
+  uint32_t differ = 0;
+
+  printf("\nrenderer: run time branches against lavaRenderer(), same frames\n");
+  printf("%-6s %-6s %-5s %10s %10s %9s %5s\n", "color", "bright", "gamma", "branchy", "pipeline", "x faster", "same");
+  for (auto &p : plans) {
+    uint32_t old_sum, new_sum;
+
+    bench_plan = &p;
+    double branchy = benchRenderRun(&benchBranchy, old_sum);
+    double pipeline = benchRenderRun(lavaRenderer<LavaSpan>(p.color_efftyp, p.bright_efftyp, p.gamma), new_sum);
+    if (old_sum != new_sum)
+      differ++;
+    printf("%-6s %-6s %-5s %10.2f %10.2f %9.2f %5s\n", colors[p.color_efftyp], brights[p.bright_efftyp],
+           p.gamma ? "yes" : "no", branchy, pipeline, branchy / pipeline, (old_sum == new_sum) ? "yes" : "NO");
+  }
+  printf("ns/LED, fastest of %u runs, host time\n", BENCH_RUNS);
+  return differ != 0;
+}
+
+int benchColor() {
+  static uint8_t sine_lut[3 * LAVA_SINE_STEPS], hue_lut[LAVA_HUE_LUT];
+  static const struct {
+    const char *name;
+    LavaRenderFn<LavaSpan> render;
+    const uint8_t *lut;
+  } sources[] = {
+    { "sine", &LavaPipeline<LavaLutColor, LavaFixedBright, LavaNoGamma>::render<LavaSpan>, sine_lut },
+    { "hue", &LavaPipeline<LavaHueColor, LavaFixedBright, LavaNoGamma>::render<LavaSpan>, hue_lut },
+    { "hsv", &LavaPipeline<BenchHsvColor, LavaFixedBright, LavaNoGamma>::render<LavaSpan>, NULL },
+    { "oklab", &LavaPipeline<BenchOklabColor, LavaFixedBright, LavaNoGamma>::render<LavaSpan>, NULL },
+    { "float", &LavaPipeline<BenchFloatColor, LavaFixedBright, LavaNoGamma>::render<LavaSpan>, NULL },
+  };
+  double sine = 0;
+
+  lavaBuildLut(lavaCalibNone, true, sine_lut);
+  lavaBuildHueLut(lavaCalibNone, LAVA_COLOR_OKLAB, 200, 80, false, hue_lut);
+  printf("color: %u LED x %u frames, fastest of %u runs, host time\n", BENCH_LEDS, BENCH_FRAMES, BENCH_RUNS);
+  printf("%-8s %10s %10s\n", "source", "ns/LED", "x sine");
+  for (auto &s : sources) {
+    double ns = benchColorRun(s.render, s.lut);
+    if (!sine)
+      sine = ns;
+    printf("%-8s %10.2f %10.1f\n", s.name, ns, ns / sine);
+  }
+  if (benchRenderer())
+    return 1;
+  return bench_sink == 0x5a5a5a5a;    // keeps the frames from being optimized away
+}
+
+// Define the chain lengths and the LEDs sent per palette benchmark run
+#define BENCH_PAL_LEDS { 256, 1024, 4096, 16384 }
+#define BENCH_PAL_SENT (2000000)
+#define BENCH_PAL_MAX (16384)
+
+// what the strip clocks out, 4 bytes per LED as on the APA102
+struct BenchWire {
+  uint8_t *next;
+
+  void startFrame() {}
+  void sendColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t brightness) {
+    next[0] = 0xE0 | brightness;
+    next[1] = blue;
+    next[2] = green;
+    next[3] = red;
+    next += 4;
+  }
+  void endFrame(uint16_t count) { (void)count; }
+};
+
+#define BENCH_DIRECT (0)
+#define BENCH_PAL256 (1)
+#define BENCH_PAL16 (2)
+
+static LavaPixel bench_pal[256];
+static LavaPixel bench_chain[BENCH_PAL_MAX];
+static uint8_t bench_ix[BENCH_PAL_MAX];
+static uint8_t bench_wire[4 * BENCH_PAL_MAX];
+
+// draw and send one frame of 'count' LED the 'path' way
+template<class Strip>
+static void benchPalFrame(uint8_t path, Strip &strip, LavaRenderFn<LavaSpan> render, const LavaFrame &f,
+                          uint16_t count) {
+  if (path == BENCH_DIRECT) {
+    LavaSpan span = { bench_chain };
+    render(span, f, count);
+    lavaShow(strip, bench_chain, count);
+  }
+  else if (path == BENCH_PAL256) {
+    lavaFillPalette<256>(render, f, bench_pal);
+    lavaShowPalette<256>(strip, bench_pal, bench_ix, count);
+  }
+  else {
+    lavaFillPalette<16>(render, f, bench_pal);
+    lavaShowPalette<16>(strip, bench_pal, bench_ix, count);
+  }
+}
+
+// fastest ns per frame
+static double benchPalRun(uint8_t path, LavaRenderFn<LavaSpan> render, LavaFrame f, uint16_t count) {
+  uint32_t frames = std::max(BENCH_PAL_SENT / count, 1);
+  double best = 1e12;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+      BenchWire wire = { bench_wire };
+      lavaAdvance(f.phase, ColorTuple{ 40, 24, 7 }, 1);
+      benchPalFrame(path, wire, render, f, count);
+      bench_sink += bench_wire[4 * (i % count) + 1];
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, secs * 1e9 / frames);
+  }
+  return best;
+}
+
+// worst channel difference of the 'path' frame from the direct one,
+// over a few phases
+static int benchPalError(uint8_t path, LavaRenderFn<LavaSpan> render, LavaFrame f, uint16_t count) {
+  static LavaPixel want[BENCH_PAL_MAX];
+  int worst = 0;
+
+  for (uint32_t n = 0; n < 64; n++) {
+    LavaSpan span = { want };
+    render(span, f, count);
+    span = { bench_chain };
+    benchPalFrame(path, span, render, f, count);
+    for (uint32_t i = 0; i < count; i++) {
+      uint8_t a[3] = { want[i].r, want[i].g, want[i].b }, b[3] = { bench_chain[i].r, bench_chain[i].g, bench_chain[i].b };
+      worst = std::max(worst, colorError(a, b));
+    }
+    lavaAdvance(f.phase, ColorTuple{ 1013, 517, 0 }, 1);
+  }
+  return worst;
+}
+
+int benchPalette() {
+  static uint8_t sine_lut[3 * LAVA_SINE_STEPS], hue_lut[LAVA_HUE_LUT];
+  static const uint16_t counts[] = BENCH_PAL_LEDS;
+  static const char *const paths[] = { "direct", "pal256", "pal16" };
+  static const struct {
+    const char *name;
+    LavaRenderFn<LavaSpan> render;
+    const uint8_t *lut;
+    uint16_t spread;
+  } plans[] = {
+    { "hue", &LavaPipeline<LavaHueColor, LavaFadeBright, LavaNoGamma>::render<LavaSpan>, hue_lut, 0x0180 },
+    { "sine", &LavaPipeline<LavaLutColor, LavaFadeBright, LavaNoGamma>::render<LavaSpan>, sine_lut, 0 },
+  };
+
+  lavaBuildLut(lavaCalibNone, true, sine_lut);
+  lavaBuildHueLut(lavaCalibNone, LAVA_COLOR_OKLAB, 200, 80, false, hue_lut);
+  printf("palette: %u LED sent per run, fastest of %u runs, host time\n", BENCH_PAL_SENT, BENCH_RUNS);
+  printf("%-5s %6s %-7s %8s %6s %10s %10s %9s %4s\n", "plan", "LED", "path", "RAM", "B/LED", "us/frame", "fps",
+         "x faster", "err");
+  for (auto &p : plans) {
+    LavaFrame f = {};
+    f.lut = p.lut;
+    f.spread = p.spread;
+    f.bright_phase = 0x1000;
+    for (uint16_t count : counts) {
+      double direct = 0;
+      lavaPaletteIndex(bench_ix, count, p.spread);
+      for (uint8_t path = BENCH_DIRECT; path <= BENCH_PAL16; path++) {
+        // a one-entry palette when the plan has no hue
+        uint32_t entries = !p.spread ? 1 : (path == BENCH_PAL16) ? 16 : 256;
+        uint32_t ram = (path == BENCH_DIRECT) ? 4 * count : count + 4 * entries;
+        double ns = benchPalRun(path, p.render, f, count);
+        int err = (path == BENCH_DIRECT) ? 0 : benchPalError(path, p.render, f, count);
+        if (path == BENCH_DIRECT)
+          direct = ns;
+        printf("%-5s %6u %-7s %8u %6.2f %10.1f %10.0f %9.2f %4d\n", p.name, count, paths[path], ram,
+               (double)ram / count, ns / 1000, 1e9 / ns, direct / ns, err);
+      }
+    }
+  }
+  return bench_sink == 0x5a5a5a5a;
+}
@@ -0,0 +1,642 @@
+/*
+  LED LAVA LAMP simulator - Arduino / ESP8266 shim implementation
+
+ */
+
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <dirent.h>
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include "sim.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+FS LittleFS;
+EEPROMClass EEPROM;
+
+uint32_t sim_net_writes;
+
+/* String */
+
+void String::fromNum(unsigned long v, unsigned char base, bool neg) {
+  char buf[34];
+  int i = sizeof(buf) - 1;
+
+  buf[i] = 0;
+  do {
+    buf[--i] = "0123456789abcdef"[v % base];
+    v /= base;
+  } while (v && (i > 1));
+  if (neg)
+    buf[--i] = '-';
+  str = &buf[i];
+}
+
+void String::trim() {
+  size_t first = str.find_first_not_of(" \t\r\n");
+  size_t last = str.find_last_not_of(" \t\r\n");
+  str = (first == std::string::npos) ? "" : str.substr(first, last - first + 1);
+}
+
+String operator+(const String &a, const String &b) { String s(a); s += b; return s; }
+String operator+(const String &a, const char *b) { String s(a); s += b; return s; }
+String operator+(const char *a, const String &b) { String s(a); s += b; return s; }
+String operator+(const String &a, char b) { String s(a); s += b; return s; }
+
+/* Print / Stream */
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+  size_t n = 0;
+  while (len--)
+    n += write(*buf++);
+  return n;
+}
+
+size_t Print::print(long v, int base) {
+  return print(String(v, base));
+}
+
+size_t Print::print(unsigned long v, int base) {
+  return print(String(v, base));
+}
+
+size_t Print::print(double v, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, v);
+  return write(buf);
+}
+
+size_t Print::printf(const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return 0;
+  return write(buf, min((size_t)len, sizeof(buf) - 1));
+}
+
+int Stream::read(uint8_t *buf, size_t len) {
+  size_t n = 0;
+  int c;
+  while ((n < len) && ((c = read()) >= 0))
+    buf[n++] = c;
+  return n;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String s;
+  int c;
+  while (((c = read()) >= 0) && (c != terminator))
+    s += (char)c;
+  return s;
+}
+
+long Stream::parseInt() {
+  long v = 0;
+  bool neg = false;
+  int c;
+
+  while (((c = peek()) >= 0) && (c != '-') && ((c < '0') || (c > '9')))
+    read();
+  if (c == '-') {
+    neg = true;
+    read();
+  }
+  while (((c = peek()) >= '0') && (c <= '9')) {
+    v = v * 10 + (c - '0');
+    read();
+  }
+  return neg ? -v : v;
+}
+
+/* Serial */
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  if (!sim_quiet)
+    fwrite(buf, 1, len, stdout);
+  simSerialWrite(buf, len);
+  return len;
+}
+
+int HardwareSerial::available() { return simSerialAvailable(); }
+int HardwareSerial::read() { return simSerialRead(false); }
+int HardwareSerial::peek() { return simSerialRead(true); }
+
+/* time and pins */
+
+uint32_t millis() { return simMicros() / 1000; }
+uint32_t micros() { return simMicros(); }
+void delay(uint32_t ms) { simAdvance(ms * 1000); }
+void delayMicroseconds(uint32_t us) { simAdvance(us); }
+void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+int digitalRead(uint8_t pin) { return simPinRead(pin); }
+void digitalWrite(uint8_t pin, uint8_t value) { simPinWrite(pin, value); }
+
+// deterministic pseudo random numbers (xorshift32) so runs repeat exactly
+static uint32_t sim_rand = 2463534242u;
+
+static uint32_t simRandom() {
+  sim_rand ^= sim_rand << 13;
+  sim_rand ^= sim_rand >> 17;
+  sim_rand ^= sim_rand << 5;
+  return sim_rand;
+}
+
+long random(long howbig) { return (howbig > 0) ? (long)(simRandom() % howbig) : 0; }
+long random(long howsmall, long howbig) { return (howbig > howsmall) ? howsmall + random(howbig - howsmall) : howsmall; }
+void randomSeed(unsigned long seed) { if (seed) sim_rand = seed; }
+
+/* ESP */
+
+void EspClass::restart() {
+  fprintf(stderr, "sim: ESP.restart()\n");
+  simExit(0);
+}
+
+uint32_t EspClass::getChipId() { return simChipId(); }
+uint32_t EspClass::getFreeHeap() { return simHeapFree(); }
+uint32_t EspClass::getMaxFreeBlockSize() { return simHeapMaxBlock(); }
+uint8_t EspClass::getHeapFragmentation() { return simHeapFragmentation(); }
+uint32_t EspClass::getCycleCount() { return (uint32_t)(simMicros() * 80); }
+
+/* WiFi */
+
+// the access point, where the lamp found it last (-w ok) and where it
+// is after moving (-w moved) or after the portal (-w gone)
+static const uint8_t wifi_bssid[2][6] = { { 0x02, 0, 0, 0, 0, 1 }, { 0x02, 0, 0, 0, 0, 2 } };
+static const int32_t wifi_channel[2] = { 6, 11 };
+
+static bool wifi_portal_done;               // -w gone: someone used the portal
+static uint64_t wifi_begin_us;              // virtual time of the last begin()
+static uint64_t wifi_up_us = UINT64_MAX;    // connected from then on, UINT64_MAX = never
+static uint64_t wifi_lease_us;              // DHCP has an address from then on
+static IPAddress wifi_static;               // config() address, unset = DHCP
+static uint64_t wifi_down_us;               // link dropped from then ...
+static uint64_t wifi_back_us;               // ... until then (script 'wifi')
+static uint8_t wifi_leases;                 // addresses given away so far
+
+static bool wifiModeled() {
+  return simWifiAp() != SIM_AP_ALWAYS;
+}
+
+static int wifiSlot() {
+  return ((simWifiAp() == SIM_AP_MOVED) || wifi_portal_done) ? 1 : 0;
+}
+
+int ESP8266WiFiClass::begin(const char *ssid, const char *pass, int32_t channel, const uint8_t *bssid, bool connect) {
+  uint64_t us = SIM_WIFI_ASSOC_MS * 1000ULL;
+  int slot = wifiSlot();
+
+  (void)pass; (void)connect;
+  if (!wifiModeled())
+    return WL_CONNECTED;
+  wifi_begin_us = simMicros();
+  wifi_up_us = UINT64_MAX;
+  // a BSSID restricts the station to that access point
+  if (((simWifiAp() == SIM_AP_GONE) && !wifi_portal_done) || strcmp(ssid, "simulator") ||
+      (bssid && memcmp(bssid, wifi_bssid[slot], 6)))
+    return WL_DISCONNECTED;
+  if (!bssid || (channel != wifi_channel[slot]))
+    us += SIM_WIFI_SCAN_MS * 1000ULL;
+  if (!wifi_static.isSet())
+    us += SIM_WIFI_DHCP_MS * 1000ULL;
+  wifi_up_us = wifi_begin_us + us;
+  wifi_lease_us = wifi_up_us;
+  return WL_DISCONNECTED;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  (void)gateway; (void)subnet; (void)dns1; (void)dns2;
+  if (!wifiModeled())
+    return true;
+  // back to DHCP while connected: no address until the new lease
+  if (wifi_static.isSet() && !local.isSet() && (status() == WL_CONNECTED))
+    wifi_lease_us = simMicros() + SIM_WIFI_DHCP_MS * 1000ULL;
+  wifi_static = local;
+  return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+  (void)wifioff;
+  if (wifiModeled())
+    wifi_up_us = UINT64_MAX;
+  return true;
+}
+
+uint8_t ESP8266WiFiClass::status() {
+  if ((simMicros() >= wifi_down_us) && (simMicros() < wifi_back_us))
+    return WL_DISCONNECTED;
+  if (!wifiModeled() || (simMicros() >= wifi_up_us))
+    return WL_CONNECTED;
+  if ((wifi_up_us == UINT64_MAX) && (simMicros() - wifi_begin_us >= SIM_WIFI_SCAN_MS * 1000ULL))
+    return WL_NO_SSID_AVAIL;
+  return WL_DISCONNECTED;
+}
+
+int8_t ESP8266WiFiClass::waitForConnectResult(unsigned long timeoutLength) {
+  uint32_t start = millis();
+
+  while ((status() == WL_DISCONNECTED) && (millis() - start < timeoutLength))
+    delay(100);
+  return status();
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+  if (status() != WL_CONNECTED)
+    return IPAddress();
+  if (!wifiModeled())
+    return IPAddress(192, 168, 4, 2 + wifi_leases);
+  if (wifi_static.isSet())
+    return wifi_static;
+  return (simMicros() >= wifi_lease_us) ? IPAddress(192, 168, 4, 2 + wifi_leases) : IPAddress();
+}
+
+int32_t ESP8266WiFiClass::channel() {
+  return wifi_channel[wifiSlot()];
+}
+
+uint8_t *ESP8266WiFiClass::BSSID() {
+  static uint8_t bssid[6];
+
+  memcpy(bssid, wifi_bssid[wifiSlot()], sizeof(bssid));
+  return bssid;
+}
+
+String ESP8266WiFiClass::BSSIDstr() {
+  char buf[18];
+  const uint8_t *b = BSSID();
+
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+  return String(buf);
+}
+
+void simWifiDrop(uint32_t ms) {
+  fprintf(stderr, "sim: WiFi link down for %u ms\n", (unsigned)ms);
+  wifi_down_us = simMicros();
+  wifi_back_us = wifi_down_us + ms * 1000ULL;
+  wifi_lease_us = wifi_back_us + SIM_WIFI_DHCP_MS * 1000ULL;
+  wifi_leases++;
+}
+
+void simWifiPortal() {
+  if (!wifiModeled())
+    return;
+  fprintf(stderr, "sim: portal open, configured %u s later\n", SIM_WIFI_PORTAL_MS / 1000);
+  delay(SIM_WIFI_PORTAL_MS);
+  wifi_portal_done = true;
+}
+
+int ESP8266WiFiClass::hostByName(const char *host, IPAddress &ip, uint32_t timeout_ms) {
+  uint32_t a;
+
+  (void)timeout_ms;
+  if (!simResolve(host, a))
+    return 0;
+  ip = IPAddress(a);
+  return 1;
+}
+
+/* real TCP connections */
+
+std::shared_ptr<SimConn> simConnect(uint32_t ip, uint16_t port, uint32_t timeout_ms) {
+  SimHeapPause pause;
+  struct sockaddr_in sa = {};
+  struct pollfd pfd;
+  int fd, err = 0, one = 1;
+  socklen_t len = sizeof(err);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return nullptr;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = ip;      // IPAddress keeps network order
+  if ((connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) && (errno != EINPROGRESS)) {
+    close(fd);
+    return nullptr;
+  }
+  // like the core, wait for the handshake up to the timeout
+  pfd = { fd, POLLOUT, 0 };
+  if ((poll(&pfd, 1, timeout_ms) != 1) || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+    close(fd);
+    return nullptr;
+  }
+  auto conn = std::make_shared<SimConn>();
+  conn->fd = fd;
+  conn->open_us = simMicros();
+  return conn;
+}
+
+void simSocketRecv(SimConn &conn) {
+  SimHeapPause pause;
+  char buf[1460];
+  ssize_t n;
+
+  if ((conn.fd < 0) || conn.closed)
+    return;
+  if (conn.rx_pos == conn.rx.size()) {
+    conn.rx.clear();
+    conn.rx_pos = 0;
+  }
+  while ((n = recv(conn.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    conn.rx.append(buf, n);
+  if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+    close(conn.fd);
+    conn.closed = true;
+  }
+}
+
+void simSocketSend(SimConn &conn, const uint8_t *buf, size_t len) {
+  if (conn.closed)
+    return;
+  if (send(conn.fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+    close(conn.fd);
+    conn.closed = true;
+  }
+}
+
+bool simResolve(const char *host, uint32_t &ip) {
+  SimHeapPause pause;
+  struct addrinfo hints = {}, *res;
+
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(host, NULL, &hints, &res))
+    return false;
+  ip = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(res);
+  return true;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  stop();
+  conn = simConnect(ip, port, timeout_ms);
+  return conn ? 1 : 0;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+  IPAddress ip;
+
+  if (!WiFi.hostByName(host, ip))
+    return 0;
+  return connect(ip, port);
+}
+
+WiFiClient WiFiServer::accept() {
+  return WiFiClient(simAccept());
+}
+
+uint8_t WiFiClient::connected() {
+  if (conn && (conn->fd >= 0)) {
+    simSocketRecv(*conn);
+    return !conn->closed || (conn->rx_pos < conn->rx.size());
+  }
+  // a one-shot client closes its side once the request is sent, but
+  // like lwIP, unread data still counts as connected; a keep-alive
+  // client stays until the firmware closes it
+  return conn && !conn->closed && ((conn->keep >= 0) || (conn->rx_pos < conn->rx.size()));
+}
+
+void WiFiClient::stop() {
+  if (conn && (conn->fd >= 0) && !conn->closed) {
+    close(conn->fd);
+    conn->closed = true;
+  }
+  else if (conn && !conn->closed)
+    simClose(*conn);
+}
+
+int WiFiClient::availableForWrite() {
+  return conn ? 2920 : 0;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t len) {
+  if (!conn || conn->closed)
+    return 0;
+  SimHeapPause pause;
+  if (conn->fd >= 0) {
+    simSocketSend(*conn, buf, len);
+    return len;
+  }
+  sim_net_writes++;
+  conn->tx.append((const char *)buf, len);
+  conn->writes++;
+  conn->tx_us = simMicros();
+  return len;
+}
+
+int WiFiClient::available() {
+  if (conn && (conn->fd >= 0))
+    simSocketRecv(*conn);
+  return conn ? conn->rx.size() - conn->rx_pos : 0;
+}
+
+int WiFiClient::read() {
+  if (!available())
+    return -1;
+  return (uint8_t)conn->rx[conn->rx_pos++];
+}
+
+int WiFiClient::peek() {
+  if (!available())
+    return -1;
+  return (uint8_t)conn->rx[conn->rx_pos];
+}
+
+// like lwIP, the received bytes come in pbufs of one TCP segment each
+// and peekBuffer() only sees the rest of the current one
+#define SIM_PBUF (536)
+
+const char *WiFiClient::peekBuffer() {
+  return conn ? conn->rx.data() + conn->rx_pos : NULL;
+}
+
+size_t WiFiClient::peekAvailable() {
+  if (!available())
+    return 0;
+  return min((size_t)available(), SIM_PBUF - conn->rx_pos % SIM_PBUF);
+}
+
+void WiFiClient::peekConsume(size_t consume) {
+  conn->rx_pos += min(consume, (size_t)available());
+}
+
+int WiFiClient::read(uint8_t *buf, size_t len) {
+  size_t n = min(len, (size_t)available());
+  if (n) {
+    memcpy(buf, conn->rx.data() + conn->rx_pos, n);
+    conn->rx_pos += n;
+  }
+  return n;
+}
+
+/* EEPROM */
+
+void EEPROMClass::begin(size_t size) {
+  SimHeapPause pause;
+  FILE *f = simEepromPath() ? fopen(simEepromPath(), "rb") : NULL;
+
+  this->size = std::min(size, (size_t)SIM_EEPROM_SIZE);
+  memset(data, 0xFF, sizeof(data));
+  if (f) {
+    if (fread(data, 1, sizeof(data), f) != sizeof(data))
+      fprintf(stderr, "sim: %s is short, rest erased\n", simEepromPath());
+    fclose(f);
+  }
+  dirty = false;
+}
+
+bool EEPROMClass::commit() {
+  SimHeapPause pause;
+  FILE *f;
+
+  if (!dirty || !size)
+    return true;
+  dirty = false;
+  fprintf(stderr, "sim: EEPROM sector written\n");
+  if (!simEepromPath())
+    return true;
+  if (!(f = fopen(simEepromPath(), "wb"))) {
+    perror(simEepromPath());
+    return false;
+  }
+  fwrite(data, 1, sizeof(data), f);
+  fclose(f);
+  return true;
+}
+
+/* LittleFS */
+
+static std::string simFsPath(const char *path) {
+  std::string p(simFsRoot());
+  if (*path != '/')
+    p += '/';
+  return p + path;
+}
+
+File::File(FILE *f, const char *name) : fp(f, fclose), path(name) {}
+
+size_t File::size() const {
+  struct stat st;
+  if (!fp || fstat(fileno(fp.get()), &st))
+    return 0;
+  return st.st_size;
+}
+
+size_t File::position() const {
+  return fp ? ftell(fp.get()) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  return fp && (fseek(fp.get(), pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0);
+}
+
+void File::close() {
+  fp.reset();
+}
+
+size_t File::write(const uint8_t *buf, size_t len) {
+  return fp ? fwrite(buf, 1, len, fp.get()) : 0;
+}
+
+int File::available() {
+  return fp ? (int)(size() - position()) : 0;
+}
+
+int File::read() {
+  int c = fp ? fgetc(fp.get()) : EOF;
+  return (c == EOF) ? -1 : c;
+}
+
+int File::peek() {
+  int c = read();
+  if (c >= 0)
+    ungetc(c, fp.get());
+  return c;
+}
+
+int File::read(uint8_t *buf, size_t len) {
+  return fp ? fread(buf, 1, len, fp.get()) : 0;
+}
+
+File FS::open(const char *path, const char *mode) {
+  std::string p = simFsPath(path);
+  std::string m(mode);
+
+  if (m.find('b') == std::string::npos)
+    m += 'b';
+  if (m[0] != 'r') {
+    for (size_t i = strlen(simFsRoot()) + 1; (i = p.find('/', i)) != std::string::npos; i++)
+      mkdir(p.substr(0, i).c_str(), 0755);
+  }
+  FILE *f = fopen(p.c_str(), m.c_str());
+  return f ? File(f, path) : File();
+}
+
+Dir FS::openDir(const char *path) {
+  Dir d;
+  d.path = simFsPath(path);
+  DIR *dir = opendir(d.path.c_str());
+  if (dir)
+    d.dir = std::shared_ptr<void>(dir, [](void *p) { closedir((DIR *)p); });
+  return d;
+}
+
+bool Dir::next() {
+  struct dirent *e;
+  struct stat st;
+
+  while (dir && (e = readdir((DIR *)dir.get()))) {
+    if (stat((path + "/" + e->d_name).c_str(), &st) || !S_ISREG(st.st_mode))
+      continue;
+    name = e->d_name;
+    size = st.st_size;
+    return true;
+  }
+  return false;
+}
+
+bool FS::exists(const char *path) {
+  struct stat st;
+  return stat(simFsPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path) {
+  return ::remove(simFsPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to) {
+  return ::rename(simFsPath(from).c_str(), simFsPath(to).c_str()) == 0;
+}
+
+bool FS::info(FSInfo &info) {
+  info.totalBytes = 1024 * 1024;
+  info.usedBytes = 0;
+  info.blockSize = 8192;
+  info.pageSize = 256;
+  info.maxOpenFiles = 5;
+  info.maxPathLength = 32;
+  return true;
+}
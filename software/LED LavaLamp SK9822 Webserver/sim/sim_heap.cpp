@@ -0,0 +1,196 @@
+/*
+  LED LAVA LAMP simulator - instrumented heap
+
+  Replaces the global operator new / delete. While the runner is inside
+  setup() or loop() (simHeapTrack()), every allocation is counted and
+  mirrored into a model of the ESP8266 heap: SIM_HEAP_SIZE bytes handed
+  out first-fit in 8 byte blocks with a 4 byte header, like umm_malloc.
+  ESP.getFreeHeap(), getMaxFreeBlockSize() and getHeapFragmentation()
+  report the model, so a request path that leaves small blocks behind
+  shows up as a shrinking largest free block, just like on the lamp.
+
+  Only the firmware's own allocations are modeled (the SDK, WiFi and
+  lwIP share the real heap too), and the simulator's bookkeeping runs
+  inside SimHeapPause so it is not counted.
+
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <map>
+#include <new>
+#include <unordered_map>
+#include "sim.h"
+
+// operator new below is malloc() underneath, so free() is the match
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+#define SIM_HEAP_BLOCK (8)
+#define SIM_HEAP_HEADER (4)
+#define SIM_HEAP_BLOCKS (SIM_HEAP_SIZE / SIM_HEAP_BLOCK)
+
+struct SimHeapBlock {
+  uint32_t start;     // first model block
+  uint32_t blocks;    // model blocks used
+  uint32_t size;      // bytes requested
+};
+
+static bool sim_heap_track;
+static int sim_heap_paused;     // SimHeapPause scopes
+static int sim_heap_busy;       // inside the model itself
+
+struct SimHeapBusy {
+  SimHeapBusy() { sim_heap_busy++; }
+  ~SimHeapBusy() { sim_heap_busy--; }
+};
+
+static SimHeapStats sim_heap;
+
+// never freed, so allocations released during static destruction still find them
+static std::map<uint32_t, uint32_t> *sim_heap_free;             // start -> length, in blocks
+static std::unordered_map<void *, SimHeapBlock> *sim_heap_used;
+
+SimHeapPause::SimHeapPause() { sim_heap_paused++; }
+SimHeapPause::~SimHeapPause() { sim_heap_paused--; }
+
+static void simHeapInit() {
+  if (sim_heap_free)
+    return;
+  SimHeapBusy busy;
+  sim_heap_free = new std::map<uint32_t, uint32_t>;
+  sim_heap_used = new std::unordered_map<void *, SimHeapBlock>;
+  (*sim_heap_free)[0] = SIM_HEAP_BLOCKS;
+}
+
+void simHeapTrack(bool on) {
+  simHeapInit();
+  sim_heap_track = on;
+}
+
+static void simHeapAlloc(void *p, size_t size) {
+  uint32_t need = (size + SIM_HEAP_HEADER + SIM_HEAP_BLOCK - 1) / SIM_HEAP_BLOCK;
+  SimHeapBusy busy;
+
+  sim_heap.allocs++;
+  sim_heap.alloc_bytes += size;
+  sim_heap.live_blocks++;
+  sim_heap.live_bytes += size;
+
+  for (auto it = sim_heap_free->begin(); it != sim_heap_free->end(); ++it) {
+    if (it->second < need)
+      continue;
+    uint32_t start = it->first;
+    uint32_t left = it->second - need;
+    sim_heap_free->erase(it);
+    if (left)
+      (*sim_heap_free)[start + need] = left;
+    (*sim_heap_used)[p] = SimHeapBlock{start, need, (uint32_t)size};
+    return;
+  }
+  // the lamp would have got NULL here
+  sim_heap.failures++;
+  (*sim_heap_used)[p] = SimHeapBlock{SIM_HEAP_BLOCKS, 0, (uint32_t)size};
+}
+
+static void simHeapRelease(void *p) {
+  SimHeapBusy busy;
+  auto used = sim_heap_used->find(p);
+
+  if (used == sim_heap_used->end())
+    return;
+  SimHeapBlock b = used->second;
+  sim_heap_used->erase(used);
+  sim_heap.frees++;
+  sim_heap.live_blocks--;
+  sim_heap.live_bytes -= b.size;
+  if (!b.blocks)
+    return;
+
+  // put the blocks back, merged with free neighbours
+  auto next = sim_heap_free->lower_bound(b.start);
+  if ((next != sim_heap_free->end()) && (next->first == b.start + b.blocks)) {
+    b.blocks += next->second;
+    next = sim_heap_free->erase(next);
+  }
+  if (next != sim_heap_free->begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == b.start) {
+      prev->second += b.blocks;
+      return;
+    }
+  }
+  (*sim_heap_free)[b.start] = b.blocks;
+}
+
+const SimHeapStats &simHeapStats() {
+  return sim_heap;
+}
+
+uint32_t simHeapFree() {
+  uint32_t blocks = 0;
+
+  simHeapInit();
+  for (auto &f : *sim_heap_free)
+    blocks += f.second;
+  return blocks * SIM_HEAP_BLOCK;
+}
+
+uint32_t simHeapMaxBlock() {
+  uint32_t blocks = 0;
+
+  simHeapInit();
+  for (auto &f : *sim_heap_free)
+    blocks = std::max(blocks, f.second);
+  return blocks ? blocks * SIM_HEAP_BLOCK - SIM_HEAP_HEADER : 0;
+}
+
+// same formula as the ESP8266 core: 100 - sqrt(sum(free^2)) * 100 / sum(free)
+uint8_t simHeapFragmentation() {
+  double sum = 0, squares = 0;
+
+  simHeapInit();
+  for (auto &f : *sim_heap_free) {
+    double bytes = (double)f.second * SIM_HEAP_BLOCK;
+    sum += bytes;
+    squares += bytes * bytes;
+  }
+  return sum ? (uint8_t)(100 - sqrt(squares) * 100 / sum) : 100;
+}
+
+/* global allocator */
+
+void *operator new(size_t size) {
+  void *p = malloc(size ? size : 1);
+
+  if (!p)
+    throw std::bad_alloc();
+  if (sim_heap_track && !sim_heap_paused && !sim_heap_busy)
+    simHeapAlloc(p, size);
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  if (!p)
+    return;
+  if (sim_heap_used && !sim_heap_busy)
+    simHeapRelease(p);
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+  (void)size;
+  operator delete(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+  (void)size;
+  operator delete(p);
+}
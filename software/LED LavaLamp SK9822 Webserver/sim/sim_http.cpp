@@ -0,0 +1,575 @@
+/*
+  LED LAVA LAMP simulator - HTTP request parser checks
+
+  lavasim -F DIR fuzzes the firmware's request parser (src/http.cpp)
+  with the corpus in DIR (sim/http/), one request per file:
+
+      # comment                 a line starting with '#'
+      expect STATUS             0 (parsed), 400, 414, 431 or "more"
+      expect FIELD VALUE        method, path, query, etag or close
+      GET / HTTP/1.1\r\n\r\n    everything else: the request bytes
+
+  Real newlines in a file are ignored, so long requests can be split
+  over lines; \r, \n, \t, \\ and \xHH are the escapes. Every file is
+  parsed in one piece, split in two at every position and a byte at a
+  time, which all have to agree with each other and with 'expect'.
+  Every pair of parsed files is sent back to back (pipelining), and
+  then FUZZ_ROUNDS random mutations of the corpus have to parse the
+  same way however they are split, without breaking the parser's
+  invariants. Build with -fsanitize=address,undefined to catch reads
+  and writes outside the slices.
+
+  lavasim -B compares the parser with the two it replaced, on the same
+  requests from a browser, curl and a cache revalidation:
+      string    String per line, one char at a time, copied by value
+                and searched with indexOf() (the original sketch)
+      line      fixed line buffer, one read() per char, strstr() on
+                the request line (web.cpp before http.cpp)
+      http      httpParse() on the receive buffer (http.h)
+  Requests/s are host numbers, only good for comparing the three; the
+  allocations per request are what the lamp would make, with String
+  modeled on the core's (about 10 bytes inline, then a heap buffer
+  grown in 16 byte steps).
+
+  Firmware without http.cpp (the Dimmable and Test sketches share this
+  simulator) only gets a message.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include "sim.h"
+
+#if !__has_include("http.h")
+
+int fuzzHttp(const char *dir) {
+  (void)dir;
+  printf("http: this firmware has no request parser\n");
+  return 2;
+}
+
+int benchHttp() {
+  return fuzzHttp(NULL);
+}
+
+#else
+
+#include "http.h"
+
+// Define the random mutations tried by the fuzzer
+#define FUZZ_ROUNDS (200000)
+
+// Define the requests per benchmark run, and the runs (the fastest counts)
+#define BENCH_REQUESTS (200000)
+#define BENCH_RUNS (5)
+
+// Define the requests whose allocations are counted
+#define BENCH_COUNTED (2000)
+
+// Define the bytes handed over per peekBuffer() (one TCP segment)
+#define BENCH_PBUF (536)
+
+static uint32_t http_rand = 2463534242u;
+
+static uint32_t httpRandom(uint32_t range) {
+  http_rand ^= http_rand << 13;
+  http_rand ^= http_rand >> 17;
+  http_rand ^= http_rand << 5;
+  return http_rand % range;
+}
+
+/* fuzzing */
+
+struct FuzzCase {
+  std::string name;
+  std::string data;
+  int expect;           // status, 0 = parsed, -1 = needs more bytes
+  std::vector<std::pair<std::string, std::string>> fields;   // expected slices
+};
+
+// what a parse came to, for comparing two ways of feeding the bytes
+struct FuzzResult {
+  size_t used;
+  HttpRequest r;
+
+  bool operator==(const FuzzResult &o) const {
+    return (used == o.used) && (r.done == o.r.done) && (r.status == o.r.status) &&
+           (r.close == o.r.close) && !strcmp(r.method, o.r.method) && !strcmp(r.path, o.r.path) &&
+           !strcmp(r.query, o.r.query) && !strcmp(r.etag, o.r.etag);
+  }
+};
+
+static bool fuzzLoad(const std::string &path, FuzzCase &fc) {
+  FILE *f = fopen(path.c_str(), "r");
+  char line[4096];
+
+  if (!f) {
+    perror(path.c_str());
+    return false;
+  }
+  fc.expect = 0;
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0] == '#')
+      continue;
+    if (!strncmp(line, "expect ", 7)) {
+      const char *value = strchr(line + 7, ' ');
+      if (value)
+        fc.fields.push_back({ std::string(line + 7, value - (line + 7)), value + 1 });
+      else
+        fc.expect = strcmp(line + 7, "more") ? atoi(line + 7) : -1;
+      continue;
+    }
+    for (const char *p = line; *p; p++) {
+      if (*p != '\\' || !p[1]) {
+        fc.data += *p;
+        continue;
+      }
+      switch (*++p) {
+        case 'r': fc.data += '\r'; break;
+        case 'n': fc.data += '\n'; break;
+        case 't': fc.data += '\t'; break;
+        case 'x':
+          if (isxdigit(p[1]) && isxdigit(p[2])) {
+            char hex[3] = { p[1], p[2], 0 };
+            fc.data += (char)strtoul(hex, NULL, 16);
+            p += 2;
+            break;
+          }
+          // fall through
+        default: fc.data += *p; break;
+      }
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// parse 'data' handed over in pieces ending at each of 'cuts'
+static FuzzResult fuzzParse(const std::string &data, const std::vector<size_t> &cuts) {
+  FuzzResult res;
+  size_t pos = 0;
+
+  httpBegin(res.r);
+  for (size_t i = 0; (i <= cuts.size()) && !res.r.done; i++) {
+    size_t end = (i < cuts.size()) ? std::min(cuts[i], data.size()) : data.size();
+    if (end < pos)
+      continue;
+    // a copy of just this piece, so reading past it is caught
+    std::vector<char> piece(data.begin() + pos, data.begin() + end);
+    pos += httpParse(res.r, piece.data(), piece.size());
+  }
+  res.used = pos;
+  return res;
+}
+
+static FuzzResult fuzzWhole(const std::string &data) {
+  return fuzzParse(data, std::vector<size_t>());
+}
+
+// the value parsed into 'field', NULL when there is no such field
+static const char *fuzzField(const HttpRequest &r, const std::string &field) {
+  if (field == "method") return r.method;
+  if (field == "path") return r.path;
+  if (field == "query") return r.query;
+  if (field == "etag") return r.etag;
+  if (field == "close") return r.close ? "1" : "0";
+  return NULL;
+}
+
+static bool fuzzSlice(const char *slice, size_t size) {
+  return memchr(slice, 0, size) != NULL;
+}
+
+// what has to hold however the request looks
+static const char *fuzzInvariant(const std::string &data, const FuzzResult &res) {
+  const HttpRequest &r = res.r;
+
+  if (res.used > data.size())
+    return "used more bytes than it was given";
+  if (!r.done && (res.used != data.size()))
+    return "stopped early without finishing";
+  if (!fuzzSlice(r.method, sizeof(r.method)) || !fuzzSlice(r.path, sizeof(r.path)) ||
+      !fuzzSlice(r.query, sizeof(r.query)) || !fuzzSlice(r.etag, sizeof(r.etag)) ||
+      !fuzzSlice(r.token, sizeof(r.token)))
+    return "slice not terminated";
+  if (r.status && (r.status != 400) && (r.status != 414) && (r.status != 431))
+    return "unknown status";
+  if (r.status && !r.close)
+    return "error without closing";
+  if (r.done && !r.status) {
+    if (!r.method[0] || (r.path[0] != '/'))
+      return "parsed without method or path";
+    if (r.headers > HTTP_HEADERS_MAX)
+      return "too many headers accepted";
+    // a parsed request ends with a blank line
+    if ((res.used < 2) || (data[res.used - 1] != '\n'))
+      return "parsed before the blank line";
+  }
+  return NULL;
+}
+
+static bool fuzzCheck(const char *name, const std::string &data, const FuzzResult &whole,
+                      const FuzzResult &other, const char *how) {
+  const char *broken = fuzzInvariant(data, other);
+
+  if (other == whole && !broken)
+    return true;
+  printf("http: %s: %s (%s)\n", name, broken ? broken : "differs from one piece", how);
+  printf("  whole: done %u status %u used %zu method '%s' path '%s' query '%s' etag '%s'\n",
+         whole.r.done, whole.r.status, whole.used, whole.r.method, whole.r.path, whole.r.query, whole.r.etag);
+  printf("  %s: done %u status %u used %zu method '%s' path '%s' query '%s' etag '%s'\n", how,
+         other.r.done, other.r.status, other.used, other.r.method, other.r.path, other.r.query, other.r.etag);
+  return false;
+}
+
+// one piece, every split in two, a byte at a time
+static bool fuzzSplits(const char *name, const std::string &data, bool every) {
+  FuzzResult whole = fuzzWhole(data);
+  std::vector<size_t> bytes;
+
+  if (!fuzzCheck(name, data, whole, whole, "one piece"))
+    return false;
+  for (size_t i = 1; i < data.size(); i++)
+    bytes.push_back(i);
+  if (!fuzzCheck(name, data, whole, fuzzParse(data, bytes), "byte at a time"))
+    return false;
+  for (size_t n = 0, cuts = every ? data.size() : 3; n < cuts; n++) {
+    size_t at = every ? n : httpRandom(data.size() + 1);
+    if (!fuzzCheck(name, data, whole, fuzzParse(data, { at }), "split in two"))
+      return false;
+  }
+  return true;
+}
+
+static void fuzzMutate(std::string &d) {
+  static const char interesting[] = " \r\n:/?\t";
+
+  for (uint32_t ops = 1 + httpRandom(4); ops; ops--) {
+    size_t at = httpRandom(d.size() + 1);
+    char c = httpRandom(2) ? interesting[httpRandom(sizeof(interesting) - 1)] : (char)httpRandom(256);
+    switch (httpRandom(6)) {
+      case 0: if (at < d.size()) d[at] = c; break;
+      case 1: d.insert(at, 1, c); break;
+      case 2: if (at < d.size()) d.erase(at, 1 + httpRandom(8)); break;
+      case 3: d.resize(at); break;
+      case 4: d.insert(at, d.substr(httpRandom(d.size() + 1), httpRandom(64))); break;
+      case 5: d.insert(at, std::string(httpRandom(2 * HTTP_LINE_MAX), 'a' + httpRandom(26))); break;
+    }
+  }
+}
+
+int fuzzHttp(const char *dir) {
+  std::vector<std::string> names;
+  std::vector<FuzzCase> corpus;
+  uint32_t failed = 0, pairs = 0, parsed = 0;
+  DIR *d = opendir(dir);
+  struct dirent *e;
+
+  if (!d) {
+    perror(dir);
+    return 2;
+  }
+  while ((e = readdir(d)))
+    if (e->d_name[0] != '.')
+      names.push_back(e->d_name);
+  closedir(d);
+  std::sort(names.begin(), names.end());
+
+  for (auto &n : names) {
+    FuzzCase fc;
+    fc.name = n;
+    if (!fuzzLoad(std::string(dir) + "/" + n, fc))
+      return 2;
+    corpus.push_back(fc);
+  }
+  if (corpus.empty()) {
+    printf("http: no corpus in %s\n", dir);
+    return 2;
+  }
+
+  // the corpus itself
+  for (auto &fc : corpus) {
+    FuzzResult res = fuzzWhole(fc.data);
+    int got = res.r.done ? res.r.status : -1;
+    if (!fuzzSplits(fc.name.c_str(), fc.data, true))
+      failed++;
+    else if (got != fc.expect) {
+      printf("http: %s: status %d, expected %d\n", fc.name.c_str(), got, fc.expect);
+      failed++;
+    }
+    else {
+      for (auto &f : fc.fields) {
+        const char *value = fuzzField(res.r, f.first);
+        if (!value || (f.second != value)) {
+          printf("http: %s: %s '%s', expected '%s'\n", fc.name.c_str(), f.first.c_str(),
+                 value ? value : "?", f.second.c_str());
+          failed++;
+        }
+      }
+      parsed += !got;
+    }
+  }
+
+  // pipelined: the second request has to parse as if it came alone
+  for (auto &a : corpus) {
+    for (auto &b : corpus) {
+      if (a.expect || b.expect)
+        continue;
+      FuzzResult first = fuzzWhole(a.data + b.data);
+      FuzzResult second = fuzzWhole((a.data + b.data).substr(first.used));
+      pairs++;
+      if (!(first == fuzzWhole(a.data)) || !(second == fuzzWhole(b.data))) {
+        printf("http: %s then %s: pipelined requests parse differently\n", a.name.c_str(), b.name.c_str());
+        failed++;
+      }
+    }
+  }
+
+  // mutations
+  for (uint32_t i = 0; (i < FUZZ_ROUNDS) && (failed < 10); i++) {
+    FuzzCase &fc = corpus[httpRandom(corpus.size())];
+    std::string data = fc.data;
+    fuzzMutate(data);
+    if (!fuzzSplits(fc.name.c_str(), data, false)) {
+      std::string shown;
+      for (unsigned char c : data) {
+        char hex[8];
+        snprintf(hex, sizeof(hex), (c >= ' ') && (c < 0x7f) && (c != '\\') ? "%c" : "\\x%02x", c);
+        shown += hex;
+      }
+      printf("  mutated: %s\n", shown.c_str());
+      failed++;
+    }
+  }
+
+  printf("http: %zu corpus files (%u parse), %u pipelined pairs, %u mutations: %s\n",
+         corpus.size(), parsed, pairs, FUZZ_ROUNDS, failed ? "FAIL" : "PASS");
+  return failed ? 1 : 0;
+}
+
+/* benchmark */
+
+static const char *bench_requests[] = {
+  // a phone browser pressing a plan button
+  "GET /m/1 HTTP/1.1\r\n"
+  "Host: 192.168.4.2\r\n"
+  "Connection: keep-alive\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (Linux; Android 14; Pixel 7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Mobile Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Referer: http://192.168.4.2/\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "\r\n",
+  // a script
+  "GET /b/2 HTTP/1.1\r\n"
+  "Host: 192.168.4.2\r\n"
+  "User-Agent: curl/8.5.0\r\n"
+  "Accept: */*\r\n"
+  "\r\n",
+  // the page revalidating the script it has cached
+  "GET /app.js HTTP/1.1\r\n"
+  "Host: 192.168.4.2\r\n"
+  "Connection: keep-alive\r\n"
+  "User-Agent: Mozilla/5.0 (Linux; Android 14; Pixel 7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Mobile Safari/537.36\r\n"
+  "Accept: */*\r\n"
+  "Referer: http://192.168.4.2/\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "If-None-Match: \"6b1f03c2-9a4\"\r\n"
+  "\r\n",
+};
+#define BENCH_KINDS (sizeof(bench_requests) / sizeof(bench_requests[0]))
+
+// the bytes of one request, read the way WiFiClient hands them out:
+// read() is a call per char (on the lamp it does a lot more)
+class BenchStream : public Stream {
+  public:
+    void start(const char *text) { buf = text; len = strlen(text); pos = 0; }
+    int available() override { return len - pos; }
+    __attribute__((noinline)) int read() override { return (pos < len) ? (uint8_t)buf[pos++] : -1; }
+    int peek() override { return (pos < len) ? (uint8_t)buf[pos] : -1; }
+    size_t write(uint8_t c) override { (void)c; return 0; }
+    const char *peekBuffer() { return buf + pos; }
+    size_t peekAvailable() { return std::min(len - pos, (size_t)BENCH_PBUF); }
+    void peekConsume(size_t n) { pos += n; }
+
+  private:
+    const char *buf;
+    size_t len, pos;
+};
+
+// the core's String as request parsing used it: short strings inline,
+// longer ones in a heap buffer reallocated in 16 byte steps
+class BenchString {
+  public:
+    BenchString() {}
+    BenchString(const BenchString &s) { append(s.c_str(), s.len); }
+    ~BenchString() { delete[] heap; }
+
+    void clear() { len = 0; buffer()[0] = 0; }    // keeps the buffer, like = ""
+    void append(const char *s, size_t n) {
+      if (len + n > cap) {
+        size_t size = (len + n + 16) & ~(size_t)15;
+        char *grown = new char[size];     // realloc() moves the block
+        memcpy(grown, c_str(), len + 1);
+        delete[] heap;
+        heap = grown;
+        cap = size - 1;
+      }
+      memcpy(buffer() + len, s, n);
+      len += n;
+      buffer()[len] = 0;
+    }
+    BenchString &operator+=(char c) { append(&c, 1); return *this; }
+    int indexOf(const char *s) const { const char *p = strstr(c_str(), s); return p ? p - c_str() : -1; }
+    char charAt(int i) const { return ((size_t)i < len) ? c_str()[i] : 0; }
+    const char *c_str() const { return heap ? heap : sso; }
+
+  private:
+    char *buffer() { return heap ? heap : sso; }
+    char sso[11] = "";
+    char *heap = NULL;
+    size_t len = 0;
+    size_t cap = 9;
+};
+
+static volatile uint32_t bench_sink;    // keeps the results from being optimized away
+
+// one request line at a time, as the original sketch did
+static void benchStringLine(BenchString line) {
+  if (line.indexOf("GET /m/") >= 0)
+    bench_sink += line.charAt(line.indexOf("GET /m/") + 7);
+  if (line.indexOf("GET /b/") >= 0)
+    bench_sink += line.charAt(line.indexOf("GET /b/") + 7);
+}
+
+static void benchParseString(BenchStream &s) {
+  BenchString currentLine;
+  bool currentLineIsBlank = true;
+
+  while (s.available()) {
+    char c = s.read();
+    if (c == '\n' && currentLineIsBlank) {
+      bench_sink++;
+      break;
+    }
+    if (c == '\n') {
+      benchStringLine(currentLine);
+      currentLineIsBlank = true;
+      currentLine.clear();
+    }
+    else if (c != '\r') {
+      currentLineIsBlank = false;
+      currentLine += c;
+    }
+  }
+}
+
+// the line buffer web.cpp used before http.cpp
+#define BENCH_LINE_MAX (128)
+
+static void benchParseLine(BenchStream &s) {
+  char line[BENCH_LINE_MAX], request[BENCH_LINE_MAX] = "", etag[24] = "";
+  const char *value;
+  uint8_t len = 0;
+  bool close = false;
+
+  while (s.available()) {
+    char ch = s.read();
+    if (ch == '\r')
+      continue;
+    if (ch != '\n') {
+      if (len < BENCH_LINE_MAX - 1)
+        line[len++] = ch;
+      continue;
+    }
+    line[len] = 0;
+    if (!len) {
+      static const char *cmds[] = { "GET /m/", "GET /b/", "GET /z/", "GET /show/", "GET /s/" };
+      for (const char *cmd : cmds) {
+        const char *p = strstr(request, cmd);
+        bench_sink += p ? p[7] : 0;
+      }
+      bench_sink += close + etag[0];
+      break;
+    }
+    if (!request[0])
+      strcpy(request, line);
+    else if (!strncasecmp(line, "If-None-Match:", 14)) {
+      for (value = line + 14; *value == ' '; value++)
+        ;
+      snprintf(etag, sizeof(etag), "%.23s", value);
+    }
+    else if (!strncasecmp(line, "Connection:", 11) && !strcasecmp(line + 12, "close"))
+      close = true;
+    len = 0;
+  }
+}
+
+static void benchParseHttp(BenchStream &s) {
+  HttpRequest r;
+  size_t len;
+
+  httpBegin(r);
+  while (!r.done && (len = s.peekAvailable()))
+    s.peekConsume(httpParse(r, s.peekBuffer(), len));
+  if (!strncmp(r.path, "/m/", 3) || !strncmp(r.path, "/b/", 3))
+    bench_sink += r.path[3];
+  bench_sink += r.close + r.etag[0];
+}
+
+// requests/s and the allocations made per request
+static void benchRun(const char *name, void (*parse)(BenchStream &)) {
+  BenchStream s;
+  size_t bytes = 0;
+  double secs = 1e9;
+
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    auto start = std::chrono::steady_clock::now();
+    bytes = 0;
+    for (uint32_t i = 0; i < BENCH_REQUESTS; i++) {
+      s.start(bench_requests[i % BENCH_KINDS]);
+      bytes += s.available();
+      parse(s);
+    }
+    secs = std::min(secs, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  SimHeapStats before = simHeapStats();
+  simHeapTrack(true);
+  for (uint32_t i = 0; i < BENCH_COUNTED; i++) {
+    s.start(bench_requests[i % BENCH_KINDS]);
+    parse(s);
+  }
+  simHeapTrack(false);
+  const SimHeapStats &after = simHeapStats();
+
+  printf("%-8s %10.0f %8.1f %12.2f %12.1f\n", name, BENCH_REQUESTS / secs, bytes / secs / 1e6,
+         (double)(after.allocs - before.allocs) / BENCH_COUNTED,
+         (double)(after.alloc_bytes - before.alloc_bytes) / BENCH_COUNTED);
+}
+
+int benchHttp() {
+  size_t bytes = 0;
+
+  for (auto req : bench_requests)
+    bytes += strlen(req);
+  printf("http: %u requests, %zu bytes on average, fastest of %u runs, host time\n",
+         BENCH_REQUESTS, bytes / BENCH_KINDS, BENCH_RUNS);
+  printf("%-8s %10s %8s %12s %12s\n", "parser", "req/s", "MB/s", "allocs/req", "bytes/req");
+  benchRun("string", benchParseString);
+  benchRun("line", benchParseLine);
+  benchRun("http", benchParseHttp);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,440 @@
+/*
+  LED LAVA LAMP simulator - lamps on a multicast bus
+
+  lavasim -M N runs N lamps, each the unmodified firmware in a process
+  of its own (the firmware is all globals), on one simulated multicast
+  bus. Lamp 0 is made sync master and the others followers, by the
+  same /s/N request a browser sends. The bus process steps the lamps in
+  lockstep, one SIM_BUS_STEP_US of bus time at a time, and between
+  steps carries every datagram sent to each of the other lamps:
+
+      -L PCT      lost on the way to each lamp with this chance (%)
+      -D MS       delivered this long after it was sent ...
+      -J MS       ... plus a random 0..MS more (multicast over WiFi
+                  waits for the access point's DTIM beacon)
+      -K PPM      every lamp's crystal is off by up to PPM, spread
+                  evenly from -PPM to +PPM
+
+  and the lamps are powered on at random times in the first
+  SIM_BUS_BOOT_MS. Every SIM_BUS_REPORT_MS the bus prints each
+  follower's lamp clock error (ms) and phase error (phase counts, 256 =
+  one sine table step) against the master, both taken at the same
+  moment of bus time; the phase of a follower one frame ahead or behind
+  is compared with the master phase moved by that many frames. At the
+  end it prints when each follower locked and from when it stayed in
+  step (phase error at most SIM_BUS_IN_STEP), the clock errors since,
+  and the beacons sent and received. It fails (exit status 1) when a
+  follower never locked or was not in step for the last half of the
+  run. The script (-s) drives lamp 0 only; -o TRACE writes TRACE.N for
+  lamp N.
+
+  Datagrams are delivered no sooner than the bus step after they were
+  sent, so -D below SIM_BUS_STEP_US is rounded up to it.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <Arduino.h>
+#include "sim.h"
+
+// Define the most lamps on the bus
+#define SIM_BUS_LAMPS (16)
+
+// Define the bus step in us (lamps wait for each other this often)
+#define SIM_BUS_STEP_US (1000)
+
+// Define the datagrams a lamp may send per step, and hold undelivered
+#define SIM_BUS_OUT (8)
+#define SIM_BUS_IN (64)
+
+// Define the window in which the lamps are powered on in ms
+#define SIM_BUS_BOOT_MS (5000)
+
+// Define how often the errors are printed in ms
+#define SIM_BUS_REPORT_MS (10000)
+
+// Define the largest phase error that counts as in step
+#define SIM_BUS_IN_STEP (256)
+
+struct BusPacket {
+  uint64_t at_us;           // bus time sent, or due at the lamp
+  uint16_t port;
+  uint16_t len;             // 0 = free slot
+  uint8_t data[SIM_UDP_MTU];
+};
+
+// what a lamp shows of itself at every step
+struct BusSample {
+  bool up;                  // powered on and set up
+  uint8_t role;             // SYNC_OFF, SYNC_FOLLOWER, SYNC_MASTER
+  bool locked;
+  uint8_t color_plan;
+  uint32_t lamp_ms;         // lampMillis()
+  uint32_t frame;           // display frame the phases belong to
+  uint16_t phase[3];        // first zone's color phases and their steps
+  uint16_t inc[3];
+};
+
+// one lamp's slot in the shared memory; 'out' and 'sample' are written
+// by the lamp during a step, 'in' by the bus between steps
+struct BusLamp {
+  uint64_t start_us;        // bus time the lamp is powered on
+  int32_t ppm;              // its clock error
+  BusSample sample;
+  uint32_t sent;            // datagrams in 'out'
+  BusPacket out[SIM_BUS_OUT];
+  BusPacket in[SIM_BUS_IN];
+  uint32_t sent_total;      // all datagrams sent, received, dropped
+  uint32_t received;
+  uint32_t dropped;         // 'out' or 'in' full
+};
+
+static BusLamp *bus;              // shared by the bus and every lamp
+static int bus_lamp = -1;         // this process's lamp, -1 = no bus
+static uint64_t bus_until_us;     // bus time this lamp may run to
+static int bus_go = -1;           // pipe: bus -> this lamp
+static int bus_done = -1;         // pipe: this lamp -> bus
+static bool bus_up;               // setup() ran
+
+static uint32_t bus_loss_pct;
+static uint32_t bus_latency_us = SIM_BUS_STEP_US;
+static uint32_t bus_jitter_us;
+static uint32_t bus_ppm;
+static uint32_t bus_rand = 2654435769u;
+
+static uint32_t busRandom(uint32_t range) {
+  bus_rand ^= bus_rand << 13;
+  bus_rand ^= bus_rand >> 17;
+  bus_rand ^= bus_rand << 5;
+  return range ? bus_rand % range : 0;
+}
+
+// bus time of this lamp's virtual clock
+static uint64_t busTime(uint64_t local_us) {
+  BusLamp &me = bus[bus_lamp];
+  return me.start_us + (uint64_t)(local_us * 1e6 / (1e6 + me.ppm));
+}
+
+void simBusConfig(uint32_t loss_pct, uint32_t latency_ms, uint32_t jitter_ms, uint32_t ppm) {
+  bus_loss_pct = std::min(loss_pct, 100u);
+  bus_latency_us = std::max(latency_ms * 1000, (uint32_t)SIM_BUS_STEP_US);
+  bus_jitter_us = jitter_ms * 1000;
+  bus_ppm = ppm;
+}
+
+/* lamp side */
+
+void simUdpSend(uint16_t port, const uint8_t *buf, size_t len) {
+  if (bus_lamp < 0)
+    return;
+  BusLamp &me = bus[bus_lamp];
+  if ((me.sent >= SIM_BUS_OUT) || !len || (len > SIM_UDP_MTU)) {
+    me.dropped++;
+    return;
+  }
+  BusPacket &p = me.out[me.sent++];
+  p.at_us = busTime(simMicros());
+  p.port = port;
+  p.len = len;
+  memcpy(p.data, buf, len);
+  me.sent_total++;
+}
+
+size_t simUdpRecv(uint16_t port, uint8_t *buf, size_t size) {
+  BusPacket *first = NULL;
+  size_t len;
+
+  if (bus_lamp < 0)
+    return 0;
+  uint64_t now = busTime(simMicros());
+  for (BusPacket &p : bus[bus_lamp].in) {
+    if (p.len && (p.port == port) && (p.at_us <= now) && (!first || (p.at_us < first->at_us)))
+      first = &p;
+  }
+  if (!first)
+    return 0;
+  len = std::min((size_t)first->len, size);
+  memcpy(buf, first->data, len);
+  first->len = 0;
+  bus[bus_lamp].received++;
+  return len;
+}
+
+static void busSample(BusSample &s);
+
+// this lamp reached the end of the step: wait for the others
+static void busBarrier() {
+  char c = 'd';
+
+  if (bus_up)
+    busSample(bus[bus_lamp].sample);
+  if ((write(bus_done, &c, 1) != 1) || (read(bus_go, &c, 1) != 1) || (c != 'g'))
+    simExit(0);
+  bus_until_us += SIM_BUS_STEP_US;
+}
+
+void simBusStep() {
+  if (bus_lamp < 0)
+    return;
+  while (busTime(simMicros()) >= bus_until_us)
+    busBarrier();
+}
+
+/* bus side */
+
+struct BusFollower {
+  int64_t locked_us = -1;       // bus time first locked
+  int64_t bad_us = 0;           // bus time last out of step
+  int32_t clock_lo = INT32_MAX; // clock error while in step
+  int32_t clock_hi = INT32_MIN;
+  uint32_t worst = 0;           // phase error in the last half
+};
+
+static uint32_t bus_lamps;
+static int bus_go_fd[SIM_BUS_LAMPS];
+static int bus_done_fd[SIM_BUS_LAMPS];
+static BusFollower bus_follower[SIM_BUS_LAMPS];
+
+// hand the datagrams sent in the last step to the other lamps
+static void busRoute() {
+  for (uint32_t i = 0; i < bus_lamps; i++) {
+    BusLamp &from = bus[i];
+    for (uint32_t k = 0; k < from.sent; k++) {
+      for (uint32_t j = 0; j < bus_lamps; j++) {
+        if ((j == i) || !bus[j].sample.up || (busRandom(100) < bus_loss_pct))
+          continue;
+        BusPacket *slot = std::find_if(bus[j].in, bus[j].in + SIM_BUS_IN, [](const BusPacket &p) { return !p.len; });
+        if (slot == bus[j].in + SIM_BUS_IN) {
+          bus[j].dropped++;
+          continue;
+        }
+        *slot = from.out[k];
+        slot->at_us += bus_latency_us + busRandom(bus_jitter_us + 1);
+      }
+    }
+    from.sent = 0;
+  }
+}
+
+// phase error of follower 'f' against master 'm', -1 = plans differ
+static int32_t busPhaseError(const BusSample &m, const BusSample &f) {
+  int32_t worst = 0;
+
+  if (m.color_plan != f.color_plan)
+    return -1;
+  for (int ch = 0; ch < 3; ch++) {
+    uint16_t expected = m.phase[ch] + (uint16_t)((f.frame - m.frame) * m.inc[ch]);
+    worst = std::max(worst, (int32_t)abs((int16_t)(f.phase[ch] - expected)));
+  }
+  return worst;
+}
+
+static void busMeasure(uint64_t now_us, uint64_t end_us) {
+  const BusSample &m = bus[0].sample;
+  bool report = (now_us % (SIM_BUS_REPORT_MS * 1000ULL) == 0);
+
+  if (report)
+    printf("%8.1f s", now_us / 1e6);
+  for (uint32_t j = 1; j < bus_lamps; j++) {
+    const BusSample &f = bus[j].sample;
+    BusFollower &st = bus_follower[j];
+    bool valid = m.up && f.up && (m.role == 2) && (f.role == 1) && f.locked;
+    int32_t phase = valid ? busPhaseError(m, f) : -1;
+    int32_t clock = (int32_t)(f.lamp_ms - m.lamp_ms);
+
+    if (valid && (st.locked_us < 0))
+      st.locked_us = now_us;
+    if ((phase < 0) || (phase > SIM_BUS_IN_STEP)) {
+      st.bad_us = now_us;
+      st.clock_lo = INT32_MAX;
+      st.clock_hi = INT32_MIN;
+    }
+    else {
+      st.clock_lo = std::min(st.clock_lo, clock);
+      st.clock_hi = std::max(st.clock_hi, clock);
+    }
+    if (now_us >= end_us / 2)
+      st.worst = std::max(st.worst, phase < 0 ? (uint32_t)65535 : (uint32_t)phase);
+    if (!report)
+      continue;
+    if (!valid)
+      printf("  %6s %6s", "-", "-");
+    else if (phase < 0)
+      printf("  %+6d %6s", clock, "plan");
+    else
+      printf("  %+6d %6d", clock, phase);
+  }
+  if (report)
+    printf("\n");
+}
+
+static int busReport(uint64_t end_us) {
+  int failed = 0;
+  // the master beacons from when it is made master (1 s after boot)
+  uint64_t beaconing = end_us - std::min(end_us, bus[0].start_us + 1000000);
+
+  printf("bus: lamp 0 (master) sent %u datagrams in %.1f s, %.1f per s\n", bus[0].sent_total, beaconing / 1e6,
+         beaconing ? bus[0].sent_total * 1e6 / beaconing : 0.0);
+  for (uint32_t j = 1; j < bus_lamps; j++) {
+    BusFollower &st = bus_follower[j];
+    printf("bus: lamp %u (%+d ppm, on at %.3f s) received %u, ", j, bus[j].ppm, bus[j].start_us / 1e6,
+           bus[j].received);
+    if (st.locked_us < 0) {
+      printf("never locked\n");
+      failed = 1;
+      continue;
+    }
+    printf("locked at %.1f s, ", st.locked_us / 1e6);
+    if ((uint64_t)st.bad_us >= end_us / 2) {
+      printf("out of step at %.1f s, worst phase error in the last half %u\n", st.bad_us / 1e6, st.worst);
+      failed = 1;
+      continue;
+    }
+    printf("in step from %.1f s, clock error %+d..%+d ms, worst phase error in the last half %u\n",
+           (st.bad_us + SIM_BUS_STEP_US) / 1e6, st.clock_lo, st.clock_hi, st.worst);
+  }
+  for (uint32_t j = 0; j < bus_lamps; j++) {
+    if (bus[j].dropped)
+      printf("bus: lamp %u dropped %u datagrams (queues full)\n", j, bus[j].dropped);
+  }
+  printf("bus: %s\n", failed ? "FAIL" : "PASS");
+  return failed;
+}
+
+int busStart(uint32_t lamps, uint64_t end_us) {
+  int go[2], done[2];
+  int status, failed = 0;
+
+  if ((lamps < 2) || (lamps > SIM_BUS_LAMPS)) {
+    fprintf(stderr, "bus: 2 to %u lamps\n", SIM_BUS_LAMPS);
+    exit(2);
+  }
+  bus_lamps = lamps;
+  bus = (BusLamp *)mmap(NULL, lamps * sizeof(BusLamp), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (bus == MAP_FAILED) {
+    perror("bus");
+    exit(2);
+  }
+  memset((void *)bus, 0, lamps * sizeof(BusLamp));
+  for (uint32_t i = 0; i < lamps; i++) {
+    bus[i].start_us = busRandom(SIM_BUS_BOOT_MS) * 1000ULL;
+    bus[i].ppm = -(int32_t)bus_ppm + (int32_t)(2 * bus_ppm * i / (lamps - 1));
+  }
+  printf("bus: %u lamps, %u%% loss, latency %.1f..%.1f ms, clocks within %u ppm\n", lamps, bus_loss_pct,
+         bus_latency_us / 1e3, (bus_latency_us + bus_jitter_us) / 1e3, bus_ppm);
+  printf("%10s", "bus time");
+  for (uint32_t j = 1; j < lamps; j++)
+    printf("  lamp %-2u clk/phase", j);
+  printf("\n");
+  fflush(stdout);
+
+  for (uint32_t i = 0; i < lamps; i++) {
+    pid_t pid;
+
+    if (pipe(go) || pipe(done) || ((pid = fork()) < 0)) {
+      perror("bus");
+      exit(2);
+    }
+    if (pid == 0) {
+      for (uint32_t j = 0; j < i; j++) {
+        close(bus_go_fd[j]);
+        close(bus_done_fd[j]);
+      }
+      close(go[1]);
+      close(done[0]);
+      bus_go = go[0];
+      bus_done = done[1];
+      bus_lamp = i;
+      bus_until_us = SIM_BUS_STEP_US;
+      // not powered on yet
+      while (bus_until_us <= bus[i].start_us)
+        busBarrier();
+      return i;
+    }
+    close(go[0]);
+    close(done[1]);
+    bus_go_fd[i] = go[1];
+    bus_done_fd[i] = done[0];
+  }
+
+  for (uint64_t now = SIM_BUS_STEP_US;; now += SIM_BUS_STEP_US) {
+    char c;
+
+    for (uint32_t i = 0; i < lamps; i++) {
+      if (read(bus_done_fd[i], &c, 1) != 1) {
+        fprintf(stderr, "bus: lamp %u ended\n", i);
+        failed = 1;
+      }
+    }
+    if (failed)
+      break;
+    busRoute();
+    busMeasure(now, end_us);
+    if (now >= end_us)
+      break;
+    c = 'g';
+    for (uint32_t i = 0; i < lamps; i++) {
+      if (write(bus_go_fd[i], &c, 1) != 1)
+        failed = 1;
+    }
+  }
+  fflush(stdout);
+  for (uint32_t i = 0; i < lamps; i++)
+    close(bus_go_fd[i]);
+  for (uint32_t i = 0; i < lamps; i++) {
+    wait(&status);
+    close(bus_done_fd[i]);
+  }
+  exit(failed ? 2 : busReport(end_us));
+}
+
+#if __has_include("sync.h")
+
+#include "lamp.h"
+#include "sync.h"
+
+extern uint32_t prev_frame;
+extern bool sync_locked;
+
+static void busSample(BusSample &s) {
+  const Zone &z = zone[0];
+
+  s.up = true;
+  s.role = syncRole;
+  s.locked = (syncRole == SYNC_FOLLOWER) && sync_locked;
+  s.color_plan = z.color_plan;
+  s.lamp_ms = lampMillis();
+  s.frame = prev_frame;
+  s.phase[0] = z.frame.phase.r;
+  s.phase[1] = z.frame.phase.g;
+  s.phase[2] = z.frame.phase.b;
+  s.inc[0] = z.color_inc.r;
+  s.inc[1] = z.color_inc.g;
+  s.inc[2] = z.color_inc.b;
+}
+
+bool simBusFirmware() {
+  return true;
+}
+
+#else
+
+static void busSample(BusSample &s) {
+  s.up = true;
+}
+
+bool simBusFirmware() {
+  return false;
+}
+
+#endif
+
+void simBusUp() {
+  bus_up = true;
+}
@@ -0,0 +1,198 @@
+/*
+  LED LAVA LAMP - LED frames over the serial port (Adalight)
+
+  see ada.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include <LavaEngine.h>
+#include "lamp.h"
+#include "show.h"
+#include "ada.h"
+
+// parser states
+#define ADA_MAGIC (0)         // matching "Ada", ada_pos bytes so far
+#define ADA_HI (1)            // LED count - 1, high byte
+#define ADA_LO (2)            // ... low byte
+#define ADA_CHECK (3)         // hi ^ lo ^ 0x55
+#define ADA_PIXELS (4)        // ada_left pixel bytes to go
+
+uint8_t ada_state = ADA_MAGIC;
+uint8_t ada_pos;              // magic bytes matched
+uint8_t ada_hi;
+uint8_t ada_lo;
+uint32_t ada_left;            // pixel bytes still to come
+uint16_t ada_led;             // LED the next pixel byte is for
+uint8_t ada_chan;             // ... and its channel (r, g, b)
+uint8_t ada_zone;             // zone of that LED
+uint8_t ada_bright;           // ... and its brightness
+
+uint32_t ada_byte_ms;         // millis() of the last byte read
+uint32_t ada_start_us;        // micros() of the first header byte
+uint32_t ada_last_ms;         // millis() when the last frame was shown
+bool ada_seen;                // a frame was shown since boot
+
+// statistics since the last report
+uint32_t ada_report_ms;
+uint32_t ada_frames;
+uint32_t ada_bad;
+uint32_t ada_overruns;
+uint32_t ada_lat_sum;         // latency of the frames shown in us
+uint32_t ada_lat_max;
+
+void adaBegin() {
+  Serial.setRxBufferSize(ADA_RX_BUF);
+  Serial.begin(ADA_BAUD);
+  // Adalight's hello, for hosts that wait for it after opening the port
+  if (!LED_PALETTE)
+    Serial.print("Ada\n");
+}
+
+// the brightness zone 'z' has from its BRIGHT PLAN right now
+uint8_t adaZoneBright(uint8_t z) {
+  BrightPlan p;
+
+  getBrightPlan(zone[z].bright_plan, p);
+  if (p.efftyp == LAVA_BRIGHT_FADE)
+    return LavaFadeBright::get(zone[z].frame, 0);
+  return LavaFixedBright::get(zone[z].frame, 0);
+}
+
+void adaReport() {
+  if (millis() - ada_report_ms < ADA_REPORT_MS)
+    return;
+  if (ada_frames || ada_bad || ada_overruns)
+    Serial.printf("ada: %u.%u fps, %u bad, %u overruns, latency avg %u max %u us\r\n",
+                  ada_frames * 1000 / ADA_REPORT_MS, ada_frames * 10000 / ADA_REPORT_MS % 10, ada_bad,
+                  ada_overruns, ada_frames ? ada_lat_sum / ada_frames : 0, ada_lat_max);
+  ada_report_ms = millis();
+  ada_frames = 0;
+  ada_bad = 0;
+  ada_overruns = 0;
+  ada_lat_sum = 0;
+  ada_lat_max = 0;
+}
+
+void adaHeader(uint8_t c) {
+  switch (ada_state) {
+    case ADA_MAGIC:
+      if (c != "Ada"[ada_pos])
+        ada_pos = 0;
+      if (c == "Ada"[ada_pos]) {
+        if (!ada_pos)
+          ada_start_us = micros();
+        if (++ada_pos == 3)
+          ada_state = ADA_HI;
+      }
+      break;
+
+    case ADA_HI:
+      ada_hi = c;
+      ada_state = ADA_LO;
+      break;
+
+    case ADA_LO:
+      ada_lo = c;
+      ada_state = ADA_CHECK;
+      break;
+
+    case ADA_CHECK:
+      ada_pos = 0;
+      if (c != (ada_hi ^ ada_lo ^ 0x55)) {
+        ada_bad++;
+        ada_state = ADA_MAGIC;
+        break;
+      }
+      // the frames own the framebuffer
+      if (showState == SHOW_PLAY)
+        showStop();
+      ada_left = 3 * ((((uint32_t)ada_hi << 8) | ada_lo) + 1);
+      ada_led = 0;
+      ada_chan = 0;
+      ada_zone = 0;
+      ada_bright = adaZoneBright(0);
+      ada_state = ADA_PIXELS;
+      break;
+  }
+}
+
+// the next pixel byte, into LED_fb
+inline void adaPixel(uint8_t v) {
+  if (ada_led < LED_FB_COUNT) {
+    LavaPixel &px = LED_fb[ada_led];
+    if (ada_chan == 0)
+      px.r = v;
+    else if (ada_chan == 1)
+      px.g = v;
+    else {
+      px.b = v;
+      px.bright = ada_bright;
+    }
+  }
+  if (++ada_chan < 3)
+    return;
+  ada_chan = 0;
+  ada_led++;
+  if ((ada_zone + 1 < zoneCount) && (ada_led >= zone[ada_zone + 1].first))
+    ada_bright = adaZoneBright(++ada_zone);
+}
+
+bool adaPoll() {
+  uint8_t buf[ADA_CHUNK];
+  int n;
+
+  // the zones draw through palettes, no framebuffer to take the frames
+  if (LED_PALETTE)
+    return false;
+  adaReport();
+  if (Serial.hasOverrun())
+    ada_overruns++;
+  n = Serial.available();
+  if (n <= 0) {
+    // drop a frame cut short, look for the next header
+    if (((ada_state != ADA_MAGIC) || ada_pos) && (millis() - ada_byte_ms >= ADA_BYTE_MS)) {
+      ada_bad++;
+      ada_state = ADA_MAGIC;
+      ada_pos = 0;
+    }
+    return false;
+  }
+  ada_byte_ms = millis();
+
+  while (n > 0) {
+    if (ada_state != ADA_PIXELS) {
+      adaHeader(Serial.read());
+      n--;
+      continue;
+    }
+    size_t len = Serial.readBytes(buf, min((uint32_t)min(n, ADA_CHUNK), ada_left));
+    if (!len)
+      break;
+    n -= len;
+    ada_left -= len;
+    for (size_t i = 0; i < len; i++)
+      adaPixel(buf[i]);
+    // complete: show it before the next frame is read over it
+    if (!ada_left) {
+      ada_state = ADA_MAGIC;
+      return true;
+    }
+  }
+  return false;
+}
+
+void adaShown() {
+  uint32_t lat = micros() - ada_start_us;
+
+  Serial.write(ADA_ACK);
+  ada_last_ms = millis();
+  ada_seen = true;
+  ada_frames++;
+  ada_lat_sum += lat;
+  ada_lat_max = max(ada_lat_max, lat);
+}
+
+bool adaActive() {
+  return (ada_state == ADA_PIXELS) || (ada_seen && (millis() - ada_last_ms < ADA_TIMEOUT_MS));
+}
@@ -0,0 +1,166 @@
+/*
+  LED LAVA LAMP - per-channel LED calibration
+
+  see calib.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include "LittleFS.h"
+#include <LavaEngine.h>
+#include "lamp.h"
+#include "calib.h"
+
+LavaCalib calib = lavaCalibNone;
+char calibProfile[CALIB_NAME_LEN] = "none";
+
+// fused tables for sine plans without and with gamma, built when first
+// needed (zones may run plans of both kinds at once)
+uint8_t calib_lut[2][3 * LAVA_SINE_STEPS];
+bool calib_lut_built[2];
+
+// hue tables and the plan each was built for
+uint8_t calib_hue_lut[CALIB_HUE_TABLES][LAVA_HUE_LUT];
+ColorPlan calib_hue_plan[CALIB_HUE_TABLES];
+bool calib_hue_built[CALIB_HUE_TABLES];
+
+char calib_use[CALIB_NAME_LEN];   // profile asked for by 'use'
+bool calib_in = true;             // lines apply to the profile we load
+bool calib_found = false;         // a profile was loaded
+
+// "a,b,c" -> v[0..2]
+bool calibTriple(const char *text, uint16_t v[3]) {
+  return sscanf(text, "%hu,%hu,%hu", &v[0], &v[1], &v[2]) == 3;
+}
+
+void calibLine(char *line) {
+  char *arg;
+  uint16_t v[3];
+
+  line[strcspn(line, "#\r")] = 0;
+  arg = line + strcspn(line, " \t");
+  if (*arg)
+    *arg++ = 0;
+  while ((*arg == ' ') || (*arg == '\t'))
+    arg++;
+  for (char *end = arg + strlen(arg); (end > arg) && ((end[-1] == ' ') || (end[-1] == '\t')); )
+    *--end = 0;
+
+  if (!strcmp(line, "use")) {
+    strncpy(calib_use, arg, sizeof(calib_use) - 1);
+  }
+  else if (!strcmp(line, "profile")) {
+    // without 'use' the first profile is loaded
+    calib_in = !calib_found && (!calib_use[0] || !strcmp(arg, calib_use));
+    if (calib_in) {
+      calib_found = true;
+      strncpy(calibProfile, arg, sizeof(calibProfile) - 1);
+    }
+  }
+  else if (!calib_in || !line[0]) {
+    return;
+  }
+  else if (!strcmp(line, "gain") && calibTriple(arg, v)) {
+    for (uint8_t ch = 0; ch < 3; ch++)
+      calib.gain[ch] = min(v[ch], (uint16_t)255);
+  }
+  else if (!strcmp(line, "gamma") && calibTriple(arg, v)) {
+    for (uint8_t ch = 0; ch < 3; ch++)
+      calib.gamma[ch] = constrain(v[ch], 50, 500);
+  }
+  else if (!strcmp(line, "white") && calibTriple(arg, v)) {
+    for (uint8_t ch = 0; ch < 3; ch++)
+      calib.white[ch] = min(v[ch], (uint16_t)255);
+  }
+  else
+    Serial.printf("calib: bad line '%s'\r\n", line);
+}
+
+void calibBegin() {
+  File f = LittleFS.open(CALIB_FILE, "r");
+  char line[CALIB_LINE_MAX];
+  uint8_t len = 0;
+  int c;
+
+  if (!f) {
+    Serial.println("calib: none");
+    return;
+  }
+  do {
+    c = f.read();
+    if ((c < 0) || (c == '\n')) {
+      line[len] = 0;
+      calibLine(line);
+      len = 0;
+    }
+    else if (len < sizeof(line) - 1)
+      line[len++] = c;
+  } while (c >= 0);
+  f.close();
+
+  if (calib_use[0] && !calib_found)
+    Serial.printf("calib: no profile '%s'\r\n", calib_use);
+  Serial.printf("calib: %s gain %u,%u,%u gamma %u,%u,%u white %u,%u,%u\r\n", calibProfile,
+                calib.gain[0], calib.gain[1], calib.gain[2], calib.gamma[0], calib.gamma[1], calib.gamma[2],
+                calib.white[0], calib.white[1], calib.white[2]);
+}
+
+// a zone other than the one drawing into 'f' shows hue table 't'
+bool calibHueInUse(uint8_t t, const LavaFrame &f) {
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    if ((&zone[z].frame != &f) && (zone[z].frame.lut == calib_hue_lut[t]))
+      return true;
+  }
+  return false;
+}
+
+bool calibHueSame(const ColorPlan &a, const ColorPlan &b) {
+  return (a.efftyp == b.efftyp) && (a.gamma == b.gamma) && (a.hue.a == b.hue.a) && (a.hue.b == b.hue.b);
+}
+
+// the hue table for 'plan': one built for it already, else a free one
+// (NULL when every table is shown by another zone)
+const uint8_t *calibHueLut(const ColorPlan &plan, const LavaFrame &f) {
+  uint8_t t;
+
+  for (t = 0; t < CALIB_HUE_TABLES; t++) {
+    if (calib_hue_built[t] && calibHueSame(calib_hue_plan[t], plan))
+      return calib_hue_lut[t];
+  }
+  for (t = 0; (t < CALIB_HUE_TABLES) && calibHueInUse(t, f); t++)
+    ;
+  if (t == CALIB_HUE_TABLES) {
+    Serial.println("calib: out of hue tables");
+    return NULL;
+  }
+  lavaBuildHueLut(calib, plan.efftyp, plan.hue.a, plan.hue.b, plan.gamma, calib_hue_lut[t]);
+  calib_hue_plan[t] = plan;
+  calib_hue_built[t] = true;
+  return calib_hue_lut[t];
+}
+
+bool calibPlan(const ColorPlan &plan, LavaFrame &f) {
+  if ((plan.efftyp == LAVA_COLOR_HSV) || (plan.efftyp == LAVA_COLOR_OKLAB)) {
+    const uint8_t *lut = calibHueLut(plan, f);
+
+    if (!lut)
+      return false;
+    f.lut = lut;
+    f.spread = plan.hue.spread;
+  }
+  else if (plan.efftyp == LAVA_COLOR_SINE) {
+    f.spread = 0;
+    if (!calib_lut_built[plan.gamma]) {
+      lavaBuildLut(calib, plan.gamma, calib_lut[plan.gamma]);
+      calib_lut_built[plan.gamma] = true;
+    }
+    f.lut = calib_lut[plan.gamma];
+  }
+  else {
+    f.spread = 0;
+    f.color.r = lavaCalibrate(calib, 0, plan.init.r, plan.gamma);
+    f.color.g = lavaCalibrate(calib, 1, plan.init.g, plan.gamma);
+    f.color.b = lavaCalibrate(calib, 2, plan.init.b, plan.gamma);
+  }
+  return true;
+}
@@ -0,0 +1,70 @@
+/*
+  LED LAVA LAMP - heap monitor
+
+  see heap.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include "heap.h"
+
+HeapSample heapSample[HEAP_SAMPLES];
+uint8_t heap_count;           // samples kept
+uint8_t heap_next;            // where the next sample goes
+HeapSample heap_worst;        // lowest free / max_block, highest frag
+uint32_t heap_prev_ms;        // millis() of the last sample
+uint32_t heap_uptime_s;       // seconds since boot, past millis() rollover
+uint16_t heap_uptime_ms;      // milliseconds not yet counted in heap_uptime_s
+
+void heapSampleNow() {
+  HeapSample &s = heapSample[heap_next];
+
+  s.free = min(ESP.getFreeHeap(), (uint32_t)0xFFFF);
+  s.max_block = min(ESP.getMaxFreeBlockSize(), (uint32_t)0xFFFF);
+  s.frag = ESP.getHeapFragmentation();
+
+  if (heap_count == 0) {
+    heap_worst = s;
+  } else {
+    heap_worst.free = min(heap_worst.free, s.free);
+    heap_worst.max_block = min(heap_worst.max_block, s.max_block);
+    heap_worst.frag = max(heap_worst.frag, s.frag);
+  }
+  if (heap_count < HEAP_SAMPLES)
+    heap_count++;
+  heap_next = (heap_next + 1) % HEAP_SAMPLES;
+
+  Serial.printf("heap: free %u, max block %u, frag %u%%\r\n", s.free, s.max_block, s.frag);
+}
+
+void heapBegin() {
+  heap_prev_ms = millis();
+  heap_uptime_s = heap_prev_ms / 1000;
+  heap_uptime_ms = heap_prev_ms % 1000;
+  heapSampleNow();
+}
+
+void heapPoll() {
+  uint32_t elapsed = millis() - heap_prev_ms;
+
+  if (elapsed < HEAP_SAMPLE_MS)
+    return;
+  heap_prev_ms += elapsed;
+  elapsed += heap_uptime_ms;
+  heap_uptime_s += elapsed / 1000;
+  heap_uptime_ms = elapsed % 1000;
+  heapSampleNow();
+}
+
+void heapJson(Print &out, uint32_t now) {
+  uint32_t uptime = heap_uptime_s + (now - heap_prev_ms + heap_uptime_ms) / 1000;
+
+  out.printf("{\"uptime\":%u,\"interval\":%u,\"worst\":{\"free\":%u,\"maxBlock\":%u,\"frag\":%u},\"samples\":[",
+             (unsigned)uptime, (unsigned)(HEAP_SAMPLE_MS / 1000),
+             heap_worst.free, heap_worst.max_block, heap_worst.frag);
+  for (uint8_t i = 0; i < heap_count; i++) {
+    const HeapSample &s = heapSample[(heap_next + HEAP_SAMPLES - heap_count + i) % HEAP_SAMPLES];
+    out.printf("%s[%u,%u,%u]", i ? "," : "", s.free, s.max_block, s.frag);
+  }
+  out.print("]}");
+}
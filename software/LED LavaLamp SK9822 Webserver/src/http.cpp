@@ -0,0 +1,252 @@
+/*
+  LED LAVA LAMP - HTTP request parser
+
+  see http.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include "http.h"
+
+// parser states
+#define HTTP_METHOD (0)       // request method, or blank lines before it
+#define HTTP_PATH (1)
+#define HTTP_QUERY (2)
+#define HTTP_VERSION (3)
+#define HTTP_LF (4)           // CR seen, LF must follow
+#define HTTP_HEADER (5)       // start of a header line, or the blank line
+#define HTTP_NAME (6)
+#define HTTP_SPACE (7)        // blanks before a header value
+#define HTTP_VALUE (8)
+#define HTTP_END (9)          // CR of the blank line seen
+#define HTTP_DONE (10)
+
+// headers kept
+#define HTTP_FIELD_OTHER (0)
+#define HTTP_FIELD_ETAG (1)
+#define HTTP_FIELD_CONNECTION (2)
+#define HTTP_FIELD_VERSION (3)  // not a header: the request line's version
+#define HTTP_FIELD_LENGTH (4)
+
+static void httpFail(HttpRequest &r, uint16_t status) {
+  r.status = status;
+  r.close = true;
+  r.done = true;
+  r.state = HTTP_DONE;
+}
+
+// append 'c' to a slice of 'size' bytes; false when it doesn't fit
+static inline bool httpPut(HttpRequest &r, char *slice, size_t size, char c) {
+  if (r.len >= size - 1)
+    return false;
+  slice[r.len++] = c;
+  slice[r.len] = 0;
+  return true;
+}
+
+// token characters of RFC 9110 (method and header names), one bit each
+static const uint32_t http_tchar[4] = { 0x00000000, 0x03ff6cfa, 0xc7fffffe, 0x57ffffff };
+
+static inline bool httpToken(char c) {
+  return ((uint8_t)c < 0x80) && (http_tchar[(uint8_t)c >> 5] & (1u << (c & 31)));
+}
+
+// drop the blanks at the end of a slice
+static void httpTrim(char *slice) {
+  size_t n = strlen(slice);
+  while (n && ((slice[n - 1] == ' ') || (slice[n - 1] == '\t')))
+    slice[--n] = 0;
+}
+
+// the request line or a header line ended
+static void httpEndLine(HttpRequest &r) {
+  if (r.field == HTTP_FIELD_VERSION) {
+    if (!strcmp(r.token, "HTTP/1.0"))
+      r.close = true;
+    else if (strcmp(r.token, "HTTP/1.1")) {
+      httpFail(r, 400);
+      return;
+    }
+  }
+  else if (r.field == HTTP_FIELD_ETAG)
+    httpTrim(r.etag);
+  else if (r.field == HTTP_FIELD_CONNECTION) {
+    httpTrim(r.token);
+    if (!strcasecmp(r.token, "close"))
+      r.close = true;
+    else if (!strcasecmp(r.token, "keep-alive"))
+      r.close = false;
+  }
+  r.field = HTTP_FIELD_OTHER;
+  r.line = 0;
+  r.state = HTTP_HEADER;
+}
+
+void httpBegin(HttpRequest &r) {
+  memset(&r, 0, sizeof(r));
+  r.state = HTTP_METHOD;
+}
+
+size_t httpParse(HttpRequest &r, const char *buf, size_t len) {
+  size_t i;
+
+  for (i = 0; (i < len) && !r.done; i++) {
+    char c = buf[i];
+
+    if ((c != '\r') && (c != '\n') && (++r.line > HTTP_LINE_MAX)) {
+      httpFail(r, (r.state <= HTTP_VERSION) ? 414 : 431);
+      return i + 1;
+    }
+
+    switch (r.state) {
+      case HTTP_METHOD:
+        if (c == ' ' && r.len) {
+          r.len = 0;
+          r.state = HTTP_PATH;
+        }
+        else if (((c == '\r') || (c == '\n')) && !r.len)
+          ;   // blank lines between requests
+        else if (!httpToken(c) || !httpPut(r, r.method, sizeof(r.method), c))
+          httpFail(r, 400);
+        break;
+
+      case HTTP_PATH:
+        if ((c == ' ') || (c == '?')) {
+          if (!r.len) {
+            httpFail(r, 400);
+            break;
+          }
+          r.len = 0;
+          r.state = (c == '?') ? HTTP_QUERY : HTTP_VERSION;
+          r.field = HTTP_FIELD_VERSION;
+        }
+        else if ((c <= ' ') || (c >= 0x7f) || (!r.len && (c != '/')))
+          httpFail(r, 400);
+        else if (!httpPut(r, r.path, sizeof(r.path), c))
+          httpFail(r, 414);
+        break;
+
+      case HTTP_QUERY:
+        if (c == ' ') {
+          r.len = 0;
+          r.state = HTTP_VERSION;
+        }
+        else if ((c < ' ') || (c >= 0x7f))
+          httpFail(r, 400);
+        else if (!httpPut(r, r.query, sizeof(r.query), c))
+          httpFail(r, 414);
+        break;
+
+      case HTTP_VERSION:
+        if (c == '\r')
+          r.state = HTTP_LF;
+        else if (c == '\n')
+          httpEndLine(r);
+        else if ((c <= ' ') || !httpPut(r, r.token, sizeof(r.token), c))
+          httpFail(r, 400);
+        break;
+
+      case HTTP_LF:
+        if (c == '\n')
+          httpEndLine(r);
+        else
+          httpFail(r, 400);
+        break;
+
+      case HTTP_HEADER:
+        if (c == '\r')
+          r.state = HTTP_END;
+        else if (c == '\n')
+          r.done = true;
+        else if (!httpToken(c))
+          httpFail(r, 400);   // also obsolete line folding
+        else if (++r.headers > HTTP_HEADERS_MAX)
+          httpFail(r, 431);
+        else {
+          r.len = 0;
+          r.token[0] = 0;
+          httpPut(r, r.token, sizeof(r.token), c);
+          r.state = HTTP_NAME;
+        }
+        break;
+
+      case HTTP_NAME:
+        if (c == ':') {
+          if (!strcasecmp(r.token, "If-None-Match"))
+            r.field = HTTP_FIELD_ETAG;
+          else if (!strcasecmp(r.token, "Connection"))
+            r.field = HTTP_FIELD_CONNECTION;
+          else if (!strcasecmp(r.token, "Content-Length"))
+            r.field = HTTP_FIELD_LENGTH;
+          else {
+            // a chunked body would be read as the next request
+            if (!strcasecmp(r.token, "Transfer-Encoding"))
+              r.close = true;
+            r.field = HTTP_FIELD_OTHER;
+          }
+          r.len = 0;
+          r.token[0] = 0;
+          r.state = HTTP_SPACE;
+        }
+        else if (!httpToken(c))
+          httpFail(r, 400);
+        else if (!httpPut(r, r.token, sizeof(r.token), c))
+          r.token[0] = 0;     // too long to be one we keep
+        break;
+
+      case HTTP_SPACE:
+        if ((c == ' ') || (c == '\t'))
+          break;
+        r.state = HTTP_VALUE;
+        // fall through
+      case HTTP_VALUE:
+        if ((r.field == HTTP_FIELD_OTHER) && (((uint8_t)c >= ' ') || (c == '\t'))) {
+          // nobody reads this value: skip to its end (or the line
+          // limit, checked above) in one go
+          size_t end = i + 1;
+          size_t stop = min(len, i + 1 + (HTTP_LINE_MAX - r.line));
+          while ((end < stop) && (((uint8_t)buf[end] >= ' ') || (buf[end] == '\t')))
+            end++;
+          r.line += end - i - 1;
+          i = end - 1;
+        }
+        else if (c == '\r')
+          r.state = HTTP_LF;
+        else if (c == '\n')
+          httpEndLine(r);
+        else if ((c < ' ') && (c != '\t'))
+          httpFail(r, 400);
+        else if (r.field == HTTP_FIELD_ETAG) {
+          if (!httpPut(r, r.etag, sizeof(r.etag), c)) {
+            // keep the whole entries of the list, skip the rest
+            char *comma = strrchr(r.etag, ',');
+            if (comma)
+              *comma = 0;
+            else
+              r.etag[0] = 0;
+            httpTrim(r.etag);
+            r.field = HTTP_FIELD_OTHER;
+          }
+        }
+        else if (r.field == HTTP_FIELD_CONNECTION)
+          httpPut(r, r.token, sizeof(r.token), c);
+        else if (r.field == HTTP_FIELD_LENGTH) {
+          // the body isn't read: after one the connection is closed,
+          // so its bytes can't pass for the next request
+          if ((c > '0') && (c <= '9'))
+            r.close = true;
+          else if ((c != '0') && (c != ' ') && (c != '\t'))
+            httpFail(r, 400);
+        }
+        break;
+
+      case HTTP_END:
+        if (c == '\n')
+          r.done = true;
+        else
+          httpFail(r, 400);
+        break;
+    }
+  }
+  return i;
+}
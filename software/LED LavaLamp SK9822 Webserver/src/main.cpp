@@ -12,6 +12,16 @@
 #include <ESP8266WebServer.h>
 #include <WiFiManager.h>         // https://github.com/tzapu/WiFiManager
 #include "LittleFS.h"
+#include <LavaEngine.h>
+#include "lamp.h"
+#include "sync.h"
+#include "web.h"
+#include "heap.h"
+#include "calib.h"
+#include "show.h"
+#include "mqtt.h"
+#include "wlan.h"
+#include "ada.h"
 
 #define TRUE (1 == 1)
 #define FALSE (1 == 0)
@@ -25,11 +35,10 @@
 // determine if GAMMA CORRECTION is used
 #define GAMMA (TRUE)
 
-// Define how many LED are in the chain (1..n)
-#define LED_COUNT (5)
-
-// Define the display update cycle in ms
-#define CYCLE_MS (200)
+// Define the zones as LED counts along the chain, from the first LED on
+// (e.g. { 1, 4 } for a base LED under a column of four); they should
+// add up to LED_COUNT
+#define ZONE_SIZES { LED_COUNT }
 
 // Define the USER BOTTON input pin
 #define BUTTON (12)
@@ -42,6 +51,10 @@
 #define BUTTON_LONG_PRESS_MS (5000)
 #define BUTTON_LG_CYC (BUTTON_LONG_PRESS_MS / CYCLE_MS)
 
+// Define the most display frames the phase may advance in one update
+// (more than this means the lamp clock was stepped, e.g. by sync)
+#define FRAME_SKIP_MAX (50)
+
 // Define the APA102 data and clock pins
 const uint8_t dataPin = 13;
 const uint8_t clockPin = 14;
@@ -49,180 +62,250 @@ const uint8_t clockPin = 14;
 // Create an object for writing to the LED strip.
 APA102<dataPin, clockPin> ledStrip;
 
-// 128 entry SINE lookup table -- AMPL = 120, OFFSET = 135
-uint8_t sinetbl[128] = {
-  0x87, 0x8C, 0x92, 0x98, 0x9E, 0xA4, 0xA9, 0xAF, 
-  0xB4, 0xBA, 0xBF, 0xC4, 0xC9, 0xCE, 0xD3, 0xD7, 
-  0xDB, 0xDF, 0xE3, 0xE7, 0xEA, 0xED, 0xF0, 0xF3, 
-  0xF5, 0xF7, 0xF9, 0xFB, 0xFC, 0xFD, 0xFE, 0xFE, 
-  0xFF, 0xFE, 0xFE, 0xFD, 0xFC, 0xFB, 0xF9, 0xF7,  // sine[0x20] MAX
-  0xF5, 0xF3, 0xF0, 0xED, 0xEA, 0xE7, 0xE3, 0xDF, 
-  0xDB, 0xD7, 0xD3, 0xCE, 0xC9, 0xC4, 0xBF, 0xBA, 
-  0xB4, 0xAF, 0xA9, 0xA4, 0x9E, 0x98, 0x92, 0x8C, 
-  0x87, 0x82, 0x7C, 0x76, 0x70, 0x6A, 0x65, 0x5F, 
-  0x5A, 0x54, 0x4F, 0x4A, 0x45, 0x40, 0x3B, 0x37, 
-  0x33, 0x2F, 0x2B, 0x27, 0x24, 0x21, 0x1E, 0x1B, 
-  0x19, 0x17, 0x15, 0x13, 0x12, 0x11, 0x10, 0x10, 
-  0x0F, 0x10, 0x10, 0x11, 0x12, 0x13, 0x15, 0x17, // sine[0x60] MIN
-  0x19, 0x1B, 0x1E, 0x21, 0x24, 0x27, 0x2B, 0x2F, 
-  0x33, 0x37, 0x3B, 0x40, 0x45, 0x4A, 0x4F, 0x54, 
-  0x5A, 0x5F, 0x65, 0x6A, 0x70, 0x76, 0x7C, 0x82
-};
-
-// Gamma brightness lookup table <https://victornpb.github.io/gamma-table-generator>
-// gamma = 2.50 steps = 256 range = 0-255
-const uint8_t gamma_lut[256] = {
-     0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-     0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
-     1,   2,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   4,   4,
-     4,   4,   4,   5,   5,   5,   5,   6,   6,   6,   6,   7,   7,   7,   7,   8,
-     8,   8,   9,   9,   9,  10,  10,  10,  11,  11,  12,  12,  12,  13,  13,  14,
-    14,  15,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,  20,  20,  21,  22,
-    22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,  30,  30,  31,  32,
-    33,  33,  34,  35,  36,  36,  37,  38,  39,  40,  40,  41,  42,  43,  44,  45,
-    46,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,
-    61,  62,  63,  64,  65,  67,  68,  69,  70,  71,  72,  73,  75,  76,  77,  78,
-    80,  81,  82,  83,  85,  86,  87,  89,  90,  91,  93,  94,  95,  97,  98,  99,
-   101, 102, 104, 105, 107, 108, 110, 111, 113, 114, 116, 117, 119, 121, 122, 124,
-   125, 127, 129, 130, 132, 134, 135, 137, 139, 141, 142, 144, 146, 148, 150, 151,
-   153, 155, 157, 159, 161, 163, 165, 166, 168, 170, 172, 174, 176, 178, 180, 182,
-   184, 186, 189, 191, 193, 195, 197, 199, 201, 204, 206, 208, 210, 212, 215, 217,
-   219, 221, 224, 226, 228, 231, 233, 235, 238, 240, 243, 245, 248, 250, 253, 255,
-  };   
-
-// Set web server port number to 80
-WiFiServer server(80);
-
-struct ColorTuple {
-  uint16_t r;
-  uint16_t g;
-  uint16_t b
-};
-
-struct ColorPlan {
-  String name;
-  uint8_t efftyp;     // 0 = fixed, 1 = sine, 2 = random walk
-  ColorTuple init;
-  ColorTuple effect;
-  bool gamma
-};
-
-struct BrightPlan {
-  String name;
-  uint8_t efftyp;     // 0 = fixed, 1 = fade, 2 = stars
-  uint16_t init;
-  uint16_t effect
-};
-
-ColorPlan colorPlan[12] = {
+const ColorPlan colorPlan[] PROGMEM = {
   { //0
     .name = "Fast",
     .efftyp = 1,
-    .init.r = 111,
-    .init.g = 86,
-    .init.b = 98,
-    .effect.r = 125,
-    .effect.g = 93,
-    .effect.b = 26,
-    .gamma = true
+    .init = { 111, 86, 98 },
+    .effect = { 125, 93, 26 },
+    .gamma = true,
+    .hue = {}
   },
   { //1
     .name = "Medium",
     .efftyp = 1,
-    .init.r = 111,
-    .init.g = 86,
-    .init.b = 98,
-    .effect.r = 62,
-    .effect.g = 47,
-    .effect.b = 13,
-    .gamma = true
+    .init = { 111, 86, 98 },
+    .effect = { 62, 47, 13 },
+    .gamma = true,
+    .hue = {}
   },
   { //2
     .name = "Slow",
     .efftyp = 1,
-    .init.r = 111,
-    .init.g = 86,
-    .init.b = 98,
-    .effect.r = 31,
-    .effect.g = 23,
-    .effect.b = 7,
-    .gamma = true
+    .init = { 111, 86, 98 },
+    .effect = { 31, 23, 7 },
+    .gamma = true,
+    .hue = {}
   },
   { //3
     .name = "Glacial",
     .efftyp = 1,
-    .init.r = 111,
-    .init.g = 86,
-    .init.b = 98,
-    .effect.r = 15,
-    .effect.g = 11,
-    .effect.b = 3,
-    .gamma = true
+    .init = { 111, 86, 98 },
+    .effect = { 15, 11, 3 },
+    .gamma = true,
+    .hue = {}
   },
   { //4
     .name = "Lamp",
     .efftyp = 0,
-    .init.r = 255,
-    .init.g = 255,
-    .init.b = 255,
-    .gamma = false
+    .init = { 255, 255, 255 },
+    .effect = { 0, 0, 0 },
+    .gamma = false,
+    .hue = {}
+  },
+  { //5 HSV rainbow drifting along the chain
+    .name = "Rainbow",
+    .efftyp = 2,
+    .init = { 0, 32, 0 },
+    .effect = { 40, 0, 0 },
+    .gamma = true,
+    .hue = { .a = 255, .b = 255, .spread = 0x0C00 }
+  },
+  { //6 OKLab teal to blue, lightness breathing
+    .name = "Ocean",
+    .efftyp = 3,
+    .init = { 140, 32, 0 },
+    .effect = { 6, 24, 0 },
+    .gamma = false,
+    .hue = { .a = 180, .b = 70, .spread = 0x0600 }
+  },
+  { //7 OKLab hue circle at even lightness
+    .name = "Aurora",
+    .efftyp = 3,
+    .init = { 0, 32, 0 },
+    .effect = { 24, 0, 0 },
+    .gamma = false,
+    .hue = { .a = 200, .b = 80, .spread = 0x1000 }
   }
 };
-uint8_t lastColorPlan = 4;
+const uint8_t lastColorPlan = sizeof(colorPlan) / sizeof(colorPlan[0]) - 1;
 uint8_t curColorPlan = 0;
+ColorPlan curColor;
 
-BrightPlan brightPlan[16] = {
+const BrightPlan brightPlan[] PROGMEM = {
   { //0
     .name = "Dim",
     .efftyp = 0,
-    .init = 11
+    .init = 11,
+    .effect = 0
   },
   { //1
     .name = "Normal",
     .efftyp = 0,
-    .init = 19
+    .init = 19,
+    .effect = 0
   },
   { //2
     .name = "Solar",
     .efftyp = 0,
-    .init = 31
+    .init = 31,
+    .effect = 0
   }
 };
-uint8_t lastBrightPlan = 2; // highest numbered valid BrightPlan entry
+const uint8_t lastBrightPlan = sizeof(brightPlan) / sizeof(brightPlan[0]) - 1;
 uint8_t curBrightPlan = 0;  // initial BrightPlan number
+BrightPlan curBright;
+
+
+
+const uint16_t zoneSize[] = ZONE_SIZES;
+const uint8_t zoneCount = sizeof(zoneSize) / sizeof(zoneSize[0]);
+Zone zone[sizeof(zoneSize) / sizeof(zoneSize[0])];
 
+LavaPixel LED_fb[LED_FB_COUNT];  // framebuffer the zones (or a show) are drawn into
 
+// with LED_PALETTE: a palette per zone and every LED's index into it
+LavaPixel zone_pal[LED_PALETTE ? sizeof(zoneSize) / sizeof(zoneSize[0]) : 1][LED_PALETTE ? LAVA_PALETTE_SIZE : 1];
+uint8_t LED_ix[LED_PALETTE ? LED_COUNT : 1];
 
 uint8_t button_deb;         // user button debounce timer
 int8_t button_st;           // user button state
-uint32_t prev_ms = 0;       // for non-blocking delay
+uint32_t prev_frame = 0;    // for non-blocking delay
 uint32_t curr_ms;           // for non-blocking delay
 
-// turn OFF all of the LED by setting RBGI = 0000
-void blankLED() {
-  ledStrip.startFrame();
-  for(uint8_t i = 0; i < LED_COUNT; i++)
-    ledStrip.sendColor(0,0,0,0);
-  ledStrip.endFrame(LED_COUNT);
+void getColorPlan(uint8_t plan, ColorPlan &p) {
+  memcpy_P(&p, &colorPlan[plan], sizeof(ColorPlan));
+}
+
+void getBrightPlan(uint8_t plan, BrightPlan &p) {
+  memcpy_P(&p, &brightPlan[plan], sizeof(BrightPlan));
+}
+
+// pick the effect pipeline specialized for the zone's COLOR and BRIGHT plans
+// (gamma and calibration are already in the plan's colors, see calibPlan())
+void selectRenderer(Zone &zn) {
+  ColorPlan c;
+  BrightPlan b;
+
+  getColorPlan(zn.color_plan, c);
+  getBrightPlan(zn.bright_plan, b);
+  zn.render = lavaRendererLut<LavaSpan>(c.efftyp, b.efftyp);
 }
 
-// make all the LED the same RGBI color
-void colorLED(uint8_t red,uint8_t green,uint8_t blue, uint8_t bright) {
-  ledStrip.startFrame();
-  for(uint8_t i = 0; i < LED_COUNT; i++)
-    ledStrip.sendColor(red,green,blue,bright);
-  ledStrip.endFrame(LED_COUNT);
+// lay the zones out along the chain
+void zoneBegin() {
+  uint16_t first = 0;
+
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    zone[z].first = first;
+    zone[z].count = min(zoneSize[z], (uint16_t)(LED_COUNT - first));
+    first += zone[z].count;
+  }
+  if (first != LED_COUNT)
+    Serial.printf("ZONES COVER %u OF %u LED\r\n", first, LED_COUNT);
+}
+
+// select a COLOR PLAN for one zone and restart its phase accumulators;
+// a hue plan without a free hue table is refused and the zone keeps its plan
+bool selectZoneColorPlan(uint8_t z, uint8_t plan) {
+  Zone &zn = zone[z];
+  LavaFrame prev = zn.frame;
+  ColorPlan p;
+
+  getColorPlan(plan, p);
+  zn.frame.color = p.init;
+  zn.frame.phase.r = p.init.r << 8;
+  zn.frame.phase.g = p.init.g << 8;
+  zn.frame.phase.b = p.init.b << 8;
+  if (!calibPlan(p, zn.frame)) {
+    zn.frame = prev;
+    Serial.printf("zone %u: color plan %u refused\r\n", z, plan);
+    return false;
+  }
+  zn.color_plan = plan;
+  zn.color_inc = (p.efftyp != LAVA_COLOR_FIXED) ? p.effect : ColorTuple{ 0, 0, 0 };
+  selectRenderer(zn);
+  if (LED_PALETTE)
+    lavaPaletteIndex(LED_ix + zn.first, zn.count, zn.frame.spread);
+  return true;
 }
 
-// set only one LED to an RGBI color
-void colorOneLED(uint8_t red,uint8_t green,uint8_t blue, uint8_t bright) {
-  ledStrip.startFrame();
-  ledStrip.sendColor(0,0,0,0);
-  ledStrip.sendColor(0,0,0,0);
-  ledStrip.sendColor(red,green,blue,bright);
-  ledStrip.sendColor(0,0,0,0);
-  ledStrip.sendColor(0,0,0,0);
-  ledStrip.endFrame(1);
+// select a BRIGHT PLAN for one zone
+void selectZoneBrightPlan(uint8_t z, uint8_t plan) {
+  Zone &zn = zone[z];
+  BrightPlan p;
+
+  getBrightPlan(plan, p);
+  zn.bright_plan = plan;
+  zn.bright_inc = (p.efftyp == LAVA_BRIGHT_FADE) ? p.effect : 0;
+  zn.frame.bright = p.init;
+  zn.frame.bright_phase = p.init << 8;
+  selectRenderer(zn);
+}
+
+// select a new COLOR PLAN for the whole lamp (ends a show playing)
+void selectColorPlan(uint8_t plan) {
+  if (showState == SHOW_PLAY)
+    showStop();
+  curColorPlan = plan;
+  getColorPlan(plan, curColor);
+  // every zone changes, so none holds on to its hue table: one is enough
+  for (uint8_t z = 0; z < zoneCount; z++)
+    zone[z].frame.lut = NULL;
+  for (uint8_t z = 0; z < zoneCount; z++)
+    selectZoneColorPlan(z, plan);
+}
+
+// select a new BRIGHT PLAN for the whole lamp (ends a show playing)
+void selectBrightPlan(uint8_t plan) {
+  if (showState == SHOW_PLAY)
+    showStop();
+  curBrightPlan = plan;
+  getBrightPlan(plan, curBright);
+  for (uint8_t z = 0; z < zoneCount; z++)
+    selectZoneBrightPlan(z, plan);
+}
+
+// show any color on the whole lamp through the first fixed COLOR PLAN
+void selectColor(ColorTuple color) {
+  ColorPlan p;
+  uint8_t plan;
+
+  for (plan = 0; plan <= lastColorPlan; plan++) {
+    getColorPlan(plan, p);
+    if (p.efftyp == LAVA_COLOR_FIXED)
+      break;
+  }
+  if (plan > lastColorPlan)
+    return;
+  selectColorPlan(plan);
+  curColor.init = color;
+  for (uint8_t z = 0; z < zoneCount; z++)
+    calibPlan(curColor, zone[z].frame);
+}
+
+// draw every zone into the framebuffer (or its palette), then send it to the LED
+// (unless a show is playing or serial frames are streaming, which own
+// the framebuffer)
+void renderZones() {
+  if ((showState == SHOW_PLAY) || adaActive())
+    return;
+  if (LED_PALETTE) {
+    // only the palettes are drawn, the LED are looked up on the way out
+    ledStrip.startFrame();
+    for (uint8_t z = 0; z < zoneCount; z++) {
+      lavaFillPalette(zone[z].render, zone[z].frame, zone_pal[z]);
+      lavaSendPalette(ledStrip, zone_pal[z], LED_ix + zone[z].first, zone[z].count);
+    }
+    ledStrip.endFrame(LED_COUNT);
+    return;
+  }
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    LavaSpan span = { LED_fb + zone[z].first };
+    zone[z].render(span, zone[z].frame, zone[z].count);
+  }
+  showCapture();
+  lavaShow(ledStrip, LED_fb, LED_COUNT);
 }
 
 void printWifiStatus() {
@@ -240,85 +323,14 @@ void printWifiStatus() {
   Serial.println(" dBm");
 }
 
-void sendHTMLpage(WiFiClient client) {
-  // send a standard http response header
-  client.println("HTTP/1.1 200 OK");
-  client.println("Content-Type: text/html");
-  client.println("Connection: close");
-  client.println();
-  // Display the HTML web page
-
-  client.println("<!DOCTYPE HTML>");
-  client.println("<html>");
-  client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-  client.println("<link rel=\"icon\" href=\"data:,\">");
-  
-  // CSS to style the on/off buttons 
-  client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-  client.println(".button { background-color: #195B6A; border: none; color: white; padding: 16px 40px;");
-  client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-  client.println(".button2 {background-color: #77878A;}</style></head>");
-    
-  // Web Page Heading
-  client.println("<body><h1>Night Light Web Server</h1>");
-    
-  // Display current DIM LEVEL and DISPLAY MODE
-  client.println("<p>MODE - " + colorPlan[curColorPlan].name + " - " + brightPlan[curBrightPlan].name + "</p>");
-
-  // display all of the MODE buttons
-  for(uint8_t i = 0; i <= lastColorPlan; i++) {
-    client.println("<p><a href=\"/m/" + String(i) + "\"><button class=\"button\">" + colorPlan[i].name + "</button></a></p>");
-  }
-
-  // display all of the BRIGHTNESS buttons
-  for(uint8_t i = 0; i <= lastBrightPlan; i++) {
-    client.println("<p><a href=\"/b/" + String(i) + "\"><button class=\"button\">" + brightPlan[i].name + "</button></a></p>");
-  }
-
-  // end of HTML webpage
-  client.println("</body></html>");
-}
-
-void processHTMLresponse(String line) {
-  // first, look for MODE selection
-  if (line.indexOf("GET /m/") >= 0) {
-    uint8_t index, value;
-    Serial.println("color plan change");
-    index = line.indexOf("GET /m/");
-    index += 7;
-    value = int(line.charAt(index))-int('0');
-    Serial.print("converted value:");
-    Serial.println(value);
-
-    if ((value >= 0) && (value <= lastColorPlan)) {
-      curColorPlan = value;
-      Serial.println(curColorPlan);
-    }
-  }
-  //next, look for BRIGHT selections
-  if (line.indexOf("GET /b/") >= 0) {
-    uint8_t index, value;
-    Serial.println("bright plan change");
-    index = line.indexOf("GET /b/");
-    index += 7;
-    value = int(line.charAt(index))-int('0');
-    Serial.print("converted value:");
-    Serial.println(value);
-
-    if ((value >= 0) && (value <= lastBrightPlan)) {
-      curBrightPlan = value;
-      Serial.println(curBrightPlan);
-    }
-  }
-}
-
 void setup() {
   uint8_t flush_WiFi_settings = FALSE;
 
   // Local intialization. Once its business is done, there is no need to keep it around
   WiFiManager wifiManager;
 
-  Serial.begin(115200);
+  // open the serial port (debug output and Adalight frames)
+  adaBegin();
   Serial.println("\r\nLED LAVA LAMP V3 - JAN 2023");
   Serial.printf("%u LEVEL DIMMING\r\n", lastBrightPlan+1);
   Serial.println("GAMMA CORRECTION (2.5, 256)");
@@ -326,8 +338,12 @@ void setup() {
   // initialize BUTTON input pin
   pinMode(BUTTON,INPUT);
 
+  // start connecting to the access point of the last boot; it runs
+  // while the button window below does
+  wlanBegin();
+
   // turn one LED GREEN after startup
-  colorOneLED(0,128,0,15); 
+  lavaFillOne(ledStrip, LED_COUNT, LED_COUNT / 2, 0,128,0,15); 
 
   // after startup allow a 2 second interval in which 
   // the WiFi configuration is flushed (by pressing BUTTON)
@@ -336,7 +352,7 @@ void setup() {
     if (button_st == LOW) {
       flush_WiFi_settings = TRUE;
       // turn one LED RED when flushing WiFi settings
-      colorOneLED(128,0,0,15); 
+      lavaFillOne(ledStrip, LED_COUNT, LED_COUNT / 2, 128,0,0,15); 
     } 
     delay(10);
   }
@@ -348,37 +364,76 @@ void setup() {
   }
 
   // turn one LED BLUE while trying to connect
-  colorOneLED(0,0,128,15); 
+  lavaFillOne(ledStrip, LED_COUNT, LED_COUNT / 2, 0,0,128,15); 
 
-  // WiFi manager fetches ssid and pass from eeprom and tries to connect
-  // if it does not connect it starts an access point with the name
-  // "NightLightAP" and goes into a blocking loop awaiting configuration
-  wifiManager.autoConnect("NightLightAP");
+  // finish that connect, else scan (or open the "NightLightAP" portal)
+  wlanConnect(wifiManager);
 
   // if you get here you have connected to the WiFi
   Serial.println("connected.");
 
-  // start the WiFi server
-  server.begin();
-
   // output the WiFi connection status
   printWifiStatus();
 
+  // join the multi-lamp sync group (if enabled)
+  syncBegin();
+
+  // start the web server (web UI from LittleFS, else the built-in page)
+  webBegin();
+
+  // load the LED calibration profile (LittleFS is mounted by webBegin())
+  calibBegin();
+
+  // read the MQTT broker settings; it connects with the first frame
+  mqttBegin();
+
+  // start watching the heap for leaks and fragmentation
+  heapBegin();
+
+  // start the first COLOR PLAN from its initial phase in every zone
+  zoneBegin();
+  selectBrightPlan(curBrightPlan);
+  selectColorPlan(curColorPlan);
+
   // clear the button debounce timer
   button_deb = 0;
+
+  // report how long it took to get here
+  wlanReady();
 }
 
 void loop()
 {
-  ColorTuple LED_phase;   // current LED phase
-  ColorTuple LED_color;   // current LED color
-  uint8_t LED_bright;     // current LED brightness
+  uint32_t frame;         // current display frame number
+  uint16_t frames;        // display frames since the last update
+
+  // show frames from the serial port as soon as they are complete
+  if (adaPoll()) {
+    lavaShow(ledStrip, LED_fb, LED_COUNT);
+    adaShown();
+  }
+
+  // receive any beacons from the sync master
+  syncPoll();
+
+  // watch the WiFi link; on a new address the services start over
+  if (wlanPoll()) {
+    syncBegin();
+    webRestart();
+    mqttRestart();
+  }
 
   // non-blocking delay for display update / button debounce cycle
-  curr_ms = millis();
-  if (curr_ms - prev_ms > CYCLE_MS) {
-    //Serial.println(curr_ms - prev_ms);
-    prev_ms = curr_ms;
+  // frames are counted on the lamp clock so synced lamps update together
+  curr_ms = lampMillis();
+  frame = curr_ms / CYCLE_MS;
+  // a sync clock slew may move the lamp clock back over a frame boundary:
+  // wait for it to come round again rather than drawing a frame twice
+  if (((int32_t)(frame - prev_frame) > 0) || ((int32_t)(frame - prev_frame) < -FRAME_SKIP_MAX)) {
+    frames = frame - prev_frame;
+    if ((uint32_t)(frame - prev_frame) > FRAME_SKIP_MAX)
+      frames = 1;
+    prev_frame = frame;
 
     //increment or clear button hold counter depending on state 
     button_st = digitalRead(BUTTON);
@@ -392,7 +447,7 @@ void loop()
     // once button is depressed for more than BUTTON_SH_CYC cycles, blank display
     // as long as it is held, or for BUTTON_LG_CYC cycles, whichever comes first.
     if (button_deb > BUTTON_SH_CYC) {
-      blankLED();    
+      lavaBlank(ledStrip, LED_COUNT);
       button_st = digitalRead(BUTTON);
       while ((button_st == LOW) && (button_deb <= BUTTON_LG_CYC)) {
         button_st = digitalRead(BUTTON);
@@ -404,10 +459,11 @@ void loop()
     // ...change the COLOR PLAN (advance by 1)
       if (button_deb <= BUTTON_LG_CYC) {
         button_deb = 0;
-        curColorPlan++;
         // ensure disp_mode is in-bounds
-        if (curColorPlan > lastColorPlan)
-          curColorPlan = 0;
+        if (curColorPlan >= lastColorPlan)
+          selectColorPlan(0);
+        else
+          selectColorPlan(curColorPlan + 1);
         // output the new COLOR PLAN value
         Serial.print("Color Plan:");
         Serial.println(curColorPlan);
@@ -417,13 +473,13 @@ void loop()
     // ...change the BRIGHT PLAN (advance by 1)
       else {
         button_deb = 0;      
-        curBrightPlan++;
         // ensure disp_mode is in-bounds
-        if (curBrightPlan > lastBrightPlan)
-          curBrightPlan = 0;
+        if (curBrightPlan >= lastBrightPlan)
+          selectBrightPlan(0);
+        else
+          selectBrightPlan(curBrightPlan + 1);
         // unblank LED to same color at new BRIGHTNESS level 
-        LED_bright = brightPlan[curBrightPlan].init & 0x31;
-        colorLED(LED_color.r,LED_color.g,LED_color.b,LED_bright);          
+        renderZones();
         // output the new BRIGHT INDEX value
         Serial.print("Bright Plan:");
         Serial.println(curBrightPlan);
@@ -437,97 +493,38 @@ void loop()
       } 
     } 
     
-    // ColorPlan effect type 0 -- FIXED COLOR
-    if (colorPlan[curColorPlan].efftyp == 0) {
-      LED_color = colorPlan[curColorPlan].init;
-    }
-    else if (colorPlan[curColorPlan].efftyp == 1) {
-    // ColorPlan effect type 1 -- GRADIENT COLOR
-    
-      // advance the phase accumulators for each color
-      LED_phase.r += colorPlan[curColorPlan].effect.r;
-      LED_phase.g += colorPlan[curColorPlan].effect.g;
-      LED_phase.b += colorPlan[curColorPlan].effect.b;
-
-      // Obtain color values from SINE table 
-      // table varies from 15 to 255 to avoid 'blackouts'
-      LED_color.r = sinetbl[(LED_phase.r >> 8) & 0x7f];
-      LED_color.g = sinetbl[(LED_phase.g >> 8) & 0x7f];
-      LED_color.b = sinetbl[(LED_phase.b >> 8) & 0x7f];
+    // advance the phase accumulators of every zone; the steps are 0 unless
+    // the zone runs ColorPlan effect type 1 (GRADIENT COLOR), 2 or 3 (HUE)
+    // or BrightPlan effect type 1 (FADE)
+    for (uint8_t z = 0; z < zoneCount; z++) {
+      lavaAdvance(zone[z].frame.phase, zone[z].color_inc, frames);
+      zone[z].frame.bright_phase += zone[z].bright_inc * frames;
     }
 
+    // let the sync master publish (or a follower correct) the phase
+    syncFrame(frame);
 
-    
-    if (disp_mode < 4) {
-
-      // Advance the phase accumulators
-      red_phase += red_ph_inc[disp_mode];
-      green_phase += green_ph_inc[disp_mode];
-      blue_phase += blue_ph_inc[disp_mode];
-
-      // Obtain color values from SINE table for modes 0...3
-      // table varies from 0 to 240, so add 15
-      red_val = sinetbl[(red_phase >> 8) & 0x7f] + 15;
-      green_val = sinetbl[(green_phase >> 8)& 0x7f] + 15;
-      blue_val = sinetbl[(blue_phase >> 8)& 0x7f] + 15;
-
-      if (GAMMA == TRUE) {
-        red_val = gamma_lut[red_val];
-        green_val = gamma_lut[green_val];
-        blue_val = gamma_lut[blue_val];
-      }
-    }
+    // update the LED colors through the pipelines chosen for each zone
+    renderZones();
 
-    // mode 4 is LAMP mode
-    else {
-      red_val = red_lamp_val;
-      green_val = green_lamp_val;
-      blue_val = blue_lamp_val;      
-    }
-
-    // use the selected BRIGHT value from the table
-    bright_val = bright_level[bright_idx] & 0x31;
-
-    // update the LED colors
-    colorLED(red_val,green_val,blue_val,bright_val);
-    //Serial.printf("\n\r%u %u %u %u",red_val,green_val,blue_val,bright_val);
+    // (re)connect to the MQTT broker while there is time until the next frame
+    mqttFrame();
   }
 
-  // Listen for incoming clients
-  WiFiClient client = server.accept();   
-  if (client) {                             // If a new client connects,
-    Serial.println("new client");
-    String currentLine = "";                // make a String to hold incoming data from the client
-    bool currentLineIsBlank = true;
-    while (client.connected()) {            // loop while the client's connected
-      if (client.available()) {             // if there's bytes to read from the client,
-        char c = client.read();             // read a byte, then
-        Serial.write(c);                    // print it out the serial monitor
-        // if we are at to the end of the line (received a newline
-        // character) and the line is blank, the http request has ended,
-        // so we should send a reply
-        if (c == '\n' && currentLineIsBlank) {
-          sendHTMLpage(client);
-          break;
-        }
-        if (c == '\n') {
-          // a newline char means process the response from web browser
-          processHTMLresponse(currentLine);
-          currentLineIsBlank = true;
-          currentLine = "";
-        } else if (c != '\r') {
-          // collect non-return characters into currentLine
-          currentLineIsBlank = false;
-          currentLine += c;
-        }
-      }
-    }
-    // give the web browser time to receive the data
-    delay(1);
-    // Close the connection
-    client.stop();
-    Serial.println("client disconnected.");
-    Serial.println("");
+  // apply MQTT commands and show them right away
+  if (mqttPoll()) {
+    renderZones();
+    mqttShown();
   }
+
+  // play the next frame of a show when it is due
+  if (showPoll())
+    lavaShow(ledStrip, LED_fb, LED_COUNT);
+
+  // service the browser connections
+  webPoll();
+
+  // sample the heap now and then
+  heapPoll();
 }
 
@@ -0,0 +1,506 @@
+/*
+  LED LAVA LAMP - MQTT control and state
+
+  see mqtt.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "LittleFS.h"
+#include "lamp.h"
+#include "sync.h"
+#include "mqtt.h"
+
+// connection states
+#define MQTT_OFF (0)          // no broker configured
+#define MQTT_WAIT (1)         // waiting for the next connection attempt
+#define MQTT_CONNACK (2)      // CONNECT sent, waiting for the answer
+#define MQTT_UP (3)
+
+// packet types (first byte, flags included where they are fixed)
+#define MQTT_CONNECT (0x10)
+#define MQTT_CONNACK_PKT (0x20)
+#define MQTT_PUBLISH (0x30)
+#define MQTT_SUBSCRIBE (0x82)
+#define MQTT_SUBACK (0x90)
+#define MQTT_PINGREQ (0xC0)
+#define MQTT_PINGRESP (0xD0)
+
+// Define the room for one packet sent (topic plus state JSON)
+#define MQTT_TX_MAX (256)
+
+// what the last state publish said
+struct MqttState {
+  uint8_t color;
+  uint8_t bright;
+  uint8_t sync;
+  bool fixed;               // fixed COLOR PLAN, 'rgb' is its color
+  ColorTuple rgb;
+};
+
+WiFiClient mqttClient;
+
+uint8_t mqtt_state = MQTT_OFF;
+char mqtt_broker[MQTT_NAME_LEN];
+char mqtt_user[MQTT_NAME_LEN];
+char mqtt_pass[MQTT_NAME_LEN];
+char mqtt_topic[MQTT_NAME_LEN];
+uint16_t mqtt_port = 1883;
+
+uint32_t mqtt_next_ms;        // next connection attempt
+uint32_t mqtt_backoff;        // wait after the next failed attempt
+uint32_t mqtt_connect_ms;     // millis() when CONNECT was sent
+uint32_t mqtt_sent_ms;        // millis() of the last packet sent
+uint32_t mqtt_heard_ms;       // millis() of the last packet received
+bool mqtt_ping_out;           // PINGREQ sent, no PINGRESP yet
+
+// receiving: fixed header, remaining length, then the body
+uint8_t mqtt_rx[MQTT_PACKET_MAX];
+uint8_t mqtt_rx_type;         // first byte, 0 = waiting for one
+uint8_t mqtt_rx_shift;        // remaining length bits read so far
+uint32_t mqtt_rx_need;        // body bytes
+uint32_t mqtt_rx_got;         // ... received so far
+bool mqtt_rx_sized;           // remaining length complete
+
+uint8_t mqtt_tx[MQTT_TX_MAX];
+
+MqttState mqtt_pub;           // state last published
+bool mqtt_pub_valid;          // false: publish even if unchanged
+uint32_t mqtt_pub_ms;         // millis() of the last state publish
+
+uint32_t mqtt_cmd_us;         // micros() when the last command was read
+uint32_t mqtt_cmd_lat;        // its command-to-LED time in us
+
+/* settings */
+
+void mqttLine(char *line) {
+  char *arg;
+
+  if ((line[0] == '#') || !line[0])
+    return;
+  line[strcspn(line, "\r")] = 0;
+  arg = strchr(line, ' ');
+  if (!arg)
+    return;
+  *arg++ = 0;
+  while (*arg == ' ')
+    arg++;
+
+  if (!strcmp(line, "broker"))
+    strncpy(mqtt_broker, arg, sizeof(mqtt_broker) - 1);
+  else if (!strcmp(line, "port"))
+    mqtt_port = atoi(arg);
+  else if (!strcmp(line, "user"))
+    strncpy(mqtt_user, arg, sizeof(mqtt_user) - 1);
+  else if (!strcmp(line, "pass"))
+    strncpy(mqtt_pass, arg, sizeof(mqtt_pass) - 1);
+  else if (!strcmp(line, "topic"))
+    strncpy(mqtt_topic, arg, sizeof(mqtt_topic) - 1);
+  else
+    Serial.printf("mqtt: bad line '%s'\r\n", line);
+}
+
+void mqttBegin() {
+  File f = LittleFS.open(MQTT_FILE, "r");
+  char line[MQTT_LINE_MAX];
+  uint8_t len = 0;
+  int c;
+
+  if (f) {
+    do {
+      c = f.read();
+      if ((c < 0) || (c == '\n')) {
+        line[len] = 0;
+        mqttLine(line);
+        len = 0;
+      }
+      else if (len < sizeof(line) - 1)
+        line[len++] = c;
+    } while (c >= 0);
+    f.close();
+  }
+
+  if (!mqtt_broker[0]) {
+    Serial.println("mqtt: off");
+    return;
+  }
+  if (!mqtt_topic[0])
+    snprintf(mqtt_topic, sizeof(mqtt_topic), "lavalamp/%06x", ESP.getChipId());
+  mqtt_state = MQTT_WAIT;
+  mqtt_next_ms = millis();
+  mqtt_backoff = MQTT_BACKOFF_MS;
+  Serial.printf("mqtt: broker %s:%u, topic %s\r\n", mqtt_broker, mqtt_port, mqtt_topic);
+}
+
+/* sending */
+
+// append a length-prefixed string
+size_t mqttString(size_t pos, const char *s, size_t len) {
+  if (pos + 2 + len > MQTT_TX_MAX)
+    return MQTT_TX_MAX + 1;
+  mqtt_tx[pos++] = len >> 8;
+  mqtt_tx[pos++] = len & 0xFF;
+  memcpy(mqtt_tx + pos, s, len);
+  return pos + len;
+}
+
+size_t mqttString(size_t pos, const char *s) {
+  return mqttString(pos, s, strlen(s));
+}
+
+// send the body built at mqtt_tx[5..end) as one packet of 'type'; the
+// fixed header goes in front of it, so it leaves in a single write
+bool mqttSend(uint8_t type, size_t end) {
+  size_t len = end - 5;
+  size_t start = 5;
+  uint8_t lenbytes[4];
+  uint8_t n = 0;
+
+  if (end > MQTT_TX_MAX)
+    return false;
+  // remaining length, 7 bits a byte, least significant first
+  do {
+    lenbytes[n] = len & 0x7F;
+    len >>= 7;
+    if (len)
+      lenbytes[n] |= 0x80;
+    n++;
+  } while (len);
+  start -= n + 1;
+  mqtt_tx[start] = type;
+  memcpy(mqtt_tx + start + 1, lenbytes, n);
+
+  if (mqttClient.availableForWrite() < (int)(end - start))
+    return false;
+  mqttClient.write(mqtt_tx + start, end - start);
+  mqtt_sent_ms = millis();
+  return true;
+}
+
+// publish 'payload' to TOPIC/'sub'
+bool mqttPublish(const char *sub, const char *payload, bool retain) {
+  char topic[MQTT_NAME_LEN + 16];
+  size_t pos, len = strlen(payload);
+
+  snprintf(topic, sizeof(topic), "%s/%s", mqtt_topic, sub);
+  pos = mqttString(5, topic);
+  if (pos + len > MQTT_TX_MAX)
+    return false;
+  memcpy(mqtt_tx + pos, payload, len);
+  return mqttSend(MQTT_PUBLISH | (retain ? 1 : 0), pos + len);
+}
+
+void mqttSnapshot(MqttState &s) {
+  s.color = curColorPlan;
+  s.bright = curBrightPlan;
+  s.sync = syncRole;
+  s.fixed = (curColor.efftyp == LAVA_COLOR_FIXED);
+  s.rgb = s.fixed ? curColor.init : ColorTuple{ 0, 0, 0 };
+}
+
+bool mqttPublishState(const MqttState &s) {
+  char json[128];
+  size_t pos;
+
+  pos = snprintf(json, sizeof(json), "{\"color\":%u,\"bright\":%u,\"sync\":%u,\"cmd_us\":%u", s.color, s.bright,
+                 s.sync, (unsigned)mqtt_cmd_lat);
+  if (s.fixed)
+    snprintf(json + pos, sizeof(json) - pos, ",\"rgb\":[%u,%u,%u]}", s.rgb.r, s.rgb.g, s.rgb.b);
+  else
+    snprintf(json + pos, sizeof(json) - pos, "}");
+  return mqttPublish("state", json, true);
+}
+
+/* connection */
+
+void mqttFail(const char *why) {
+  uint32_t wait = mqtt_backoff + random(mqtt_backoff / 4 + 1);
+
+  mqttClient.stop();
+  mqtt_state = MQTT_WAIT;
+  mqtt_next_ms = millis() + wait;
+  mqtt_backoff = min(mqtt_backoff * 2, (uint32_t)MQTT_BACKOFF_MAX_MS);
+  Serial.printf("mqtt: %s, retry in %u ms\r\n", why, (unsigned)wait);
+}
+
+void mqttConnect() {
+  char id[24];
+  char will[MQTT_NAME_LEN + 8];
+  IPAddress ip;
+  uint8_t flags = 0x02 | 0x04 | 0x20;   // clean session, will, will retained
+  size_t pos;
+
+  if (!ip.fromString(mqtt_broker) && (WiFi.hostByName(mqtt_broker, ip, MQTT_CONNECT_MS) != 1)) {
+    mqttFail("broker not found");
+    return;
+  }
+  mqttClient.setTimeout(MQTT_CONNECT_MS);
+  if (!mqttClient.connect(ip, mqtt_port)) {
+    mqttFail("no connection");
+    return;
+  }
+  mqttClient.setNoDelay(true);
+
+  snprintf(id, sizeof(id), "lavalamp-%06x", ESP.getChipId());
+  snprintf(will, sizeof(will), "%s/status", mqtt_topic);
+  if (mqtt_user[0])
+    flags |= 0x80;
+  if (mqtt_pass[0])
+    flags |= 0x40;
+
+  pos = mqttString(5, "MQTT");
+  mqtt_tx[pos++] = 4;                   // protocol level 3.1.1
+  mqtt_tx[pos++] = flags;
+  mqtt_tx[pos++] = 0;
+  mqtt_tx[pos++] = MQTT_KEEPALIVE_S;
+  pos = mqttString(pos, id);
+  pos = mqttString(pos, will);
+  pos = mqttString(pos, "offline");
+  if (mqtt_user[0])
+    pos = mqttString(pos, mqtt_user);
+  if (mqtt_pass[0])
+    pos = mqttString(pos, mqtt_pass);
+  if (!mqttSend(MQTT_CONNECT, pos)) {
+    mqttFail("CONNECT not sent");
+    return;
+  }
+
+  mqtt_state = MQTT_CONNACK;
+  mqtt_connect_ms = millis();
+  mqtt_rx_type = 0;
+}
+
+void mqttRestart() {
+  if (mqtt_state < MQTT_CONNACK)
+    return;
+  mqttClient.stop();
+  mqtt_state = MQTT_WAIT;
+  mqtt_next_ms = millis();
+  mqtt_backoff = MQTT_BACKOFF_MS;
+  Serial.println("mqtt: address changed, reconnecting");
+}
+
+// the broker took us: subscribe to the commands and say hello
+void mqttUp() {
+  char filter[MQTT_NAME_LEN + 8];
+  size_t pos;
+
+  snprintf(filter, sizeof(filter), "%s/set/+", mqtt_topic);
+  mqtt_tx[5] = 0;                       // packet id 1
+  mqtt_tx[6] = 1;
+  pos = mqttString(7, filter);
+  mqtt_tx[pos++] = 0;                   // QoS 0
+  if (!mqttSend(MQTT_SUBSCRIBE, pos)) {
+    // connected but deaf to commands: better to try again later
+    mqttFail("SUBSCRIBE not sent");
+    return;
+  }
+  mqttPublish("status", "online", true);
+
+  mqtt_state = MQTT_UP;
+  mqtt_backoff = MQTT_BACKOFF_MS;
+  mqtt_ping_out = false;
+  mqtt_pub_valid = false;
+  mqtt_pub_ms = millis() - MQTT_BATCH_MS;
+  Serial.printf("mqtt: connected after %u ms\r\n", (unsigned)(millis() - mqtt_connect_ms));
+}
+
+void mqttFrame() {
+  uint32_t now = millis();
+
+  if (mqtt_state == MQTT_WAIT) {
+    if ((int32_t)(now - mqtt_next_ms) >= 0)
+      mqttConnect();
+  }
+  else if (mqtt_state == MQTT_CONNACK) {
+    if (now - mqtt_connect_ms > MQTT_CONNACK_MS)
+      mqttFail("no CONNACK");
+  }
+  else if (mqtt_state == MQTT_UP) {
+    if (now - mqtt_heard_ms > MQTT_KEEPALIVE_S * 1500UL)
+      mqttFail("broker silent");
+    else if (!mqtt_ping_out && (now - mqtt_sent_ms >= MQTT_KEEPALIVE_S * 500UL)) {
+      mqtt_ping_out = mqttSend(MQTT_PINGREQ, 5);
+    }
+  }
+}
+
+/* receiving */
+
+// plan number, or the plan whose name 'v' is; -1 when there is none
+int16_t mqttFindPlan(const char *v, bool color) {
+  uint8_t last = color ? lastColorPlan : lastBrightPlan;
+
+  if ((v[0] >= '0') && (v[0] <= '9')) {
+    uint16_t n = atoi(v);
+    return (n <= last) ? n : -1;
+  }
+  for (uint8_t i = 0; i <= last; i++) {
+    ColorPlan c;
+    BrightPlan b;
+    if (color)
+      getColorPlan(i, c);
+    else
+      getBrightPlan(i, b);
+    if (!strcasecmp(v, color ? c.name : b.name))
+      return i;
+  }
+  return -1;
+}
+
+// "r,g,b" or "#rrggbb"
+bool mqttParseColor(const char *v, ColorTuple &c) {
+  unsigned r, g, b;
+
+  if ((v[0] == '#') && (strlen(v) == 7)) {
+    uint32_t rgb = strtoul(v + 1, NULL, 16);
+    c = ColorTuple{ (uint16_t)(rgb >> 16), (uint16_t)((rgb >> 8) & 0xFF), (uint16_t)(rgb & 0xFF) };
+    return true;
+  }
+  if ((sscanf(v, "%u,%u,%u", &r, &g, &b) == 3) && (r < 256) && (g < 256) && (b < 256)) {
+    c = ColorTuple{ (uint16_t)r, (uint16_t)g, (uint16_t)b };
+    return true;
+  }
+  return false;
+}
+
+// a PUBLISH from the broker; true when it changed the lamp
+bool mqttCommand(const uint8_t *body, size_t len) {
+  size_t tlen = (len >= 2) ? (body[0] << 8) | body[1] : 0;
+  size_t plen = strlen(mqtt_topic);
+  char topic[MQTT_NAME_LEN + 16];
+  char value[32];
+  ColorTuple rgb;
+  int16_t plan;
+
+  if ((len < 2) || (2 + tlen > len) || (tlen >= sizeof(topic)))
+    return false;
+  memcpy(topic, body + 2, tlen);
+  topic[tlen] = 0;
+  len -= 2 + tlen;
+  if ((len >= sizeof(value)) || strncmp(topic, mqtt_topic, plen) || strncmp(topic + plen, "/set/", 5))
+    return false;
+  memcpy(value, body + 2 + tlen, len);
+  value[len] = 0;
+
+  const char *cmd = topic + plen + 5;
+  Serial.printf("mqtt: %s %s\r\n", cmd, value);
+  if (!strcmp(cmd, "plan") && ((plan = mqttFindPlan(value, true)) >= 0))
+    selectColorPlan(plan);
+  else if (!strcmp(cmd, "bright") && ((plan = mqttFindPlan(value, false)) >= 0))
+    selectBrightPlan(plan);
+  else if (!strcmp(cmd, "color") && mqttParseColor(value, rgb))
+    selectColor(rgb);
+  else {
+    Serial.println("mqtt: bad command");
+    return false;
+  }
+  return true;
+}
+
+// one whole packet (its body cut to MQTT_PACKET_MAX); true when a
+// command changed the lamp
+bool mqttPacket(uint8_t type, const uint8_t *body, size_t len, bool cut) {
+  switch (type & 0xF0) {
+    case MQTT_CONNACK_PKT:
+      if (mqtt_state != MQTT_CONNACK)
+        break;
+      if ((len == 2) && (body[1] == 0))
+        mqttUp();
+      else
+        mqttFail("broker refused");
+      break;
+    case MQTT_PUBLISH:
+      // subscribed with QoS 0, so there is no packet id
+      if (!cut && !(type & 0x06))
+        return mqttCommand(body, len);
+      break;
+    case MQTT_SUBACK:
+      if ((len >= 3) && (body[2] & 0x80))
+        Serial.println("mqtt: subscription refused");
+      break;
+    case MQTT_PINGRESP:
+      mqtt_ping_out = false;
+      break;
+  }
+  return false;
+}
+
+bool mqttPoll() {
+  uint8_t buf[64];
+  bool changed = false;
+  int len;
+
+  if (mqtt_state < MQTT_CONNACK)
+    return false;
+  if (!mqttClient.connected()) {
+    mqttFail("connection lost");
+    return false;
+  }
+
+  while ((mqtt_state >= MQTT_CONNACK) && ((len = mqttClient.read(buf, min(mqttClient.available(), (int)sizeof(buf)))) > 0)) {
+    mqtt_heard_ms = millis();
+    for (int i = 0; i < len; i++) {
+      uint8_t c = buf[i];
+      if (!mqtt_rx_type) {
+        mqtt_rx_type = c ? c : 0xFF;    // 0 is reserved, keep it from meaning "none"
+        mqtt_rx_need = mqtt_rx_got = mqtt_rx_shift = 0;
+        mqtt_rx_sized = false;
+        continue;
+      }
+      if (!mqtt_rx_sized) {
+        mqtt_rx_need |= (uint32_t)(c & 0x7F) << mqtt_rx_shift;
+        mqtt_rx_shift += 7;
+        if (c & 0x80) {
+          if (mqtt_rx_shift < 28)
+            continue;
+          mqttFail("bad packet");
+          return changed;
+        }
+        mqtt_rx_sized = true;
+      }
+      else {
+        if (mqtt_rx_got < MQTT_PACKET_MAX)
+          mqtt_rx[mqtt_rx_got] = c;
+        mqtt_rx_got++;
+      }
+      if (mqtt_rx_got == mqtt_rx_need) {
+        uint8_t type = mqtt_rx_type;
+        mqtt_rx_type = 0;
+        if (!changed)
+          mqtt_cmd_us = micros();
+        changed |= mqttPacket(type, mqtt_rx, min(mqtt_rx_got, (uint32_t)MQTT_PACKET_MAX),
+                              mqtt_rx_got > MQTT_PACKET_MAX);
+      }
+    }
+  }
+
+  // publish the state when it changed, at most once per MQTT_BATCH_MS
+  if ((mqtt_state == MQTT_UP) && !changed && (millis() - mqtt_pub_ms >= MQTT_BATCH_MS)) {
+    MqttState s;
+    mqttSnapshot(s);
+    if (!mqtt_pub_valid || memcmp(&s, &mqtt_pub, sizeof(s))) {
+      if (mqttPublishState(s)) {
+        mqtt_pub = s;
+        mqtt_pub_valid = true;
+        mqtt_pub_ms = millis();
+      }
+    }
+  }
+  return changed;
+}
+
+void mqttShown() {
+  mqtt_cmd_lat = micros() - mqtt_cmd_us;
+  Serial.printf("mqtt: command shown after %u us\r\n", (unsigned)mqtt_cmd_lat);
+}
+
+const char *mqttStatus() {
+  switch (mqtt_state) {
+    case MQTT_WAIT: return "Waiting";
+    case MQTT_CONNACK: return "Connecting";
+    case MQTT_UP: return "Connected";
+  }
+  return "Off";
+}
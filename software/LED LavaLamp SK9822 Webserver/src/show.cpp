@@ -0,0 +1,522 @@
+/*
+  LED LAVA LAMP - recorded shows
+
+  see show.h for the file format
+
+ */
+
+#include <Arduino.h>
+#include "LittleFS.h"
+#include <LavaEngine.h>
+#include "lamp.h"
+#include "show.h"
+
+#define SHOW_MAGIC "LLSH"
+
+// run control bytes
+#define SHOW_RUN_SKIP (0x00)
+#define SHOW_RUN_REPEAT (0x40)
+#define SHOW_RUN_LITERAL (0x80)
+#define SHOW_RUN_MAX (64)
+
+uint8_t showState = SHOW_IDLE;
+
+File show_file;
+char show_name[SHOW_NAME_MAX + 1];
+uint8_t show_buf[SHOW_BUF];     // read-ahead (play) or write (record) buffer
+uint16_t show_pos;              // next byte to decode
+uint16_t show_len;              // bytes in show_buf
+bool show_eof;                  // nothing left to read ahead
+
+// playback
+uint16_t show_leds;             // LED count of the show
+uint32_t show_duration_ms;      // length of one pass
+uint32_t show_time_ms;          // show time of the pending record
+uint32_t show_due_us;           // micros() when the pending record is due
+uint8_t show_type;              // pending record: type and payload length,
+uint16_t show_rec_len;          // 0 type = end of the show
+bool show_dirty;                // LED_fb changed outside showPoll()
+
+// playback statistics
+uint32_t show_frames;           // frames decoded
+uint32_t show_read;             // bytes read from flash
+uint32_t show_late_max_us;      // latest frame
+uint32_t show_late_sum_us;
+uint32_t show_start_ms;         // millis() when playback started
+
+// recording
+LavaPixel show_prev[LED_FB_COUNT];  // last stored frame
+uint32_t show_records;          // records stored
+uint32_t show_rec_ms;           // millis() of the last stored frame
+bool show_fail;                 // a write came up short
+
+/* helpers */
+
+static inline void showPut16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static inline void showPut32(uint8_t *p, uint32_t v) {
+  showPut16(p, v);
+  showPut16(p + 2, v >> 16);
+}
+
+static inline uint16_t showGet16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t showGet32(const uint8_t *p) {
+  return showGet16(p) | ((uint32_t)showGet16(p + 2) << 16);
+}
+
+static inline bool showSame(const LavaPixel &a, const LavaPixel &b) {
+  return (a.r == b.r) && (a.g == b.g) && (a.b == b.b) && (a.bright == b.bright);
+}
+
+// letters, digits, '-' and '_' only, so a name can't leave SHOW_DIR
+bool showValid(const char *name, size_t len) {
+  return len && (len <= SHOW_NAME_MAX) &&
+         (strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") >= len);
+}
+
+bool showName(const char *name, char *path, size_t size) {
+  if (!showValid(name, strlen(name)))
+    return false;
+  snprintf(path, size, SHOW_DIR "/%s.lls", name);
+  return true;
+}
+
+/* reading */
+
+// move the unread bytes to the front and top the buffer up from flash
+void showFill() {
+  int room, n;
+
+  if (show_eof)
+    return;
+  if (show_pos) {
+    memmove(show_buf, show_buf + show_pos, show_len - show_pos);
+    show_len -= show_pos;
+    show_pos = 0;
+  }
+  room = SHOW_BUF - show_len;
+  n = show_file.read(show_buf + show_len, room);
+  if (n > 0) {
+    show_len += n;
+    show_read += n;
+  }
+  if (n < room)
+    show_eof = true;
+}
+
+// continue reading at file offset 'pos'
+void showSeek(uint32_t pos) {
+  show_file.seek(pos);
+  show_pos = show_len = 0;
+  show_eof = false;
+}
+
+bool showGet(void *p, uint16_t n) {
+  uint8_t *b = (uint8_t *)p;
+
+  while (n--) {
+    if ((show_pos == show_len) && (showFill(), show_pos == show_len))
+      return false;
+    *b++ = show_buf[show_pos++];
+  }
+  return true;
+}
+
+// read the next record header; false at the end of the show
+bool showNext() {
+  uint8_t h[SHOW_REC_LEN];
+
+  if (!showGet(h, sizeof(h))) {
+    show_type = 0;
+    return false;
+  }
+  show_type = h[0];
+  show_rec_len = showGet16(h + 1);
+  show_time_ms += showGet16(h + 3);
+  return true;
+}
+
+// apply the pending record's runs to LED_fb
+bool showDecode() {
+  uint16_t len = show_rec_len;
+  uint16_t led = 0;
+  uint8_t c, n;
+  LavaPixel p;
+
+  if ((show_type != 'K') && (show_type != 'D'))
+    return false;
+  while (len) {
+    if (!showGet(&c, 1))
+      return false;
+    len--;
+    n = (c & (SHOW_RUN_MAX - 1)) + 1;
+    switch (c & 0xc0) {
+      case SHOW_RUN_SKIP:
+        led += n;
+        break;
+      case SHOW_RUN_REPEAT:
+        if ((len < 4) || !showGet(&p, 4))
+          return false;
+        len -= 4;
+        for (; n; n--, led++) {
+          if (led < LED_FB_COUNT)
+            LED_fb[led] = p;
+        }
+        break;
+      case SHOW_RUN_LITERAL:
+        if (len < 4 * n)
+          return false;
+        len -= 4 * n;
+        for (; n; n--, led++) {
+          if (!showGet(&p, 4))
+            return false;
+          if (led < LED_FB_COUNT)
+            LED_fb[led] = p;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+// jump to the last keyframe before 'at_ms', reading only the record
+// headers, then decode up to 'at_ms' without showing anything
+bool showStartAt(uint32_t at_ms) {
+  uint32_t pos = SHOW_HEAD_LEN, key_pos = SHOW_HEAD_LEN;
+  uint32_t t = 0, key_base = 0;
+  uint8_t h[SHOW_REC_LEN];
+
+  show_file.seek(pos);
+  while (show_file.read(h, sizeof(h)) == sizeof(h)) {
+    show_read += sizeof(h);
+    if (t + showGet16(h + 3) >= at_ms)
+      break;
+    if (h[0] == 'K') {
+      key_pos = pos;
+      key_base = t;
+    }
+    t += showGet16(h + 3);
+    pos += SHOW_REC_LEN + showGet16(h + 1);
+    show_file.seek(pos);
+  }
+
+  showSeek(key_pos);
+  show_time_ms = key_base;
+  if (!showNext())
+    return false;
+  while (show_time_ms < at_ms) {
+    if (!showDecode())
+      return false;
+    if (!showNext()) {
+      show_time_ms = show_duration_ms;
+      break;
+    }
+  }
+  return true;
+}
+
+/* playback */
+
+bool showPlay(const char *name, uint32_t at_ms) {
+  char path[sizeof(SHOW_DIR) + SHOW_NAME_MAX + 6];
+  uint8_t h[SHOW_HEAD_LEN];
+
+  showStop();
+  // the zones draw through palettes, no framebuffer to play into
+  if (LED_PALETTE || !showName(name, path, sizeof(path)))
+    return false;
+  show_file = LittleFS.open(path, "r");
+  if (!show_file)
+    return false;
+  if ((show_file.read(h, sizeof(h)) != sizeof(h)) || memcmp(h, SHOW_MAGIC, 4) || (h[4] != SHOW_VERSION)) {
+    Serial.printf("show: %s is not a show\r\n", path);
+    show_file.close();
+    return false;
+  }
+  show_leds = showGet16(h + 6);
+  show_duration_ms = max(showGet32(h + 12), (uint32_t)1);
+  strcpy(show_name, name);
+
+  show_frames = show_late_max_us = show_late_sum_us = 0;
+  show_read = sizeof(h);
+  show_start_ms = millis();
+  memset(LED_fb, 0, sizeof(LED_fb));
+  at_ms %= show_duration_ms;
+  if (!showStartAt(at_ms)) {
+    Serial.printf("show: %s is damaged\r\n", path);
+    show_file.close();
+    return false;
+  }
+  // the pending record is due show_time_ms - at_ms from now, and what
+  // was decoded up to at_ms is shown right away
+  show_due_us = micros() + (show_time_ms - at_ms) * 1000;
+  show_dirty = at_ms;
+  showState = SHOW_PLAY;
+  Serial.printf("show: playing %s, %u LED, %u.%03u s\r\n", name, show_leds,
+                show_duration_ms / 1000, show_duration_ms % 1000);
+  return true;
+}
+
+bool showPoll() {
+  bool shown = show_dirty;
+  int32_t late;
+
+  if (showState != SHOW_PLAY)
+    return false;
+  show_dirty = false;
+  while ((late = (int32_t)(micros() - show_due_us)) >= 0) {
+    uint32_t was = show_time_ms;
+
+    if (!show_type) {
+      // end of the show: start over once its duration is up
+      was = 0;
+      showSeek(SHOW_HEAD_LEN);
+      show_time_ms = 0;
+      if (!showNext()) {
+        showStop();
+        return false;
+      }
+    }
+    else {
+      if (!showDecode()) {
+        Serial.printf("show: %s is damaged\r\n", show_name);
+        showStop();
+        return false;
+      }
+      shown = true;
+      show_frames++;
+      late = micros() - show_due_us;
+      show_late_sum_us += late;
+      show_late_max_us = max(show_late_max_us, (uint32_t)late);
+      if (!showNext())
+        show_time_ms = max(show_duration_ms, was);
+    }
+    show_due_us += (show_time_ms - was) * 1000;
+  }
+  // read ahead while waiting for the next frame
+  if (!shown && (show_len - show_pos < SHOW_BUF / 2))
+    showFill();
+  return shown;
+}
+
+/* recording */
+
+// store 'n' bytes through the write buffer
+void showPut(const void *p, uint16_t n) {
+  const uint8_t *b = (const uint8_t *)p;
+
+  while (n) {
+    uint16_t room = min((uint16_t)(SHOW_BUF - show_len), n);
+    memcpy(show_buf + show_len, b, room);
+    show_len += room;
+    b += room;
+    n -= room;
+    if (show_len == SHOW_BUF) {
+      show_fail |= (show_file.write(show_buf, show_len) != show_len);
+      show_len = 0;
+    }
+  }
+}
+
+// encode LED_fb (against show_prev unless 'key') as runs; with 'put'
+// false only count the bytes, so the record length can go first
+uint16_t showEncode(bool key, bool put) {
+  uint16_t len = 0, i = 0, n;
+  uint8_t c;
+
+  while (i < LED_FB_COUNT) {
+    if (!key && showSame(LED_fb[i], show_prev[i])) {
+      for (n = 1; (i + n < LED_FB_COUNT) && (n < SHOW_RUN_MAX) && showSame(LED_fb[i + n], show_prev[i + n]); n++)
+        ;
+      c = SHOW_RUN_SKIP | (n - 1);
+      len += 1;
+      if (put)
+        showPut(&c, 1);
+    }
+    else {
+      for (n = 1; (i + n < LED_FB_COUNT) && (n < SHOW_RUN_MAX) && showSame(LED_fb[i + n], LED_fb[i]); n++)
+        ;
+      if (n > 1) {
+        c = SHOW_RUN_REPEAT | (n - 1);
+        len += 5;
+        if (put) {
+          showPut(&c, 1);
+          showPut(&LED_fb[i], 4);
+        }
+      }
+      else {
+        // literal pixels up to where a skip or a repeat pays off
+        for (n = 1; (i + n < LED_FB_COUNT) && (n < SHOW_RUN_MAX); n++) {
+          uint16_t j = i + n;
+          if ((!key && showSame(LED_fb[j], show_prev[j])) || ((j + 1 < LED_FB_COUNT) && showSame(LED_fb[j], LED_fb[j + 1])))
+            break;
+        }
+        c = SHOW_RUN_LITERAL | (n - 1);
+        len += 1 + 4 * n;
+        if (put) {
+          showPut(&c, 1);
+          showPut(&LED_fb[i], 4 * n);
+        }
+      }
+    }
+    i += n;
+  }
+  return len;
+}
+
+void showPutRecord(uint8_t type, uint16_t len, uint16_t delay) {
+  uint8_t h[SHOW_REC_LEN];
+
+  h[0] = type;
+  showPut16(h + 1, len);
+  showPut16(h + 3, delay);
+  showPut(h, sizeof(h));
+}
+
+void showPutHead(uint32_t records, uint32_t duration_ms) {
+  uint8_t h[SHOW_HEAD_LEN];
+
+  memcpy(h, SHOW_MAGIC, 4);
+  h[4] = SHOW_VERSION;
+  h[5] = SHOW_KEY_RECORDS;
+  showPut16(h + 6, LED_COUNT);
+  showPut32(h + 8, records);
+  showPut32(h + 12, duration_ms);
+  show_fail |= (show_file.write(h, sizeof(h)) != sizeof(h));
+}
+
+bool showRecord(const char *name) {
+  char path[sizeof(SHOW_DIR) + SHOW_NAME_MAX + 6];
+
+  showStop();
+  // ... nor to record from
+  if (LED_PALETTE || !showName(name, path, sizeof(path)))
+    return false;
+  show_file = LittleFS.open(path, "w");
+  if (!show_file)
+    return false;
+  strcpy(show_name, name);
+  show_len = 0;
+  show_records = 0;
+  show_fail = false;
+  showPutHead(0, 0);
+  showState = SHOW_RECORD;
+  Serial.printf("show: recording %s\r\n", name);
+  return true;
+}
+
+void showCapture() {
+  uint32_t now = millis();
+  uint32_t delay;
+  bool key;
+
+  if (showState != SHOW_RECORD)
+    return;
+  if (show_records && (now - show_start_ms >= SHOW_RECORD_MAX_MS)) {
+    showStop();
+    return;
+  }
+  // an unchanged frame only adds to the next delay
+  if (show_records && !memcmp(LED_fb, show_prev, sizeof(show_prev)))
+    return;
+
+  if (!show_records)
+    show_start_ms = show_rec_ms = now;
+  delay = now - show_rec_ms;
+  for (; delay > 0xffff; delay -= 0xffff, show_records++)
+    showPutRecord('D', 0, 0xffff);
+  key = (show_records % SHOW_KEY_RECORDS == 0);
+  showPutRecord(key ? 'K' : 'D', showEncode(key, false), delay);
+  showEncode(key, true);
+  memcpy(show_prev, LED_fb, sizeof(show_prev));
+  show_rec_ms = now;
+  show_records++;
+  if (show_fail) {
+    Serial.println("show: file system full");
+    showStop();
+  }
+}
+
+/* both */
+
+void showStop() {
+  if (showState == SHOW_RECORD) {
+    uint32_t duration = millis() - show_start_ms;
+    uint32_t size;
+
+    if (show_len)
+      show_fail |= (show_file.write(show_buf, show_len) != show_len);
+    size = show_file.position();
+    show_file.seek(0);
+    showPutHead(show_records, show_records ? duration : 0);
+    Serial.printf("show: recorded %s, %u records, %u.%03u s, %u bytes (%u raw)%s\r\n", show_name,
+                  show_records, duration / 1000, duration % 1000, size,
+                  (unsigned)(duration / CYCLE_MS * sizeof(LED_fb)), show_fail ? ", TRUNCATED" : "");
+  }
+  if (showState == SHOW_PLAY) {
+    uint32_t ms = max(millis() - show_start_ms, (uint32_t)1);
+    Serial.printf("show: played %s, %u frames in %u.%03u s, %u bytes read (%u B/s), late avg %u max %u us\r\n",
+                  show_name, show_frames, ms / 1000, ms % 1000, show_read, (unsigned)((uint64_t)show_read * 1000 / ms),
+                  show_frames ? show_late_sum_us / show_frames : 0, show_late_max_us);
+  }
+  if (showState != SHOW_IDLE)
+    show_file.close();
+  showState = SHOW_IDLE;
+}
+
+void showSnapshot(ShowSnapshot &s) {
+  uint32_t ms = max(millis() - show_start_ms, (uint32_t)1);
+  Dir dir = LittleFS.openDir(SHOW_DIR);
+
+  s.state = showState;
+  strcpy(s.name, showState ? show_name : "");
+  s.frames = show_frames;
+  s.read = show_read;
+  s.read_per_sec = (ms < 1000) ? 0 : (uint32_t)((uint64_t)show_read * 1000 / ms);
+  s.late_avg_us = show_frames ? show_late_sum_us / show_frames : 0;
+  s.late_max_us = show_late_max_us;
+  s.records = show_records;
+  s.shows = 0;
+  s.more = 0;
+  while (dir.next()) {
+    String file = dir.fileName();
+    int len = (int)file.length() - 4;
+
+    if ((len <= 0) || strcmp(file.c_str() + len, ".lls") || !showValid(file.c_str(), len))
+      continue;
+    if (s.shows == SHOW_LIST_MAX) {
+      s.more++;
+      continue;
+    }
+    memcpy(s.show[s.shows].name, file.c_str(), len);
+    s.show[s.shows].name[len] = 0;
+    s.show[s.shows].bytes = dir.fileSize();
+    s.shows++;
+  }
+}
+
+void showJson(Print &out, const ShowSnapshot &s) {
+  static const char *const states[] = { "idle", "play", "record" };
+
+  out.printf("{\"state\":\"%s\",\"name\":\"%s\"", states[s.state], s.name);
+  if (s.state == SHOW_PLAY)
+    out.printf(",\"frames\":%u,\"read\":%u,\"readPerSec\":%u,\"lateAvgUs\":%u,\"lateMaxUs\":%u",
+               s.frames, s.read, s.read_per_sec, s.late_avg_us, s.late_max_us);
+  if (s.state == SHOW_RECORD)
+    out.printf(",\"records\":%u", s.records);
+  out.print(",\"shows\":[");
+  for (uint8_t i = 0; i < s.shows; i++)
+    out.printf("%s{\"name\":\"%s\",\"bytes\":%u}", i ? "," : "", s.show[i].name, s.show[i].bytes);
+  out.print("]");
+  if (s.more)
+    out.printf(",\"more\":%u", s.more);
+  out.print("}");
+}
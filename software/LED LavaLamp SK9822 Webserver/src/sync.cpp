@@ -0,0 +1,258 @@
+/*
+  LED LAVA LAMP - multi-lamp phase synchronization
+
+  see sync.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include "lamp.h"
+#include "sync.h"
+
+#define SYNC_MAGIC (0x4C4C5359)   // "LLSY"
+#define SYNC_VERSION (1)
+
+// beacon sent by the master, all fields little-endian
+struct __attribute__((packed)) SyncBeacon {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t colorPlan;        // master COLOR PLAN number
+  uint8_t brightPlan;       // master BRIGHT PLAN number
+  uint8_t reserved;
+  uint32_t node;            // master chip id
+  uint32_t seq;             // beacon sequence number
+  uint32_t lamp_ms;         // master lamp clock when sent
+  uint32_t frame;           // master frame number the phases belong to
+  uint16_t phase_r;         // master phase accumulators after 'frame'
+  uint16_t phase_g;
+  uint16_t phase_b;
+};
+
+WiFiUDP syncUdp;
+uint8_t syncRole = SYNC_ROLE_DEFAULT;
+
+bool sync_started = false;    // UDP socket is open
+bool sync_locked = false;     // follower has a valid master
+uint32_t sync_node;           // our own chip id
+uint32_t sync_seq;            // master: next beacon sequence number
+uint32_t sync_beacon_at;      // master: frame the next beacon is due
+
+SyncBeacon sync_last;         // follower: last accepted beacon
+uint32_t sync_rx_ms;          // follower: millis() when sync_last arrived
+
+int32_t sync_offset;          // applied lamp clock offset (lamp - millis)
+int32_t sync_target;          // estimated master clock offset
+int32_t sync_win_max;         // largest offset sample in this window
+uint8_t sync_win_cnt;         // samples in this window
+
+uint32_t lampMillis() {
+  return millis() + sync_offset;
+}
+
+void syncBegin() {
+  sync_node = ESP.getChipId();
+  if (sync_started) {
+    syncUdp.stop();
+    sync_started = false;
+  }
+  syncSetRole(syncRole);
+}
+
+void syncSetRole(uint8_t role) {
+  if (role > SYNC_MASTER)
+    return;
+  syncRole = role;
+  sync_locked = false;
+  sync_win_cnt = 0;
+  sync_beacon_at = lampMillis() / CYCLE_MS;
+
+  if ((syncRole != SYNC_OFF) && !sync_started) {
+    syncUdp.beginMulticast(WiFi.localIP(), SYNC_GROUP, SYNC_PORT);
+    sync_started = true;
+  }
+  else if ((syncRole == SYNC_OFF) && sync_started) {
+    syncUdp.stop();
+    sync_started = false;
+  }
+  Serial.print("Sync role:");
+  Serial.println(syncRole);
+}
+
+// fold one offset sample into the estimate. Network latency only ever
+// makes a sample smaller than the true offset, so the largest sample of
+// each window is the best estimate.
+void syncOffsetSample(int32_t sample) {
+  if ((sync_win_cnt == 0) || (sample > sync_win_max))
+    sync_win_max = sample;
+  if (++sync_win_cnt >= SYNC_OFFSET_WINDOW) {
+    sync_target = sync_win_max;
+    sync_win_cnt = 0;
+  }
+}
+
+void syncReceive(const SyncBeacon &b) {
+  uint32_t now = millis();
+
+  if ((b.magic != SYNC_MAGIC) || (b.version != SYNC_VERSION) || (b.node == sync_node))
+    return;
+  if ((b.colorPlan > lastColorPlan) || (b.brightPlan > lastBrightPlan))
+    return;
+
+  // two masters: the one with the lower chip id keeps the job
+  if (syncRole == SYNC_MASTER) {
+    if (b.node < sync_node) {
+      Serial.println("sync: yielding to lower master");
+      syncSetRole(SYNC_FOLLOWER);
+    }
+    else
+      return;
+  }
+
+  if (sync_locked) {
+    // ignore a competing master while ours is alive, and stale beacons
+    if ((b.node != sync_last.node) && (now - sync_rx_ms < SYNC_TIMEOUT_MS) && (b.node > sync_last.node))
+      return;
+    if ((b.node == sync_last.node) && ((int32_t)(b.seq - sync_last.seq) <= 0))
+      return;
+  }
+
+  if (!sync_locked || (b.node != sync_last.node)) {
+    // new master: step the lamp clock once, then track it by slewing
+    sync_offset = (int32_t)(b.lamp_ms - now);
+    sync_target = sync_offset;
+    sync_win_cnt = 0;
+    Serial.printf("sync: locked to %08x\r\n", b.node);
+  }
+  else
+    syncOffsetSample((int32_t)(b.lamp_ms - now));
+
+  sync_last = b;
+  sync_rx_ms = now;
+  sync_locked = true;
+}
+
+void syncPoll() {
+  SyncBeacon b;
+
+  if (!sync_started)
+    return;
+  while (syncUdp.parsePacket() > 0) {
+    if (syncUdp.read((uint8_t *)&b, sizeof(b)) == sizeof(b))
+      syncReceive(b);
+  }
+  if (sync_locked && (millis() - sync_rx_ms > SYNC_TIMEOUT_MS)) {
+    // master went quiet, free-run on the last clock offset
+    Serial.println("sync: master lost");
+    sync_locked = false;
+  }
+}
+
+// the zone whose phase is sent: the first one showing the lamp plan
+Zone &syncZone() {
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    if (zone[z].color_plan == curColorPlan)
+      return zone[z];
+  }
+  return zone[0];
+}
+
+void syncSendBeacon(uint32_t frame) {
+  const LavaFrame &f = syncZone().frame;
+  SyncBeacon b;
+
+  b.magic = SYNC_MAGIC;
+  b.version = SYNC_VERSION;
+  b.colorPlan = curColorPlan;
+  b.brightPlan = curBrightPlan;
+  b.reserved = 0;
+  b.node = sync_node;
+  b.seq = sync_seq++;
+  b.lamp_ms = lampMillis();
+  b.frame = frame;
+  b.phase_r = f.phase.r;
+  b.phase_g = f.phase.g;
+  b.phase_b = f.phase.b;
+
+  syncUdp.beginPacketMulticast(SYNC_GROUP, SYNC_PORT, WiFi.localIP());
+  syncUdp.write((const uint8_t *)&b, sizeof(b));
+  syncUdp.endPacket();
+}
+
+// move one phase accumulator toward the expected master phase,
+// proportionally to the error but never by more than SYNC_SLEW_MAX
+uint16_t syncSlew(uint16_t phase, uint16_t expected) {
+  int16_t err = (int16_t)(expected - phase);
+  int16_t step = err / SYNC_SLEW_DIV;
+
+  if (step == 0)
+    step = err;
+  if (step > SYNC_SLEW_MAX)
+    step = SYNC_SLEW_MAX;
+  if (step < -SYNC_SLEW_MAX)
+    step = -SYNC_SLEW_MAX;
+  return phase + step;
+}
+
+void syncFrame(uint32_t frame) {
+  ColorTuple expected;
+  uint16_t frames;
+  int32_t diff;
+  bool changed;
+
+  if (syncRole == SYNC_MASTER) {
+    // frames may be skipped, so send on crossing a beacon boundary
+    if ((int32_t)(frame - sync_beacon_at) >= 0) {
+      syncSendBeacon(frame);
+      sync_beacon_at = frame - frame % SYNC_BEACON_CYC + SYNC_BEACON_CYC;
+    }
+    return;
+  }
+  if ((syncRole != SYNC_FOLLOWER) || !sync_locked)
+    return;
+
+  // slew the lamp clock so our frames line up with the master frames
+  diff = sync_target - sync_offset;
+  if (diff > SYNC_CLOCK_SLEW_MS)
+    diff = SYNC_CLOCK_SLEW_MS;
+  if (diff < -SYNC_CLOCK_SLEW_MS)
+    diff = -SYNC_CLOCK_SLEW_MS;
+  sync_offset += diff;
+
+  // a plan change is a visible change anyway, so jump straight to it
+  changed = (sync_last.colorPlan != curColorPlan) || (sync_last.brightPlan != curBrightPlan);
+  if (changed) {
+    selectColorPlan(sync_last.colorPlan);
+    selectBrightPlan(sync_last.brightPlan);
+  }
+
+  // extrapolate the master phase to this frame
+  frames = frame - sync_last.frame;
+  expected.r = sync_last.phase_r + frames * curColor.effect.r;
+  expected.g = sync_last.phase_g + frames * curColor.effect.g;
+  expected.b = sync_last.phase_b + frames * curColor.effect.b;
+
+  // zones given their own plan (/z/Z/m/N) are left alone
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    ColorTuple &phase = zone[z].frame.phase;
+
+    if (zone[z].color_plan != curColorPlan)
+      continue;
+    if (changed) {
+      phase = expected;
+      continue;
+    }
+    phase.r = syncSlew(phase.r, expected.r);
+    phase.g = syncSlew(phase.g, expected.g);
+    phase.b = syncSlew(phase.b, expected.b);
+  }
+}
+
+const char *syncStatus() {
+  if (syncRole == SYNC_MASTER)
+    return "Master";
+  if (syncRole == SYNC_FOLLOWER)
+    return sync_locked ? "Follower (locked)" : "Follower (searching)";
+  return "Off";
+}
@@ -0,0 +1,544 @@
+/*
+  LED LAVA LAMP - web server
+
+  see web.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "LittleFS.h"
+#include "lamp.h"
+#include "sync.h"
+#include "heap.h"
+#include "show.h"
+#include "http.h"
+#include "mqtt.h"
+#include "wlan.h"
+#include "web.h"
+
+struct WebAsset {
+  const char *path;         // request path
+  const char *file;         // gzip file on LittleFS
+  const char *type;         // Content-Type
+  uint32_t size;            // stored (compressed) size, 0 = missing
+  char etag[20];            // "xxxxxxxx-size", quoted
+};
+
+WebAsset webAsset[] = {
+  { "/",           WEB_ROOT "/index.html.gz", "text/html",              0, "" },
+  { "/index.html", WEB_ROOT "/index.html.gz", "text/html",              0, "" },
+  { "/style.css",  WEB_ROOT "/style.css.gz",  "text/css",               0, "" },
+  { "/app.js",     WEB_ROOT "/app.js.gz",     "application/javascript", 0, "" },
+};
+#define WEB_ASSETS (sizeof(webAsset) / sizeof(webAsset[0]))
+
+// one browser connection
+struct WebClient {
+  WiFiClient client;
+  bool open;                // connection accepted and not yet closed
+  bool close;               // close it after the current response
+  uint8_t requests;         // requests answered on this connection
+  uint32_t idle_ms;         // millis() of the last activity
+  HttpRequest req;          // request being parsed
+};
+
+WiFiServer webServer(WEB_PORT);
+WebClient webClient[WEB_CLIENTS];
+
+bool web_ready = false;       // the page (and so the web UI) is installed
+uint8_t web_tx[WEB_MSS];      // segment buffer, one response at a time
+
+/* WebWriter */
+
+size_t WebWriter::write(const uint8_t *buf, size_t len) {
+  size_t part;
+
+  total += len;
+  if (counting)
+    return len;
+  for (size_t left = len; left; left -= part) {
+    part = min(left, (size_t)(WEB_MSS - used));
+    memcpy(web_tx + used, buf, part);
+    buf += part;
+    used += part;
+    if (used == WEB_MSS)
+      flush();
+  }
+  return len;
+}
+
+void WebWriter::flush() {
+  if (used && !counting)
+    client.write(web_tx, used);
+  used = 0;
+}
+
+size_t WebWriter::send(Stream &file) {
+  size_t sent = 0;
+  int len;
+
+  while ((len = file.read(web_tx + used, WEB_MSS - used)) > 0) {
+    used += len;
+    sent += len;
+    if (used == WEB_MSS)
+      flush();
+  }
+  total += sent;
+  return sent;
+}
+
+/* assets */
+
+// FNV-1a hash of a whole file, the body of its ETag
+uint32_t webHashFile(File &f) {
+  uint8_t buf[WEB_CHUNK];
+  uint32_t hash = 2166136261u;
+  int len;
+
+  while ((len = f.read(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < len; i++) {
+      hash ^= buf[i];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+void webBegin() {
+  webServer.begin();
+  webServer.setNoDelay(true);
+
+  if (!LittleFS.begin()) {
+    Serial.println("web: no file system");
+    return;
+  }
+
+  for (uint8_t i = 0; i < WEB_ASSETS; i++) {
+    WebAsset &a = webAsset[i];
+    File f = LittleFS.open(a.file, "r");
+    if (!f)
+      continue;
+    a.size = f.size();
+    snprintf(a.etag, sizeof(a.etag), "\"%08x-%x\"", (unsigned)webHashFile(f), (unsigned)a.size);
+    f.close();
+  }
+
+  web_ready = (webAsset[0].size != 0);
+  Serial.println(web_ready ? "web: assets installed" : "web: no assets, using built-in page");
+}
+
+/* responses */
+
+// status line; the caller adds its own headers, then webEndHead()
+void webStatus(WebWriter &w, const char *status) {
+  w.print("HTTP/1.1 ");
+  w.print(status);
+  w.print("\r\n");
+}
+
+// Content-Length, connection headers and the blank line
+void webEndHead(WebWriter &w, const WebClient &c, size_t length) {
+  w.printf("Content-Length: %u\r\n", (unsigned)length);
+  if (c.close)
+    w.print("Connection: close\r\n\r\n");
+  else
+    w.printf("Connection: keep-alive\r\nKeep-Alive: timeout=%u\r\n\r\n", WEB_IDLE_MS / 1000);
+}
+
+void webSendStatus(WebWriter &w, const WebClient &c, const char *status) {
+  webStatus(w, status);
+  webEndHead(w, c, 0);
+}
+
+// does the If-None-Match 'list' name 'etag'? Entries are compared
+// weakly (W/ ignored), '*' matches anything
+bool webEtagMatch(const char *list, const char *etag) {
+  size_t len = strlen(etag);
+
+  while (*list) {
+    while ((*list == ' ') || (*list == '\t') || (*list == ','))
+      list++;
+    if (*list == '*')
+      return true;
+    if (!strncmp(list, "W/", 2))
+      list += 2;
+    if (!strncmp(list, etag, len) && strchr(" \t,", list[len]))
+      return true;
+    while (*list && (*list != ','))
+      list++;
+  }
+  return false;
+}
+
+void webSendAsset(WebWriter &w, const WebClient &c, const WebAsset &a) {
+  // the browser already has these bytes
+  if (webEtagMatch(c.req.etag, a.etag)) {
+    webStatus(w, "304 Not Modified");
+    w.printf("ETag: %s\r\n", a.etag);
+    webEndHead(w, c, 0);
+    return;
+  }
+
+  File f = LittleFS.open(a.file, "r");
+  if (!f) {
+    webSendStatus(w, c, "404 Not Found");
+    return;
+  }
+
+  webStatus(w, "200 OK");
+  w.printf("Content-Type: %s\r\n"
+           "Content-Encoding: gzip\r\n"
+           "ETag: %s\r\n"
+           "Cache-Control: %s\r\n",
+           a.type, a.etag, WEB_CACHE);
+  webEndHead(w, c, a.size);
+  w.send(f);
+  f.close();
+}
+
+// append 'text' to the JSON buffer as a quoted string
+size_t webJsonString(char *buf, size_t pos, const char *text) {
+  if (pos < WEB_STATE_MAX)
+    buf[pos++] = '"';
+  for (; *text && (pos < WEB_STATE_MAX - 2); text++) {
+    if ((*text == '"') || (*text == '\\'))
+      buf[pos++] = '\\';
+    buf[pos++] = *text;
+  }
+  if (pos < WEB_STATE_MAX)
+    buf[pos++] = '"';
+  return pos;
+}
+
+size_t webJsonText(char *buf, size_t pos, const char *text) {
+  while (*text && (pos < WEB_STATE_MAX))
+    buf[pos++] = *text++;
+  return pos;
+}
+
+// current plans, sync role and the plan names for the buttons
+void webSendState(WebWriter &w, const WebClient &c) {
+  char body[WEB_STATE_MAX];
+  size_t pos;
+
+  pos = snprintf(body, sizeof(body), "{\"color\":%u,\"bright\":%u,\"sync\":%u,\"syncStatus\":",
+                 curColorPlan, curBrightPlan, syncRole);
+  pos = webJsonString(body, pos, syncStatus());
+  pos = webJsonText(body, pos, ",\"mqtt\":");
+  pos = webJsonString(body, pos, mqttStatus());
+  pos = webJsonText(body, pos, ",\"wifi\":");
+  pos = webJsonString(body, pos, wlanPath());
+  if (pos < WEB_STATE_MAX)
+    pos += snprintf(body + pos, WEB_STATE_MAX - pos, ",\"bootMs\":%u", (unsigned)wlanBootMs());
+  pos = webJsonText(body, pos, ",\"colorPlans\":[");
+  for (uint8_t i = 0; i <= lastColorPlan; i++) {
+    ColorPlan p;
+    getColorPlan(i, p);
+    if (i)
+      pos = webJsonText(body, pos, ",");
+    pos = webJsonString(body, pos, p.name);
+  }
+  pos = webJsonText(body, pos, "],\"brightPlans\":[");
+  for (uint8_t i = 0; i <= lastBrightPlan; i++) {
+    BrightPlan p;
+    getBrightPlan(i, p);
+    if (i)
+      pos = webJsonText(body, pos, ",");
+    pos = webJsonString(body, pos, p.name);
+  }
+  pos = webJsonText(body, pos, "],\"zones\":[");
+  for (uint8_t z = 0; z < zoneCount; z++) {
+    if (pos < WEB_STATE_MAX)
+      pos += snprintf(body + pos, WEB_STATE_MAX - pos, "%s{\"first\":%u,\"count\":%u,\"color\":%u,\"bright\":%u}",
+                      z ? "," : "", zone[z].first, zone[z].count, zone[z].color_plan, zone[z].bright_plan);
+  }
+  pos = webJsonText(body, pos, "]}");
+  pos = min(pos, (size_t)WEB_STATE_MAX);
+
+  webStatus(w, "200 OK");
+  w.print("Content-Type: application/json\r\n"
+          "Cache-Control: no-store\r\n");
+  webEndHead(w, c, pos);
+  w.write(body, pos);
+}
+
+// heap samples from heap.cpp
+void webSendHeap(WebWriter &w, WebClient &c) {
+  WebWriter length(c.client, true);
+  uint32_t now = millis();
+  heapJson(length, now);
+
+  webStatus(w, "200 OK");
+  w.print("Content-Type: application/json\r\n"
+          "Cache-Control: no-store\r\n");
+  webEndHead(w, c, length.length());
+  heapJson(w, now);
+}
+
+// show state and the stored shows from show.cpp, one snapshot for both passes
+void webSendShow(WebWriter &w, WebClient &c) {
+  static ShowSnapshot snap;   // kept off the stack
+  WebWriter length(c.client, true);
+
+  showSnapshot(snap);
+  showJson(length, snap);
+
+  webStatus(w, "200 OK");
+  w.print("Content-Type: application/json\r\n"
+          "Cache-Control: no-store\r\n");
+  webEndHead(w, c, length.length());
+  showJson(w, snap);
+}
+
+// built-in page, used when no web assets are installed
+void sendHTMLpage(Print &client) {
+  client.println("<!DOCTYPE HTML>");
+  client.println("<html>");
+  client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  client.println("<link rel=\"icon\" href=\"data:,\">");
+  
+  // CSS to style the on/off buttons 
+  client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
+  client.println(".button { background-color: #195B6A; border: none; color: white; padding: 16px 40px;");
+  client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
+  client.println(".button2 {background-color: #77878A;}</style></head>");
+    
+  // Web Page Heading
+  client.println("<body><h1>Night Light Web Server</h1>");
+    
+  // Display current DIM LEVEL and DISPLAY MODE
+  client.printf("<p>MODE - %s - %s</p>\r\n", curColor.name, curBright.name);
+  client.printf("<p>SYNC - %s</p>\r\n", syncStatus());
+
+  // and each zone's plans when the chain is split
+  for (uint8_t z = 0; (zoneCount > 1) && (z < zoneCount); z++) {
+    ColorPlan c;
+    BrightPlan b;
+    getColorPlan(zone[z].color_plan, c);
+    getBrightPlan(zone[z].bright_plan, b);
+    client.printf("<p>ZONE %u - %s - %s</p>\r\n", z + 1, c.name, b.name);
+  }
+
+  // display all of the MODE buttons
+  for(uint8_t i = 0; i <= lastColorPlan; i++) {
+    ColorPlan p;
+    getColorPlan(i, p);
+    client.printf("<p><a href=\"/m/%u\"><button class=\"button\">%s</button></a></p>\r\n", i, p.name);
+  }
+
+  // display all of the BRIGHTNESS buttons
+  for(uint8_t i = 0; i <= lastBrightPlan; i++) {
+    BrightPlan p;
+    getBrightPlan(i, p);
+    client.printf("<p><a href=\"/b/%u\"><button class=\"button\">%s</button></a></p>\r\n", i, p.name);
+  }
+
+  // display the SYNC role buttons
+  client.println("<p><a href=\"/s/0\"><button class=\"button button2\">Sync Off</button></a></p>");
+  client.println("<p><a href=\"/s/1\"><button class=\"button button2\">Sync Follow</button></a></p>");
+  client.println("<p><a href=\"/s/2\"><button class=\"button button2\">Sync Master</button></a></p>");
+
+  // end of HTML webpage
+  client.println("</body></html>");
+}
+
+void webSendPage(WebWriter &w, WebClient &c) {
+  // measure the page first, so it can go out with a Content-Length
+  WebWriter length(c.client, true);
+  sendHTMLpage(length);
+
+  webStatus(w, "200 OK");
+  w.print("Content-Type: text/html\r\n");
+  webEndHead(w, c, length.length());
+  sendHTMLpage(w);
+}
+
+/* requests */
+
+void processHTMLresponse(const char *path, const char *query) {
+  // first, look for MODE selection
+  if (!strncmp(path, "/m/", 3)) {
+    uint8_t value;
+    Serial.println("color plan change");
+    value = path[3] - '0';
+    Serial.print("converted value:");
+    Serial.println(value);
+
+    if (value <= lastColorPlan) {
+      selectColorPlan(value);
+      Serial.println(curColorPlan);
+    }
+  }
+  //next, look for BRIGHT selections
+  if (!strncmp(path, "/b/", 3)) {
+    uint8_t value;
+    Serial.println("bright plan change");
+    value = path[3] - '0';
+    Serial.print("converted value:");
+    Serial.println(value);
+
+    if (value <= lastBrightPlan) {
+      selectBrightPlan(value);
+      Serial.println(curBrightPlan);
+    }
+  }
+  //look for single zone selections, /z/Z/m/N and /z/Z/b/N
+  if (!strncmp(path, "/z/", 3) && ((uint8_t)(path[3] - '0') < zoneCount) &&
+      (path[4] == '/') && path[5] && (path[6] == '/')) {
+    uint8_t z = path[3] - '0';
+    uint8_t value = path[7] - '0';
+
+    if ((path[5] == 'm') && (value <= lastColorPlan))
+      selectZoneColorPlan(z, value);
+    if ((path[5] == 'b') && (value <= lastBrightPlan))
+      selectZoneBrightPlan(z, value);
+    Serial.printf("zone %u plans %u %u\r\n", z, zone[z].color_plan, zone[z].bright_plan);
+  }
+  //look for shows, /show/play/NAME[?t=MS], /show/record/NAME, /show/stop
+  if (!strncmp(path, "/show/", 6)) {
+    const char *name = strchr(path + 6, '/');
+
+    name = (name && (strlen(name + 1) <= SHOW_NAME_MAX)) ? name + 1 : "";
+    if (!strncmp(path + 6, "play/", 5))
+      showPlay(name, !strncmp(query, "t=", 2) ? strtoul(query + 2, NULL, 10) : 0);
+    else if (!strncmp(path + 6, "record/", 7))
+      showRecord(name);
+    else if (!strcmp(path + 6, "stop"))
+      showStop();
+  }
+  //last, look for SYNC role selections
+  if (!strncmp(path, "/s/", 3)) {
+    syncSetRole(path[3] - '0');
+  }
+}
+
+void webClose(WebClient &c) {
+  c.client.stop();
+  c.open = false;
+  Serial.println("client disconnected.");
+}
+
+// answer the request parsed into 'c.req'
+void webRespond(WebClient &c) {
+  const HttpRequest &r = c.req;
+  const char *path = r.path;
+
+  c.requests++;
+  c.idle_ms = millis();
+  if (r.close || (c.requests >= WEB_MAX_REQUESTS))
+    c.close = true;
+
+  if (r.status)
+    Serial.printf("bad request, %u\r\n", r.status);
+  else {
+    Serial.printf("%s %s%s%s\r\n", r.method, r.path, r.query[0] ? "?" : "", r.query);
+    if (!strcmp(r.method, "GET"))
+      processHTMLresponse(r.path, r.query);
+  }
+
+  {
+    WebWriter w(c.client);
+
+    if (r.status == 414)
+      webSendStatus(w, c, "414 URI Too Long");
+    else if (r.status == 431)
+      webSendStatus(w, c, "431 Request Header Fields Too Large");
+    else if (r.status)
+      webSendStatus(w, c, "400 Bad Request");
+    else if (strcmp(r.method, "GET"))
+      webSendStatus(w, c, "405 Method Not Allowed");
+    // the JSON API answers whether or not the web UI is installed
+    else if (!strcmp(path, "/api/state"))
+      webSendState(w, c);
+    else if (!strcmp(path, "/api/show"))
+      webSendShow(w, c);
+    else if (!strcmp(path, "/api/heap"))
+      webSendHeap(w, c);
+    else if (!web_ready)
+      webSendPage(w, c);
+    else if (!strncmp(path, "/m/", 3) || !strncmp(path, "/b/", 3) || !strncmp(path, "/s/", 3) ||
+             !strncmp(path, "/z/", 3))
+      webSendState(w, c);
+    else if (!strncmp(path, "/show/", 6))
+      webSendShow(w, c);
+    else {
+      uint8_t i;
+      for (i = 0; i < WEB_ASSETS; i++) {
+        if (!strcmp(path, webAsset[i].path) && webAsset[i].size)
+          break;
+      }
+      if (i < WEB_ASSETS)
+        webSendAsset(w, c, webAsset[i]);
+      else
+        webSendStatus(w, c, "404 Not Found");
+    }
+  }
+
+  if (c.close)
+    webClose(c);
+  httpBegin(c.req);
+}
+
+// parse whatever the client has sent straight out of its receive
+// buffer, answering each complete request
+void webService(WebClient &c) {
+  size_t len;
+
+  if (!c.open)
+    return;
+  if (!c.client.connected()) {
+    webClose(c);
+    return;
+  }
+
+  while (c.open && (len = c.client.peekAvailable())) {
+    size_t used = httpParse(c.req, c.client.peekBuffer(), len);
+    c.client.peekConsume(used);
+    if (c.req.done)
+      webRespond(c);
+  }
+
+  // drop keep-alive connections the browser stopped using
+  if (c.open && ((uint32_t)(millis() - c.idle_ms) > WEB_IDLE_MS))
+    webClose(c);
+}
+
+void webRestart() {
+  for (uint8_t i = 0; i < WEB_CLIENTS; i++) {
+    if (webClient[i].open)
+      webClose(webClient[i]);
+  }
+}
+
+void webPoll() {
+  WiFiClient client = webServer.accept();
+
+  if (client) {
+    WebClient *c = NULL;
+    for (uint8_t i = 0; (i < WEB_CLIENTS) && !c; i++) {
+      if (!webClient[i].open)
+        c = &webClient[i];
+    }
+    // all in use: make room by closing the one idle the longest
+    if (!c) {
+      c = &webClient[0];
+      for (uint8_t i = 1; i < WEB_CLIENTS; i++) {
+        if ((int32_t)(webClient[i].idle_ms - c->idle_ms) < 0)
+          c = &webClient[i];
+      }
+      webClose(*c);
+    }
+    Serial.println("new client");
+    c->client = client;
+    c->client.setNoDelay(true);
+    c->open = true;
+    c->close = false;
+    c->requests = 0;
+    c->idle_ms = millis();
+    httpBegin(c->req);
+  }
+
+  for (uint8_t i = 0; i < WEB_CLIENTS; i++)
+    webService(webClient[i]);
+}
@@ -0,0 +1,268 @@
+/*
+  LED LAVA LAMP - fast WiFi connect at boot
+
+  see wlan.h for an overview
+
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <EEPROM.h>
+#include "LittleFS.h"
+#include "wlan.h"
+
+#define WLAN_MAGIC (0x4C574331)   // "LWC1"
+
+// the access point and address of the last connect, in the EEPROM sector
+struct WlanCache {
+  uint32_t magic;
+  char ssid[33];
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t mask;
+  uint32_t dns;
+  uint16_t sum;
+};
+
+static_assert(sizeof(WlanCache) <= WLAN_EEPROM_SIZE, "WlanCache does not fit WLAN_EEPROM_SIZE");
+
+WlanCache wlan_cache;
+bool wlan_cached;             // wlan_cache is for the configured network
+
+bool wlan_static;             // WLAN_FILE fixes the address
+IPAddress wlan_ip;
+IPAddress wlan_gateway;
+IPAddress wlan_mask;
+IPAddress wlan_dns;
+
+uint8_t wlan_path = WLAN_SCAN;
+uint32_t wlan_begin_ms;       // millis() when the direct connect started
+uint32_t wlan_ready_ms;       // millis() when the web server was ready
+bool wlan_leased;             // running on the cached copy of a DHCP lease
+uint32_t wlan_lost_ms;        // millis() when the link went down, 0 = up
+uint32_t wlan_addr;           // the address the services were started on
+
+/* settings */
+
+void wlanLine(char *line) {
+  IPAddress *ip = NULL;
+  char *arg;
+
+  if ((line[0] == '#') || !line[0])
+    return;
+  line[strcspn(line, "\r")] = 0;
+  arg = strchr(line, ' ');
+  if (!arg)
+    return;
+  *arg++ = 0;
+  while (*arg == ' ')
+    arg++;
+  arg[strcspn(arg, " #")] = 0;
+
+  if (!strcmp(line, "ip"))
+    ip = &wlan_ip;
+  else if (!strcmp(line, "gateway"))
+    ip = &wlan_gateway;
+  else if (!strcmp(line, "mask"))
+    ip = &wlan_mask;
+  else if (!strcmp(line, "dns"))
+    ip = &wlan_dns;
+  if (!ip || !ip->fromString(arg))
+    Serial.printf("wifi: bad line '%s'\r\n", line);
+}
+
+void wlanLoad() {
+  File f = LittleFS.open(WLAN_FILE, "r");
+  char line[WLAN_LINE_MAX];
+  uint8_t len = 0;
+  int c;
+
+  if (!f)
+    return;
+  do {
+    c = f.read();
+    if ((c < 0) || (c == '\n')) {
+      line[len] = 0;
+      wlanLine(line);
+      len = 0;
+    }
+    else if (len < sizeof(line) - 1)
+      line[len++] = c;
+  } while (c >= 0);
+  f.close();
+
+  wlan_static = wlan_ip.isSet() && wlan_gateway.isSet() && wlan_mask.isSet();
+  if (!wlan_static) {
+    if (wlan_ip.isSet() || wlan_gateway.isSet() || wlan_mask.isSet())
+      Serial.println("wifi: " WLAN_FILE " needs ip, gateway and mask, using DHCP");
+    return;
+  }
+  if (!wlan_dns.isSet())
+    wlan_dns = wlan_gateway;
+  Serial.print("wifi: static address ");
+  Serial.println(wlan_ip);
+}
+
+/* cache */
+
+uint16_t wlanSum(const WlanCache &c) {
+  const uint8_t *p = (const uint8_t *)&c;
+  uint16_t sum = 0;
+
+  for (size_t i = 0; i < offsetof(WlanCache, sum); i++)
+    sum = ((sum << 1) | (sum >> 15)) + p[i];
+  return sum;
+}
+
+// write 'c' to the EEPROM sector, only when it differs from what is
+// there (every commit erases and rewrites a flash sector)
+void wlanStore(WlanCache &c) {
+  c.sum = wlanSum(c);
+  if (!memcmp(&c, &wlan_cache, sizeof(c)))
+    return;
+  wlan_cache = c;
+  EEPROM.put(WLAN_EEPROM_ADDR, wlan_cache);
+  EEPROM.commit();
+  Serial.println("wifi: connection cached");
+}
+
+void wlanLease(WlanCache &c) {
+  c.ip = WiFi.localIP();
+  c.gateway = WiFi.gatewayIP();
+  c.mask = WiFi.subnetMask();
+  c.dns = WiFi.dnsIP();
+}
+
+/* connecting */
+
+void wlanBegin() {
+  String ssid = WiFi.SSID();
+
+  if (LittleFS.begin())
+    wlanLoad();
+
+  EEPROM.begin(WLAN_EEPROM_SIZE);
+  EEPROM.get(WLAN_EEPROM_ADDR, wlan_cache);
+  wlan_cached = (wlan_cache.magic == WLAN_MAGIC) && (wlan_cache.sum == wlanSum(wlan_cache)) && wlan_cache.ip &&
+                ssid.length() && !strncmp(ssid.c_str(), wlan_cache.ssid, sizeof(wlan_cache.ssid));
+  if (!wlan_cached) {
+    Serial.println("wifi: no connection cached");
+    return;
+  }
+
+  // straight to the cached access point, with a fixed address; none of
+  // it goes to the flash settings (WiFiManager's credentials stay there)
+  WiFi.persistent(false);
+  if (wlan_static)
+    WiFi.config(wlan_ip, wlan_gateway, wlan_mask, wlan_dns);
+  else
+    WiFi.config(IPAddress(wlan_cache.ip), IPAddress(wlan_cache.gateway), IPAddress(wlan_cache.mask),
+                IPAddress(wlan_cache.dns));
+  WiFi.begin(wlan_cache.ssid, WiFi.psk().c_str(), wlan_cache.channel, wlan_cache.bssid);
+  WiFi.persistent(true);
+  wlan_begin_ms = millis();
+  Serial.printf("wifi: connecting to %s on channel %u\r\n", wlan_cache.ssid, wlan_cache.channel);
+}
+
+// WiFiManager opens its portal
+void wlanPortal(WiFiManager *wm) {
+  (void)wm;
+  wlan_path = WLAN_PORTAL;
+  Serial.println("wifi: no network, portal NightLightAP open");
+}
+
+void wlanConnect(WiFiManager &wm) {
+  WlanCache c;
+
+  if (wlan_cached) {
+    while ((WiFi.status() != WL_CONNECTED) && (millis() - wlan_begin_ms < WLAN_FAST_MS))
+      delay(10);
+    if (WiFi.status() == WL_CONNECTED) {
+      wlan_path = WLAN_FAST;
+      wlan_leased = !wlan_static;
+    }
+    else {
+      // forget the access point (and the cached address) again
+      Serial.println("wifi: cached access point not found, scanning");
+      WiFi.persistent(false);
+      if (!wlan_static)
+        WiFi.config(0U, 0U, 0U);
+      WiFi.begin(wlan_cache.ssid, WiFi.psk().c_str());
+      WiFi.persistent(true);
+    }
+  }
+
+  if (wlan_path != WLAN_FAST) {
+    if (wlan_static)
+      wm.setSTAStaticIPConfig(wlan_ip, wlan_gateway, wlan_mask);
+    wm.setAPCallback(wlanPortal);
+    // WiFi manager fetches ssid and pass from flash and tries to connect
+    // if it does not connect it starts an access point with the name
+    // "NightLightAP" and goes into a blocking loop awaiting configuration
+    wm.autoConnect("NightLightAP");
+  }
+
+  // remember where we are for the next boot
+  String ssid = WiFi.SSID();
+  memset(&c, 0, sizeof(c));
+  c.magic = WLAN_MAGIC;
+  strncpy(c.ssid, ssid.c_str(), sizeof(c.ssid) - 1);
+  memcpy(c.bssid, WiFi.BSSID(), sizeof(c.bssid));
+  c.channel = WiFi.channel();
+  wlanLease(c);
+  wlanStore(c);
+  wlan_addr = WiFi.localIP();
+}
+
+void wlanReady() {
+  wlan_ready_ms = millis();
+  Serial.printf("wifi: %s connect, web server ready %u ms after boot\r\n", wlanPath(), wlan_ready_ms);
+}
+
+bool wlanPoll() {
+  WlanCache c;
+  IPAddress ip;
+
+  if (WiFi.status() != WL_CONNECTED) {
+    if (!wlan_lost_ms)
+      wlan_lost_ms = millis() | 1;
+    else if (wlan_leased && (millis() - wlan_lost_ms >= WLAN_FAST_MS)) {
+      // the cached lease may have run out at the router: reconnect with DHCP
+      Serial.println("wifi: link lost, back to DHCP");
+      WiFi.config(0U, 0U, 0U);
+      wlan_leased = false;
+    }
+    return false;
+  }
+  wlan_lost_ms = 0;
+  if (wlan_leased && (millis() - wlan_ready_ms >= WLAN_RENEW_MS)) {
+    // the cached lease may have run out at the router: ask DHCP again
+    Serial.println("wifi: renewing the cached lease");
+    WiFi.config(0U, 0U, 0U);
+    wlan_leased = false;
+    return false;
+  }
+
+  ip = WiFi.localIP();
+  if (!ip.isSet() || ((uint32_t)ip == wlan_addr))
+    return false;
+  wlan_addr = ip;
+  Serial.print("wifi: new address ");
+  Serial.println(ip);
+  c = wlan_cache;
+  wlanLease(c);
+  wlanStore(c);
+  return true;
+}
+
+const char *wlanPath() {
+  static const char *const names[] = { "fast", "scan", "portal" };
+
+  return names[wlan_path];
+}
+
+uint32_t wlanBootMs() {
+  return wlan_ready_ms;
+}
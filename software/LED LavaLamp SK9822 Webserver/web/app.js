@@ -0,0 +1,69 @@
+// Night Light page: the lamp state comes from /api/state and every
+// button press (/m/N, /b/N, /s/N, /z/Z/m/N, /z/Z/b/N) answers with the
+// new state. Shows come from /api/show, which /show/... answers with.
+
+var roles = ["Sync Off", "Sync Follow", "Sync Master"];
+var state;
+var zone = -1;    // zone the plan buttons change, -1 = the whole lamp
+
+function buttons(id, names, cls, current, action) {
+  var div = document.getElementById(id);
+  div.innerHTML = "";
+  names.forEach(function (name, i) {
+    var p = document.createElement("p");
+    var b = document.createElement("button");
+    b.className = cls + (i == current ? " active" : "");
+    b.textContent = name;
+    b.onclick = function () { action(i); };
+    p.appendChild(b);
+    div.appendChild(p);
+  });
+}
+
+function show(s) {
+  var zones = s.zones.length > 1 ? ["All Zones"] : [];
+  var plans = zone < 0 ? s : s.zones[zone];
+  var prefix = zone < 0 ? "" : "/z/" + zone;
+
+  state = s;
+  s.zones.forEach(function (z, i) {
+    if (zones.length)
+      zones.push("Zone " + (i + 1) + " - " + s.colorPlans[z.color] + " - " + s.brightPlans[z.bright]);
+  });
+  document.getElementById("mode").textContent =
+    "MODE - " + s.colorPlans[s.color] + " - " + s.brightPlans[s.bright];
+  document.getElementById("sync").textContent = "SYNC - " + s.syncStatus;
+  document.getElementById("mqtt").textContent = "MQTT - " + s.mqtt;
+  buttons("zone", zones, "button button2", zone + 1, function (i) { zone = i - 1; show(state); });
+  buttons("color", s.colorPlans, "button", plans.color, function (i) { load(prefix + "/m/" + i); });
+  buttons("bright", s.brightPlans, "button", plans.bright, function (i) { load(prefix + "/b/" + i); });
+  buttons("role", roles, "button button2", s.sync, function (i) { load("/s/" + i); });
+}
+
+function shows(s) {
+  var names = s.shows.map(function (x) { return x.name; });
+  var playing = s.state == "play" ? names.indexOf(s.name) : -1;
+
+  document.getElementById("show").textContent =
+    "SHOW - " + (s.state == "idle" ? "Off" : s.state + " " + s.name);
+  buttons("shows", names.concat(["Record", "Stop"]), "button button2", playing, function (i) {
+    var name;
+    if (i < names.length)
+      loadShow("/show/play/" + names[i]);
+    else if (i == names.length && (name = prompt("Show name (letters, digits, - and _)")))
+      loadShow("/show/record/" + encodeURIComponent(name));
+    else if (i > names.length)
+      loadShow("/show/stop");
+  });
+}
+
+function load(url) {
+  fetch(url).then(function (r) { return r.json(); }).then(show);
+}
+
+function loadShow(url) {
+  fetch(url).then(function (r) { return r.json(); }).then(shows);
+}
+
+load("/api/state");
+loadShow("/api/show");
@@ -0,0 +1,405 @@
+/*
+  LED LAVA LAMP engine
+  Tom LeMense
+
+  Shared by the Webserver, Dimmable and Test firmwares: the sine and
+  gamma tables, the phase accumulators and the effect pipeline
+
+    color source -> brightness modulation -> gamma -> output encoder
+
+  Each stage is a small struct with a static inline function, and
+  LavaPipeline<> glues one of each together at compile time. The plan
+  options (color effect, brightness effect, gamma) are looked up once
+  when a plan is selected (lavaRenderer()), which hands back a pointer
+  to the specialized render function. The per-LED loop inside it is
+  straight-line code with no 'if (efftyp == ...)' tests.
+
+  Per-channel LED calibration (gain, gamma, white point; LavaCalib) is
+  folded in when a plan is selected: lavaBuildLut() composes the sine
+  table, gamma and the channel correction into one table per channel,
+  so LavaLutColor needs a single table read per channel and no gamma
+  stage (lavaRendererLut()).
+
+  Hue plans (LAVA_COLOR_HSV, LAVA_COLOR_OKLAB) move along a hue circle
+  instead of three independent sines, which pass through muddy,
+  desaturated colors. HSV and OKLCh (OKLab in polar form, where equal
+  hue steps look equally far apart) are converted in integer math
+  (lava_color.cpp); at plan selection lavaBuildHueLut() turns the plan
+  into one table of hue -> calibrated color and one of level ->
+  multiplier, so LavaHueColor costs three table reads and three
+  multiplies per LED. The hue may step along the chain (a gradient)
+  and the level (value or lightness) may breathe on the sine table.
+
+  The output encoder is the strip itself: any class with startFrame(),
+  sendColor(r, g, b, brightness) and endFrame(count), such as the
+  Pololu APA102<> template. LavaSpan is such an encoder writing into a
+  framebuffer instead, so a chain split into zones can have each zone
+  drawn by its own pipeline and then be sent in one go (lavaShow()).
+
+  A framebuffer costs 4 bytes per LED and every LED runs the pipeline
+  every frame. With a palette instead, the pipeline draws only the
+  palette: LAVA_PALETTE_SIZE steps of the hue circle (lavaFillPalette(),
+  a single entry for plans without a hue), and every LED keeps one byte,
+  its hue offset along the chain (lavaPaletteIndex(), set once per plan).
+  lavaShowPalette() looks the LED up on the way out, interpolating
+  between entries for palettes shorter than 256. A frame then costs
+  O(palette) plus the send, and an effect that moves the whole chain
+  (the hue phase, the level, the brightness) only redraws the palette.
+
+ */
+
+#ifndef LAVA_ENGINE_H
+#define LAVA_ENGINE_H
+
+#include <Arduino.h>
+
+// COLOR effect types
+#define LAVA_COLOR_FIXED (0)    // plan 'init' is the color
+#define LAVA_COLOR_SINE (1)     // plan 'init' is the start phase (x256)
+#define LAVA_COLOR_HSV (2)      // hue and value trajectory in HSV
+#define LAVA_COLOR_OKLAB (3)    // hue and lightness trajectory in OKLCh
+
+// Define the sine table length (7-bit phase index)
+#define LAVA_SINE_STEPS (128)
+
+// Define the hue table length (8-bit hue index)
+#define LAVA_HUE_STEPS (256)
+
+// Define the entries of a palette (16..256, a power of two)
+#ifndef LAVA_PALETTE_SIZE
+#define LAVA_PALETTE_SIZE (256)
+#endif
+
+// Define the size of a hue plan's tables: the color of every hue step
+// per channel, then the level multiplier of every sine step per channel
+#define LAVA_HUE_LUT (3 * (LAVA_HUE_STEPS + LAVA_SINE_STEPS))
+
+// BRIGHT effect types
+#define LAVA_BRIGHT_FIXED (0)   // plan 'init' is the 5-bit brightness
+#define LAVA_BRIGHT_FADE (1)    // brightness follows the sine table
+
+// 128 entry SINE lookup table -- AMPL = 120, OFFSET = 135
+// (both tables live in flash: read them with pgm_read_byte())
+extern const uint8_t sinetbl[128];
+
+// Gamma brightness lookup table, gamma = 2.50 steps = 256 range = 0-255
+extern const uint8_t gamma_lut[256];
+
+struct ColorTuple {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+};
+
+// everything the pipeline needs to draw one frame
+struct LavaFrame {
+  ColorTuple phase;       // color phase accumulators (LAVA_COLOR_SINE)
+  ColorTuple color;       // fixed color (LAVA_COLOR_FIXED)
+  uint16_t bright_phase;  // brightness phase accumulator (LAVA_BRIGHT_FADE)
+  uint8_t bright;         // fixed 5-bit brightness (LAVA_BRIGHT_FIXED)
+  const uint8_t *lut;     // fused r, g, b tables, 3 x LAVA_SINE_STEPS (LavaLutColor)
+                          // or hue tables, LAVA_HUE_LUT (LavaHueColor)
+  uint16_t spread;        // hue step from one LED to the next (LavaHueColor)
+};
+
+// one LED of a framebuffer
+struct LavaPixel {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t bright;         // 5-bit brightness
+};
+
+// per-channel LED calibration, each array is r, g, b
+struct LavaCalib {
+  uint8_t gain[3];        // I-V / strip batch correction, 255 = 1.0
+  uint16_t gamma[3];      // gamma x100, 250 = the gamma_lut curve
+  uint8_t white[3];       // white point, 255 = full
+};
+
+// no correction, gamma 2.5 on every channel
+extern const LavaCalib lavaCalibNone;
+
+// one channel value through gamma (if 'gamma'), gain and white point,
+// in integer steps as used to build the tables
+uint8_t lavaCalibrate(const LavaCalib &cal, uint8_t ch, uint8_t v, bool gamma);
+
+// the same in floating point, straight from the definition; the
+// reference the tables are checked against, too slow for plan loads
+uint8_t lavaCalibrateRef(const LavaCalib &cal, uint8_t ch, uint8_t v, bool gamma);
+
+// fill 'lut' (3 x LAVA_SINE_STEPS) with the fused sine -> gamma ->
+// calibration tables of the three channels
+void lavaBuildLut(const LavaCalib &cal, bool gamma, uint8_t *lut);
+
+// integer HSV -> RGB: 'hue' is a full circle in 16 bits, 'sat' and
+// 'val' are 0..255
+void lavaHsv(uint16_t hue, uint8_t sat, uint8_t val, uint8_t &r, uint8_t &g, uint8_t &b);
+
+// fixed-point OKLCh -> linear RGB: 'hue' is a full circle in 16 bits
+// (8 of them used), 'light' 0..255 is L 0..1, 'chroma' 0..255 is C
+// 0..0.4; colors outside sRGB are clipped, and false returned
+bool lavaOklch(uint16_t hue, uint8_t light, uint8_t chroma, uint8_t &r, uint8_t &g, uint8_t &b);
+
+// the largest chroma up to 'chroma' that 'hue' and 'light' have in sRGB
+uint8_t lavaOklchFit(uint16_t hue, uint8_t light, uint8_t chroma);
+
+// the same in floating point, straight from the definitions; the
+// references the integer versions are checked against
+void lavaHsvRef(uint16_t hue, uint8_t sat, uint8_t val, uint8_t &r, uint8_t &g, uint8_t &b);
+void lavaOklchRef(uint16_t hue, uint8_t light, uint8_t chroma, uint8_t &r, uint8_t &g, uint8_t &b);
+
+// fill 'lut' (LAVA_HUE_LUT) for a hue plan of type 'efftyp': 'a' and
+// 'b' are saturation and value (HSV) or lightness and chroma (OKLAB,
+// reduced to the gamut hue by hue), the colors go through gamma (if
+// 'gamma') and the calibration
+void lavaBuildHueLut(const LavaCalib &cal, uint8_t efftyp, uint8_t a, uint8_t b, bool gamma, uint8_t *lut);
+
+// sine table entry for the upper 7 bits of a phase accumulator
+static inline uint8_t lavaSine(uint16_t phase) {
+  return pgm_read_byte(&sinetbl[(phase >> 8) & 0x7f]);
+}
+
+// advance the phase accumulators by 'frames' display frames
+static inline void lavaAdvance(ColorTuple &phase, const ColorTuple &inc, uint16_t frames) {
+  phase.r += inc.r * frames;
+  phase.g += inc.g * frames;
+  phase.b += inc.b * frames;
+}
+
+/* color sources */
+
+struct LavaFixedColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    (void)led;
+    r = f.color.r;
+    g = f.color.g;
+    b = f.color.b;
+  }
+};
+
+struct LavaSineColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    (void)led;
+    r = lavaSine(f.phase.r);
+    g = lavaSine(f.phase.g);
+    b = lavaSine(f.phase.b);
+  }
+};
+
+// sine, gamma and calibration in one table read per channel
+struct LavaLutColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    (void)led;
+    r = f.lut[(f.phase.r >> 8) & 0x7f];
+    g = f.lut[LAVA_SINE_STEPS + ((f.phase.g >> 8) & 0x7f)];
+    b = f.lut[2 * LAVA_SINE_STEPS + ((f.phase.b >> 8) & 0x7f)];
+  }
+};
+
+// hue tables: the hue phase plus the LED's step along the chain picks
+// the color, the level phase scales it
+struct LavaHueColor {
+  static inline void get(const LavaFrame &f, uint16_t led, uint8_t &r, uint8_t &g, uint8_t &b) {
+    const uint8_t *level = f.lut + 3 * LAVA_HUE_STEPS + ((f.phase.g >> 8) & 0x7f);
+    uint8_t h = (uint16_t)(f.phase.r + led * f.spread) >> 8;
+    r = (f.lut[h] * (level[0] + 1)) >> 8;
+    g = (f.lut[LAVA_HUE_STEPS + h] * (level[LAVA_SINE_STEPS] + 1)) >> 8;
+    b = (f.lut[2 * LAVA_HUE_STEPS + h] * (level[2 * LAVA_SINE_STEPS] + 1)) >> 8;
+  }
+};
+
+/* brightness modulation */
+
+struct LavaFixedBright {
+  static inline uint8_t get(const LavaFrame &f, uint16_t led) {
+    (void)led;
+    return f.bright & 0x1F;
+  }
+};
+
+struct LavaFadeBright {
+  static inline uint8_t get(const LavaFrame &f, uint16_t led) {
+    (void)led;
+    return lavaSine(f.bright_phase) >> 3;
+  }
+};
+
+/* gamma */
+
+struct LavaGamma {
+  static inline uint8_t apply(uint8_t v) { return pgm_read_byte(&gamma_lut[v]); }
+};
+
+struct LavaNoGamma {
+  static inline uint8_t apply(uint8_t v) { return v; }
+};
+
+/* pipeline */
+
+template<class Color, class Bright, class Gamma>
+struct LavaPipeline {
+  template<class Strip>
+  static void render(Strip &strip, const LavaFrame &f, uint16_t count) {
+    uint8_t r, g, b;
+
+    strip.startFrame();
+    for (uint16_t i = 0; i < count; i++) {
+      Color::get(f, i, r, g, b);
+      strip.sendColor(Gamma::apply(r), Gamma::apply(g), Gamma::apply(b), Bright::get(f, i));
+    }
+    strip.endFrame(count);
+  }
+};
+
+template<class Strip>
+using LavaRenderFn = void (*)(Strip &strip, const LavaFrame &f, uint16_t count);
+
+template<class Strip, class Color, class Bright>
+LavaRenderFn<Strip> lavaRendererGamma(bool gamma) {
+  if (gamma)
+    return &LavaPipeline<Color, Bright, LavaGamma>::template render<Strip>;
+  return &LavaPipeline<Color, Bright, LavaNoGamma>::template render<Strip>;
+}
+
+template<class Strip, class Color>
+LavaRenderFn<Strip> lavaRendererBright(uint8_t bright_efftyp, bool gamma) {
+  if (bright_efftyp == LAVA_BRIGHT_FADE)
+    return lavaRendererGamma<Strip, Color, LavaFadeBright>(gamma);
+  return lavaRendererGamma<Strip, Color, LavaFixedBright>(gamma);
+}
+
+// pick the specialized render function for a plan; call once per plan
+// change, not per frame (hue plans need tables: lavaRendererLut())
+template<class Strip>
+LavaRenderFn<Strip> lavaRenderer(uint8_t color_efftyp, uint8_t bright_efftyp, bool gamma) {
+  if (color_efftyp == LAVA_COLOR_SINE)
+    return lavaRendererBright<Strip, LavaSineColor>(bright_efftyp, gamma);
+  return lavaRendererBright<Strip, LavaFixedColor>(bright_efftyp, gamma);
+}
+
+// pick the render function for a calibrated plan: LAVA_COLOR_SINE reads
+// the fused tables in f.lut, the hue plans their hue tables there,
+// LAVA_COLOR_FIXED expects f.color already calibrated (lavaCalibrate()),
+// so none applies gamma per frame
+template<class Strip>
+LavaRenderFn<Strip> lavaRendererLut(uint8_t color_efftyp, uint8_t bright_efftyp) {
+  if (color_efftyp == LAVA_COLOR_SINE)
+    return lavaRendererBright<Strip, LavaLutColor>(bright_efftyp, false);
+  if ((color_efftyp == LAVA_COLOR_HSV) || (color_efftyp == LAVA_COLOR_OKLAB))
+    return lavaRendererBright<Strip, LavaHueColor>(bright_efftyp, false);
+  return lavaRendererBright<Strip, LavaFixedColor>(bright_efftyp, false);
+}
+
+/* framebuffer */
+
+// output encoder that fills a framebuffer from 'next' on
+struct LavaSpan {
+  LavaPixel *next;
+
+  void startFrame() {}
+  void sendColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t brightness) {
+    next->r = red;
+    next->g = green;
+    next->b = blue;
+    next->bright = brightness;
+    next++;
+  }
+  void endFrame(uint16_t count) { (void)count; }
+};
+
+// send a framebuffer of 'count' LED to the strip
+template<class Strip>
+void lavaShow(Strip &strip, const LavaPixel *fb, uint16_t count) {
+  strip.startFrame();
+  for (uint16_t i = 0; i < count; i++)
+    strip.sendColor(fb[i].r, fb[i].g, fb[i].b, fb[i].bright);
+  strip.endFrame(count);
+}
+
+/* palette */
+
+// draw one frame of a pipeline into the palette 'pal' of Size entries:
+// entry k is the color of the hue phase plus k / Size of the circle;
+// plans without a hue (f.spread 0) draw only entry 0
+template<uint16_t Size = LAVA_PALETTE_SIZE>
+void lavaFillPalette(LavaRenderFn<LavaSpan> render, const LavaFrame &f, LavaPixel *pal) {
+  static_assert((Size >= 16) && (Size <= 256) && !(Size & (Size - 1)), "palette size");
+  LavaFrame pf = f;
+  LavaSpan span = { pal };
+
+  pf.spread = 65536 / Size;
+  render(span, pf, f.spread ? Size : 1);
+}
+
+// the palette index of 'count' LED stepping 'spread' along the hue
+// circle, 256 to the circle (LavaHueColor's h minus the phase)
+inline void lavaPaletteIndex(uint8_t *ix, uint16_t count, uint16_t spread) {
+  for (uint16_t i = 0; i < count; i++)
+    ix[i] = (uint16_t)(i * spread) >> 8;
+}
+
+// send 'count' LED looking their index up in 'pal'; with fewer than 256
+// entries an index between two entries gets a blend of both (the last
+// one blends into the first, round the hue circle); the brightness is
+// the lower entry's
+template<uint16_t Size = LAVA_PALETTE_SIZE, class Strip>
+void lavaSendPalette(Strip &strip, const LavaPixel *pal, const uint8_t *ix, uint16_t count) {
+  const uint8_t step = 256 / Size;
+
+  for (uint16_t i = 0; i < count; i++) {
+    const LavaPixel &a = pal[ix[i] / step];
+    int16_t w = (ix[i] & (step - 1)) * Size;
+    if (!w) {
+      strip.sendColor(a.r, a.g, a.b, a.bright);
+      continue;
+    }
+    const LavaPixel &b = pal[(ix[i] / step + 1) & (Size - 1)];
+    strip.sendColor(a.r + (((b.r - a.r) * w) >> 8), a.g + (((b.g - a.g) * w) >> 8),
+                    a.b + (((b.b - a.b) * w) >> 8), a.bright);
+  }
+}
+
+// send a chain drawn through one palette (zones with a palette each:
+// startFrame(), lavaSendPalette() per zone, endFrame())
+template<uint16_t Size = LAVA_PALETTE_SIZE, class Strip>
+void lavaShowPalette(Strip &strip, const LavaPixel *pal, const uint8_t *ix, uint16_t count) {
+  strip.startFrame();
+  lavaSendPalette<Size>(strip, pal, ix, count);
+  strip.endFrame(count);
+}
+
+/* whole-chain helpers */
+
+// turn OFF all of the LED by setting RBGI = 0000
+template<class Strip>
+void lavaBlank(Strip &strip, uint16_t count) {
+  strip.startFrame();
+  for (uint16_t i = 0; i < count; i++)
+    strip.sendColor(0, 0, 0, 0);
+  strip.endFrame(count);
+}
+
+// make all the LED the same RGBI color
+template<class Strip>
+void lavaFill(Strip &strip, uint16_t count, uint8_t red, uint8_t green, uint8_t blue, uint8_t bright) {
+  strip.startFrame();
+  for (uint16_t i = 0; i < count; i++)
+    strip.sendColor(red, green, blue, bright & 0x1F);
+  strip.endFrame(count);
+}
+
+// set only LED 'led' to an RGBI color, the others OFF
+template<class Strip>
+void lavaFillOne(Strip &strip, uint16_t count, uint16_t led, uint8_t red, uint8_t green, uint8_t blue, uint8_t bright) {
+  strip.startFrame();
+  for (uint16_t i = 0; i < count; i++) {
+    if (i == led)
+      strip.sendColor(red, green, blue, bright & 0x1F);
+    else
+      strip.sendColor(0, 0, 0, 0);
+  }
+  strip.endFrame(count);
+}
+
+#endif
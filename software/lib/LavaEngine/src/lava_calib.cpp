@@ -0,0 +1,43 @@
+/*
+  LED LAVA LAMP engine - per-channel calibration
+
+ */
+
+#include <math.h>
+#include "LavaEngine.h"
+
+const LavaCalib lavaCalibNone = {
+  .gain = { 255, 255, 255 },
+  .gamma = { 250, 250, 250 },
+  .white = { 255, 255, 255 }
+};
+
+uint8_t lavaCalibrate(const LavaCalib &cal, uint8_t ch, uint8_t v, bool gamma) {
+  uint32_t g = v;
+
+  if (gamma) {
+    if (cal.gamma[ch] == 250)
+      g = pgm_read_byte(&gamma_lut[v]);
+    else
+      g = (uint32_t)(255.0 * pow(v / 255.0, cal.gamma[ch] / 100.0) + 0.5);
+  }
+  // gain and white point together, 255 x 255 = 1.0
+  return (g * cal.gain[ch] * cal.white[ch] + 65025 / 2) / 65025;
+}
+
+uint8_t lavaCalibrateRef(const LavaCalib &cal, uint8_t ch, uint8_t v, bool gamma) {
+  double x = v / 255.0;
+
+  if (gamma)
+    x = pow(x, cal.gamma[ch] / 100.0);
+  x *= cal.gain[ch] / 255.0;
+  x *= cal.white[ch] / 255.0;
+  return (uint8_t)(x * 255.0 + 0.5);
+}
+
+void lavaBuildLut(const LavaCalib &cal, bool gamma, uint8_t *lut) {
+  for (uint8_t ch = 0; ch < 3; ch++) {
+    for (uint8_t i = 0; i < LAVA_SINE_STEPS; i++)
+      lut[ch * LAVA_SINE_STEPS + i] = lavaCalibrate(cal, ch, pgm_read_byte(&sinetbl[i]), gamma);
+  }
+}
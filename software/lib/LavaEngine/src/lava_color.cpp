@@ -0,0 +1,178 @@
+/*
+  LED LAVA LAMP engine - HSV and OKLab color spaces
+
+  Integer only: the ESP8266 has a 32-bit multiplier but no FPU and no
+  divider, so the conversions use Q12 fixed point, shifts and a
+  quarter-wave cosine table. The floating-point versions (Ref) are the
+  definitions the integer ones are checked against.
+
+ */
+
+#include <math.h>
+#include "LavaEngine.h"
+
+// cos() of a quarter circle in 64 steps, Q12 (4096 = 1.0)
+static const int16_t lava_cos12[65] PROGMEM = {
+  4096, 4095, 4091, 4085, 4076, 4065, 4052, 4036,
+  4017, 3996, 3973, 3948, 3920, 3889, 3857, 3822,
+  3784, 3745, 3703, 3659, 3612, 3564, 3513, 3461,
+  3406, 3349, 3290, 3229, 3166, 3102, 3035, 2967,
+  2896, 2824, 2751, 2675, 2598, 2520, 2440, 2359,
+  2276, 2191, 2106, 2019, 1931, 1842, 1751, 1660,
+  1567, 1474, 1380, 1285, 1189, 1092, 995, 897,
+  799, 700, 601, 501, 401, 301, 201, 101,
+  0
+};
+
+// cosine of an 8-bit angle (256 = full circle), Q12
+static int32_t lavaCos12(uint8_t angle) {
+  uint8_t i = angle & 0x3f;
+
+  switch (angle >> 6) {
+    case 0: return (int16_t)pgm_read_word(&lava_cos12[i]);
+    case 1: return -(int16_t)pgm_read_word(&lava_cos12[64 - i]);
+    case 2: return -(int16_t)pgm_read_word(&lava_cos12[i]);
+  }
+  return (int16_t)pgm_read_word(&lava_cos12[64 - i]);
+}
+
+// x / 255, rounded, for x up to 65535 (no divider on the ESP8266)
+static inline uint8_t lavaDiv255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+void lavaHsv(uint16_t hue, uint8_t sat, uint8_t val, uint8_t &r, uint8_t &g, uint8_t &b) {
+  uint32_t h6 = (uint32_t)hue * 6;      // sector in the upper 16 bits
+  uint8_t f = h6 >> 8;                  // position in the sector
+  uint8_t p = lavaDiv255(val * (255 - sat));
+  uint8_t q = lavaDiv255(val * (255 - lavaDiv255(sat * f)));
+  uint8_t t = lavaDiv255(val * (255 - lavaDiv255(sat * (255 - f))));
+
+  switch (h6 >> 16) {
+    case 0: r = val; g = t; b = p; break;
+    case 1: r = q; g = val; b = p; break;
+    case 2: r = p; g = val; b = t; break;
+    case 3: r = p; g = q; b = val; break;
+    case 4: r = t; g = p; b = val; break;
+    default: r = val; g = p; b = q; break;
+  }
+}
+
+void lavaHsvRef(uint16_t hue, uint8_t sat, uint8_t val, uint8_t &r, uint8_t &g, uint8_t &b) {
+  double h = hue * 6.0 / 65536.0, s = sat / 255.0, v = val / 255.0;
+  double f = h - floor(h);
+  double p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+  double c[3];
+
+  switch ((int)h) {
+    case 0: c[0] = v; c[1] = t; c[2] = p; break;
+    case 1: c[0] = q; c[1] = v; c[2] = p; break;
+    case 2: c[0] = p; c[1] = v; c[2] = t; break;
+    case 3: c[0] = p; c[1] = q; c[2] = v; break;
+    case 4: c[0] = t; c[1] = p; c[2] = v; break;
+    default: c[0] = v; c[1] = p; c[2] = q; break;
+  }
+  r = (uint8_t)(c[0] * 255.0 + 0.5);
+  g = (uint8_t)(c[1] * 255.0 + 0.5);
+  b = (uint8_t)(c[2] * 255.0 + 0.5);
+}
+
+// Q12 linear light, clipped, to 0..255; 'in' is cleared when clipped
+// by more than rounding
+static inline uint8_t lavaLinear8(int32_t x, bool &in) {
+  if (x <= 0) {
+    in &= (x > -8);
+    return 0;
+  }
+  if (x >= 4096) {
+    in &= (x < 4104);
+    return 255;
+  }
+  return (x * 255 + 2048) >> 12;
+}
+
+static inline int32_t lavaCube12(int32_t x) {
+  return (((x * x) >> 12) * x) >> 12;
+}
+
+// OKLab matrices of Björn Ottosson in Q12: L, a, b -> l', m', s' and
+// the cubed l, m, s -> linear sRGB
+bool lavaOklch(uint16_t hue, uint8_t light, uint8_t chroma, uint8_t &r, uint8_t &g, uint8_t &b) {
+  int32_t L = (light << 4) + (light >> 4);        // 255 -> 4095
+  int32_t C = (chroma * 1645) >> 8;               // 255 -> 0.4
+  int32_t A = (C * lavaCos12(hue >> 8)) >> 12;
+  int32_t B = (C * lavaCos12((hue >> 8) - 64)) >> 12;
+  int32_t l = lavaCube12(L + ((1623 * A + 884 * B) >> 12));
+  int32_t m = lavaCube12(L - ((432 * A + 262 * B) >> 12));
+  int32_t s = lavaCube12(L - ((367 * A + 5290 * B) >> 12));
+  bool in = true;
+
+  r = lavaLinear8((16698 * l - 13548 * m + 946 * s) >> 12, in);
+  g = lavaLinear8((-5195 * l + 10689 * m - 1398 * s) >> 12, in);
+  b = lavaLinear8((-17 * l - 2881 * m + 6994 * s) >> 12, in);
+  return in;
+}
+
+uint8_t lavaOklchFit(uint16_t hue, uint8_t light, uint8_t chroma) {
+  uint8_t lo = 0, hi = chroma, r, g, b;
+
+  if (lavaOklch(hue, light, chroma, r, g, b))
+    return chroma;
+  // largest chroma in the gamut; it is convex, so bisect
+  while (lo < hi) {
+    uint8_t mid = (lo + hi + 1) / 2;
+    if (lavaOklch(hue, light, mid, r, g, b))
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+void lavaOklchRef(uint16_t hue, uint8_t light, uint8_t chroma, uint8_t &r, uint8_t &g, uint8_t &b) {
+  double h = (hue >> 8) * 2 * M_PI / 256.0;
+  double L = light / 255.0, C = chroma * 0.4 / 255.0;
+  double A = C * cos(h), B = C * sin(h);
+  double l = pow(L + 0.3963377774 * A + 0.2158037573 * B, 3);
+  double m = pow(L - 0.1055613458 * A - 0.0638541728 * B, 3);
+  double s = pow(L - 0.0894841775 * A - 1.2914855480 * B, 3);
+  double c[3] = { 4.0767416621 * l - 3.3077115913 * m + 0.2309699292 * s,
+                  -1.2684380046 * l + 2.6097574011 * m - 0.3413193965 * s,
+                  -0.0041960863 * l - 0.7034186147 * m + 1.7076147010 * s };
+  uint8_t out[3];
+
+  for (int ch = 0; ch < 3; ch++)
+    out[ch] = (uint8_t)(fmin(fmax(c[ch], 0.0), 1.0) * 255.0 + 0.5);
+  r = out[0];
+  g = out[1];
+  b = out[2];
+}
+
+void lavaBuildHueLut(const LavaCalib &cal, uint8_t efftyp, uint8_t a, uint8_t b, bool gamma, uint8_t *lut) {
+  // gamma alone, for the level multipliers (gain and white point are
+  // in the colors already)
+  LavaCalib curve = lavaCalibNone;
+  uint8_t rgb[3];
+
+  for (uint16_t h = 0; h < LAVA_HUE_STEPS; h++) {
+    if (efftyp == LAVA_COLOR_OKLAB)
+      lavaOklch(h << 8, a, lavaOklchFit(h << 8, a, b), rgb[0], rgb[1], rgb[2]);
+    else
+      lavaHsv(h << 8, a, b, rgb[0], rgb[1], rgb[2]);
+    for (uint8_t ch = 0; ch < 3; ch++)
+      lut[ch * LAVA_HUE_STEPS + h] = lavaCalibrate(cal, ch, rgb[ch], gamma);
+  }
+
+  // the level follows the sine table; it scales HSV value, and OKLab
+  // lightness and chroma together, which scales linear light by its
+  // cube (and keeps it in the gamut, hence the fitted chroma above)
+  memcpy(curve.gamma, cal.gamma, sizeof(curve.gamma));
+  for (uint8_t i = 0; i < LAVA_SINE_STEPS; i++) {
+    uint32_t k = pgm_read_byte(&sinetbl[i]);
+    if (efftyp == LAVA_COLOR_OKLAB)
+      k = lavaDiv255(lavaDiv255(k * k) * k);
+    for (uint8_t ch = 0; ch < 3; ch++)
+      lut[3 * LAVA_HUE_STEPS + ch * LAVA_SINE_STEPS + i] = lavaCalibrate(curve, ch, k, gamma);
+  }
+}